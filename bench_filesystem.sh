@@ -0,0 +1,162 @@
+#!/bin/bash
+
+# Benchmark suite: generate a synthetic tree, then time the main commands
+# with and without the real-filesystem mirror.
+# Usage: ./bench_filesystem.sh        (or: make bench)
+#
+# Tree shape, all overridable from the environment:
+#   FANOUT        folders per folder                  (default: 4)
+#   DEPTH         levels of folders below the root    (default: 5)
+#   FILES         files per folder                    (default: 8)
+#   NAME_LENGTH   length of every generated name      (default: 12)
+#   CONTENT_SIZE  bytes written to each file, 0=none  (default: 64)
+#   QUERIES       cd/lookup/ls calls in the query run (default: 5000)
+#   WALK_THREADS  thread counts for the parallel walk  (default: 1 2 4 ... nproc)
+#
+# Results are JSON lines, one per command and run, appended to $RESULTS
+# (default: bench_results.jsonl) with ops/s, p50/p99 latency and peak RSS.
+
+GREEN="\e[32m"
+RED="\e[31m"
+CYAN="\e[36m"
+RESET="\e[0m"
+
+EXECUTABLE="$(pwd)/linux_file_system.out"
+RESULTS="$(pwd)/${RESULTS:-bench_results.jsonl}"
+BENCH_DIR="bench_dir"
+
+FANOUT=${FANOUT:-4}
+DEPTH=${DEPTH:-5}
+FILES=${FILES:-8}
+NAME_LENGTH=${NAME_LENGTH:-12}
+CONTENT_SIZE=${CONTENT_SIZE:-64}
+QUERIES=${QUERIES:-5000}
+if [[ -z "$WALK_THREADS" ]]; then
+    WALK_THREADS=1
+    for ((threads = 2; threads <= $(nproc); threads *= 2)); do WALK_THREADS="$WALK_THREADS $threads"; done
+fi
+
+if [[ ! -f "$EXECUTABLE" ]]; then
+    echo -e "${RED}Error:${RESET} Executable '$EXECUTABLE' not found. Please compile your program first."
+    exit 1
+fi
+
+rm -rf $BENCH_DIR
+mkdir $BENCH_DIR
+cd $BENCH_DIR
+
+# Generator: writes the command script that builds the tree (build.txt)
+# and the absolute paths of its folders and files (folders.txt, files.txt)
+generate_tree() {
+    awk -v fanout="$FANOUT" -v depth="$DEPTH" -v files="$FILES" \
+        -v namelen="$NAME_LENGTH" -v content="$CONTENT_SIZE" '
+    function pad(s) {
+        while (length(s) < namelen) s = s "x"
+        return s
+    }
+    function gen(path, level,    i, name) {
+        for (i = 0; i < files; i++) {
+            name = pad("f" i "_")
+            print "touch " name > "build.txt"
+            if (content > 0) {
+                print "edit " name > "build.txt"
+                print body > "build.txt"
+            }
+            print path "/" name > "files.txt"
+        }
+        if (level == depth) return
+        for (i = 0; i < fanout; i++) {
+            name = pad("d" i "_")
+            print "mkdir " name > "build.txt"
+            print "cd " name > "build.txt"
+            print path "/" name > "folders.txt"
+            gen(path "/" name, level + 1)
+            print "cdup" > "build.txt"
+        }
+    }
+    BEGIN {
+        body = ""
+        while (length(body) < content) body = body "abcdefghijklmnopqrstuvwxyz"
+        body = substr(body, 1, content)
+        gen("", 0)
+        print "save tree.txt" > "build.txt"
+        print "save -b tree.snap" > "build.txt"
+        print "exit" > "build.txt"
+    }'
+}
+
+# Query script: random cd/lookup/ls over the loaded tree, then whole-tree commands
+generate_queries() {
+    awk -v queries="$QUERIES" '
+    FILENAME == "folders.txt" { folders[nfolders++] = $0; next }
+    FILENAME == "files.txt"   { files[nfiles++] = $0; next }
+    END {
+        srand(42)
+        print "load -b tree.snap"
+        for (i = 0; i < queries; i++) {
+            print "cd " folders[int(rand() * nfolders)]
+            print "ls"
+            print "lookup " files[int(rand() * nfiles)]
+        }
+        print "cd /"
+        for (i = 0; i < 5; i++) {
+            print "lsrecursive"
+            print "sortBy name"
+            print "sortBy date"
+        }
+        for (i = 0; i < 5; i++) {
+            print "save tree.txt"
+            print "load tree.txt"
+            print "save -b tree.snap"
+            print "load -b tree.snap"
+        }
+        print "exit"
+    }' folders.txt files.txt > queries.txt
+}
+
+# run <label> <script> [flags]: time one batch run and tag its report lines
+run() {
+    local label=$1 script=$2
+    shift 2
+    local report
+    report=$(mktemp)
+    "$EXECUTABLE" -b "$script" -r "$report" "$@" > /dev/null 2>&1
+    sed "s/^{/{\"run\":\"$label\",/" "$report" | tee -a "$RESULTS"
+    rm -f "$report"
+}
+
+generate_tree
+generate_queries
+echo -e "${CYAN}Benchmark:${RESET} fan-out $FANOUT, depth $DEPTH, $FILES files/folder," \
+        "$(wc -l < folders.txt) folders, $(wc -l < files.txt) files, names $NAME_LENGTH, content ${CONTENT_SIZE}B"
+
+run build-mirror build.txt
+rm -rf ./d*_* ./f*_*               # Drop the mirrored tree before the next build
+run build-virtual build.txt -n
+run query-mirror queries.txt
+run query-virtual queries.txt -n
+
+# Listing throughput: whole-tree and sorted listings into a non-terminal,
+# buffered and through stdio field by field (-u, the unbuffered baseline)
+{ echo "load -b tree.snap"; for i in $(seq 1 20); do echo "lsrecursive"; echo "ls --sort=date"; done; echo "exit"; } > listing.txt
+BUFFERED=$(run listing listing.txt -n | grep '"ls')
+UNBUFFERED=$(run listing-unbuffered listing.txt -n -u | grep '"ls')
+echo "$BUFFERED"
+echo "$UNBUFFERED"
+SPEEDUP=$(awk 'match($0, /"command":"[^"]*"/) { command = substr($0, RSTART + 11, RLENGTH - 12) }
+               match($0, /"seconds":[0-9.]+/) { seconds = substr($0, RSTART + 10, RLENGTH - 10) }
+               FNR == NR { unbuffered[command] = seconds; next }
+               seconds > 0 { printf "%s %.1fx  ", command, unbuffered[command] / seconds }' \
+          <(echo "$UNBUFFERED") <(echo "$BUFFERED"))
+echo -e "${CYAN}Listing speedup over -u:${RESET} $SPEEDUP"
+
+# Scaling of the parallel walk (count -w) with the number of threads
+for threads in $WALK_THREADS; do
+    { echo "load -b tree.snap"; for i in $(seq 1 20); do echo "count -w -t $threads"; done; echo "exit"; } > walk.txt
+    run "walk-t$threads" walk.txt -n | grep '"count"'
+done
+
+echo -e "${GREEN}Done:${RESET} results appended to $RESULTS"
+
+cd ..
+rm -rf $BENCH_DIR
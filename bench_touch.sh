@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Benchmark: bulk-populate a single folder with `touch`.
+# Usage: ./bench_touch.sh [count]   (default: 1000000)
+
+GREEN="\e[32m"
+RED="\e[31m"
+CYAN="\e[36m"
+RESET="\e[0m"
+
+EXECUTABLE="$(pwd)/linux_file_system.out"
+COUNT=${1:-1000000}
+BENCH_DIR="bench_dir"
+
+if [[ ! -f "$EXECUTABLE" ]]; then
+    echo -e "${RED}Error:${RESET} Executable '$EXECUTABLE' not found. Please compile your program first."
+    exit 1
+fi
+
+rm -rf $BENCH_DIR
+mkdir $BENCH_DIR
+cd $BENCH_DIR
+
+echo -e "${CYAN}Benchmark:${RESET} $COUNT touch calls into one folder..."
+
+# Generate the command stream up front so only the filesystem is timed
+SCRIPT=$(mktemp)
+{
+    echo "mkdir big"
+    echo "cd big"
+    seq -f "touch file%.0f" 1 $COUNT
+    echo "ls"
+    echo "exit"
+} > "$SCRIPT"
+
+START=$(date +%s.%N)
+$EXECUTABLE < "$SCRIPT" > /dev/null 2>&1
+END=$(date +%s.%N)
+
+CREATED=$(ls big | wc -l)
+ELAPSED=$(awk "BEGIN { printf \"%.2f\", $END - $START }")
+RATE=$(awk "BEGIN { printf \"%.0f\", $COUNT / ($END - $START) }")
+echo -e "${GREEN}Done:${RESET} $CREATED files in ${ELAPSED}s ($RATE touch/s)"
+
+cd ..
+rm -rf $BENCH_DIR "$SCRIPT"
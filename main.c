@@ -1,16 +1,39 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h> // For bgsave
 #include <time.h>
 #include <zlib.h> // For compression and decompression
+#include <pthread.h> // For the parallel compression pipeline
+#include <sched.h>
+#include <stdatomic.h>
+#include <fnmatch.h> // For find -name
+#include <regex.h>   // For find -regex
+#ifdef __SSE2__
+#include <emmintrin.h> // For the substring kernel behind find -content
+#endif
 #include <termios.h> // For real time color updates
 
 #define MAX_PATH_LENGTH 2048
 
 enum nodeType {File, Folder, Symlink};
 
+// Orders a folder keeps its children in, besides the list order
+enum orderKind {OrderByName, OrderByDate};
+
+// Host filesystem changes queued for the write-behind mirror
+enum mirrorOpType {MirrorRegister, MirrorMkdir, MirrorCreate, MirrorWrite, MirrorPatch, MirrorRemoveFile, MirrorRemoveDir};
+
 // Define Google colors using ANSI escape codes
 const char* YELLOW = "\033[38;5;226m"; // Google Yellow
 const char* CYAN = "\033[36m";         // Cyan for folders
@@ -18,20 +41,191 @@ const char* BLUE = "\033[38;5;33m";    // Google Blue for symlinks
 const char* GREEN = "\033[38;5;46m"; // Google Green
 const char* RESET = "\033[0m";       // Reset to default
 
+// Commands, and answers to the questions some commands ask, are read from here
+FILE* inputStream;
+
+// Set when commands come from a script or a pipe: no prompts or colors, buffered output
+int batchMode = 0;
+
+// Cleared by -n to keep every change in the virtual tree only
+int mirrorEnabled = 1;
+
+// Totals for a subtree, the subtree's root included
+typedef struct subtreeStats {
+    uint64_t files;
+    uint64_t folders;
+    uint64_t symlinks;
+    uint64_t bytes;          // Sum of the File sizes
+} subtreeStats;
+
+// Nodes refer to each other by their slot in the node table (see nodeAt):
+// 32 bits instead of a pointer, 0 standing for none
+typedef uint32_t nodeRef;
+
+#define NODE_INLINE_NAME 16  // Names up to 15 bytes are kept in the node itself
+
+// Everything only a folder has, in a side table the folder points to
+typedef struct folderData {
+    nodeRef child;
+    nodeRef lastChild;       // Tail of the child list, for O(1) appends
+    int numberOfItems;       // Number of direct children, kept by linkChild/unlinkChild
+    uint32_t indexCapacity;  // Number of buckets in the name index
+    uint32_t indexCount;     // Number of children in the name index
+    nodeRef* index;          // Name index over the children, chained through node.hashNext
+    struct orderPage* order[2]; // Ordered indexes over the children, by orderKind
+    uint64_t lazyRecord;     // 1 + snapshot record whose children are not built yet, 0 once built
+    uint64_t mirrorId;       // Host directory id once mirrored, 0 before
+    uint64_t segment;        // Offset of the children's segment in the tree's segmented snapshot, 0 while dirty
+    subtreeStats stats;      // Kept up to date along the parent chain by every mutator
+} folderData;
+
+// 64 bytes: links, type and flag bits, the name inline when it is short,
+// and one pointer whose meaning depends on the type. Per-subtree totals of
+// files and symlinks follow from their type and size (see nodeStats)
 typedef struct node {
-    enum nodeType type;
-    char* name;
-    int numberOfItems;
+    nodeRef self;            // The node's own slot
+    nodeRef parentRef;       // Links, read through nodeParent, nodePrevious and nodeNext
+    nodeRef previousRef;
+    nodeRef nextRef;
+    nodeRef hashNextRef;     // Next node in the parent's name index bucket
+    unsigned int type : 2;   // enum nodeType
+    unsigned int longName : 1;   // The name is in nameStorage.heap, not inlined
+    unsigned int hasHistory : 1; // Has a snapshot history (see nodeHistoryOf)
+    union {
+        char inlined[NODE_INLINE_NAME];
+        char* heap;
+    } nameStorage;           // Read through nodeName
     size_t size;
     time_t date;
-    char* content;
-    struct node* previous;
-    struct node* parent;
-    struct node* next;
-    struct node* child;
-    char* symlinkTarget; // For symbolic links
+    union {
+        struct fileContent* content; // Files: chunked content, NULL until first written
+        char* symlinkTarget;         // Symlinks
+        folderData* dir;             // Folders
+    };
 } node;
 
+_Static_assert(sizeof(node) == 64, "node layout changed");
+
+// Callbacks of a parallel walk: visit() folds one node into a thread's
+// accumulator, reduce() folds one accumulator into the walk's total
+typedef void (*walkVisitor)(node* item, void* accumulator, void* argument);
+typedef void (*walkReducer)(void* total, const void* partial);
+
+// Trees are built out of arenas: nodes come from chunks of the node table
+// with a free list, and long names, contents, symlink targets and index
+// buckets come from power-of-two size classes carved out of slabs. Dropping
+// a whole tree (exit, load) releases the chunks and slabs without visiting
+// a single node.
+#define ARENA_SLAB_SIZE (1 << 20)
+#define ARENA_MIN_CLASS 16
+#define ARENA_CLASS_COUNT 11 // 16 bytes .. 16 KiB, anything larger gets its own block
+
+typedef struct arenaBlock {
+    struct arenaBlock* next;
+    struct arenaBlock* previous;
+    size_t size;
+    size_t padding;          // Keeps the payload 16-byte aligned
+} arenaBlock;
+
+typedef struct freeChunk {
+    struct freeChunk* next;
+} freeChunk;
+
+// Content-addressed index of the file contents of one tree (see contentIntern)
+typedef struct contentStore {
+    struct fileContent** buckets; // Chained through fileContent.hashNext
+    size_t bucketCount;      // Power of two
+    size_t blobCount;        // Contents in the index
+    uint64_t distinct;       // Live contents, indexed or not
+    uint64_t references;     // Files holding some content
+    uint64_t logicalBytes;   // Sum of those files' lengths
+    uint64_t storedBytes;    // Bytes in live chunks, a shared chunk counted once
+    uint64_t hits;           // Interned contents that were already stored
+} contentStore;
+
+// The segmented snapshot a tree was last saved to or loaded from (see saveSegmented)
+typedef struct segmentFile {
+    char* path;              // NULL: none, so the next save -s re-encodes everything
+    dev_t device;
+    ino_t inode;
+    uint64_t end;            // Size of the file after that save
+    uint64_t generation;     // Its header's generation then
+    uint64_t epoch;          // Bumped by every full rewrite; content offsets of older epochs are void
+} segmentFile;
+
+// In-memory snapshots of the tree (see snapshotTake). Epochs count the
+// snapshots taken: one taken at epoch e sees every node state that began at
+// or before e and had not been replaced by then
+typedef struct treeSnapshot {
+    uint32_t id;
+    uint32_t epoch;
+    node* root;
+    time_t taken;
+    subtreeStats stats;      // Totals of the tree when it was taken
+} treeSnapshot;
+
+typedef struct treeSnapshots {
+    treeSnapshot* list;      // Oldest first, so epochs ascend
+    size_t count;
+    size_t capacity;
+    uint32_t nextId;
+    uint32_t epoch;          // Epoch of the live tree
+    node** tracked;          // Nodes holding versions, or kept only for snapshots
+    size_t trackedCount;
+    size_t trackedCapacity;
+    uint64_t versions;       // Older node states held
+    uint64_t retired;        // Nodes out of the live tree that a snapshot still shows
+    struct nodeHistory** histories; // Node histories by node slot, chained through nodeHistory.hashNext
+    size_t historyBuckets;   // Power of two
+    size_t historyCount;
+} treeSnapshots;
+
+// Helpers timed for "stats" (see metricsRecord)
+enum helperMetric {
+    MetricGetNode,           // The lookups up to MetricParsePath are timed on a sample of calls
+    MetricGetNodeTypeless,
+    MetricParsePath,
+    MetricMirrorResolve,     // Opening a host directory from its registered parents
+    MetricMirrorSyscall,     // The mkdirat/openat/pwrite/unlinkat of one mirror operation
+    MetricSaveText,
+    MetricLoadText,
+    MetricSaveBinary,
+    MetricLoadBinary,
+    MetricSaveSegments,
+    MetricLoadSegments,
+    HELPER_METRIC_COUNT
+};
+
+// Nodes of one type and the bytes they take: node slots, folder records and long names
+typedef struct nodeUsage {
+    size_t nodes;
+    size_t bytes;
+} nodeUsage;
+
+typedef struct treeArena {
+    arenaBlock* blocks;      // Every slab and large allocation, freed together
+    char* bump;              // Unused tail of the newest slab
+    size_t bumpLeft;
+    uint32_t* nodeChunks;    // Node table chunks the arena's nodes live in
+    uint32_t nodeChunkCount;
+    uint32_t nodeChunkCapacity;
+    nodeRef freeNodes;       // Recycled node slots, chained through nextRef
+    nodeRef nextNode;        // Next unused slot of the newest chunk
+    uint32_t nodesLeft;      // Unused slots left in it
+    freeChunk* freeLists[ARENA_CLASS_COUNT]; // Recycled chunks per size class
+    struct snapshotMapping* mapping; // Snapshot that lazily loaded folders still point into
+    contentStore contents;   // Deduplicated file contents of the tree
+    segmentFile segments;    // Where the segment offsets in the tree's folders and contents point
+    treeSnapshots snapshots; // In-memory snapshots of the tree
+    nodeUsage usage[3];      // Nodes in the arena by enum nodeType (see nodeUsageAdd)
+} treeArena;
+
+// Arena that owns the live tree; createNode and the string helpers use it
+treeArena* activeArena = NULL;
+
+// Set while a lazily loaded folder's children are built, which is no change a snapshot must keep
+int materializing = 0;
+
 // Function to create a new folder in the current directory
 // void make_dir(node* currentFolder, char* command, char* currentPath);
 
@@ -41,12 +235,23 @@ typedef struct node {
 // Function to list files and folders in the current directory
 void ls(node* currentFolder);
 
+// Functions to format one ls line into the listing buffer, and to list a folder in name or date order over a key range
+void lsEntry(node* currentNode, int indentCount, int recursive);
+void lsLine(enum nodeType type, int numberOfItems, size_t size, time_t date, const char* name,
+            int indentCount, int recursive);
+void lsSorted(node* currentFolder, char* command);
+
 // Function to recursively list files and folders in the current directory
 void lsrecursive(node* currentFolder, int indentCount);
 
 // Function to edit the content of an existing file
 void edit(node* currentFolder, char* command);
 
+// Functions to append to a file, or overwrite part of it, touching only the affected chunks
+void writeAt(node* currentFolder, char* fileName, long long offset);
+void append(node* currentFolder, char* command);
+void writeCommand(node* currentFolder, char* command);
+
 // Function to print the current directory's full path
 void pwd(char* path);
 
@@ -56,6 +261,21 @@ node* cd(node* currentFolder, char* command, char** path, node *root);
 // Function to move up to the parent directory
 node* cdup(node* currentFolder, char** path);
 
+// Function to resolve a path through the path cache, reporting the missing component
+node* resolvePath(node* currentFolder, const char* path, node* root, char* missing, size_t missingSize);
+
+// Function to drop every path cache entry
+void pathCacheClear(void);
+
+// Function to drop cached lookups that a node leaving its place would make stale
+void pathCacheNodeLeaving(node* item);
+
+// Function to drop cached misses that a node arriving at its place would make stale
+void pathCacheNodeArrived(node* item);
+
+// Function to print the path cache counters
+void pathCacheReport(void);
+
 // Function to free a node (and its children)
 void freeNode(node* freeingNode);
 
@@ -68,14 +288,24 @@ void rm(node* currentFolder, char* command);
 // Function to move a node (file or folder) to another location
 void mov(node* currentFolder, char* command);
 
+// Functions to queue host filesystem changes and wait for them to land
+void mirrorSubmit(enum mirrorOpType type, uint64_t directory, const char* name, const char* content, uint64_t id);
+void mirrorSubmitPatch(uint64_t directory, const char* name, size_t offset, const char* data, size_t length);
+uint64_t mirrorFolderId(node* folder);
+void mirrorFlush(void);
+void mirrorShutdown(void);
+
 // Function to count the total number of files in the entire directory tree
 int countFiles(node* folder);
 
-// // Function to save the directory structure to a file or compressed file
-// void saveDirectory(node* folder, void* file);
+// Functions to save/load the directory structure as a binary snapshot
+void saveSnapshot(node* root, const char* filename);
+node* loadSnapshot(const char* filename);
+node* loadSnapshotLazy(const char* filename);
 
-// // Function to load the directory structure from a file or compressed file
-// node* loadDirectory(gzFile gz, node* parent);
+// Functions to save/load the directory structure as a segmented snapshot, rewriting only what changed
+void saveSegmented(node* root, const char* filename);
+node* loadSegmented(const char* filename);
 
 // Function to merge two directories, resolving conflicts interactively
 void mergeDirectories(node* destFolder, node* srcFolder);
@@ -86,8 +316,24 @@ int createSymlink(node* currentFolder, char* sourcePath, char* linkName, node* r
 // Function to sort files and folders in the current directory by name or date
 void sortDirectory(node* folder, const char* criterion);
 
+// Functions to change a node without any output, shared by the commands and journal replay
+void renameChild(node* currentNode, const char* newName);
+void sortChildren(node* folder, enum orderKind kind);
+int setContent(node* file, const char* data, size_t length, time_t date);
+int writeContent(node* file, size_t offset, const char* data, size_t length, time_t date);
+
+// Functions to record tree changes in the write-ahead journal (no-ops without -j)
+void journalCreate(node* item);
+void journalEdit(node* file, const char* data, size_t length);
+void journalWrite(node* file, size_t offset, const char* data, size_t length);
+void journalRemove(node* item);
+void journalMove(node* item, node* destination, const char* newName);
+void journalRename(node* item, const char* newName);
+void journalSort(node* folder, enum orderKind kind);
+void journalReset(node* root);
+
 // Function to compress the entire directory structure into a compressed file
-void compressDirectory(node* folder, const char* filename);
+void compressDirectory(node* folder, const char* filename, int level, size_t blockSize, int threads);
 
 // Function to decompress a file and restore the directory structure
 node* decompressDirectory(const char* filename);
@@ -96,1440 +342,7637 @@ node* decompressDirectory(const char* filename);
 node* getNode(node *currentFolder, char* name, enum nodeType type);
 node* getNodeTypeless(node *currentFolder, char* name);
 
+// Functions to create and bulk-release a tree arena
+treeArena* arenaCreate(void);
+void arenaDestroy(treeArena* arena);
+void arenaFreeNodeChunks(treeArena* arena);
+
+// Functions to allocate and release memory owned by a tree arena
+void* arenaAlloc(treeArena* arena, size_t size);
+void arenaRelease(treeArena* arena, void* memory, size_t size);
+char* arenaStrdup(treeArena* arena, const char* str);
+void arenaFreeString(treeArena* arena, char* str);
+
+// Functions to reach a node through its slot in the node table, and its neighbours
+node* nodeAt(nodeRef ref);
+node* nodeParent(const node* item);
+node* nodeNext(const node* item);
+node* nodePrevious(const node* item);
+node* nodeChild(const node* item);
+
+// Functions to read and replace a node's name, inlined or in the arena
+char* nodeName(const node* item);
+int nodeSetName(node* item, const char* name);
+const char* nodeTarget(const node* item);
+int nodeSetNameLength(node* item, const char* name, size_t length);
+void nodeFreeName(node* item);
+
+// Function to allocate and initialize a detached node
+node* createNode(enum nodeType type, const char* name);
+
+// Functions to keep the node states that in-memory snapshots still show
+void nodeHistoryCreate(node* item);
+void nodeHistoryRelease(node* item);
+void preserveNode(node* item);
+int snapshotRetire(node* item);
+void releaseNode(node* item);
+void contentShare(struct fileContent* content);
+void contentHold(struct fileContent* content);
+void contentDrop(struct fileContent* content);
+
+// Functions to build the children of a lazily loaded folder on first use
+void materialize(node* folder);
+void materializeTree(node* folder);
+void unmapSnapshot(struct snapshotMapping* mapping);
+
+// Functions to link/unlink a node into a folder's child list and name index
+void linkChild(node* folder, node* child);
+void attachChild(node* folder, node* child);
+void unlinkChild(node* child);
+
+// Functions to keep the per-subtree totals in sync
+subtreeStats ownStats(node* item);
+subtreeStats nodeStats(node* item);
+void addStats(subtreeStats* total, const subtreeStats* delta);
+void propagateStats(node* folder, const subtreeStats* delta, int sign);
+void setNodeSize(node* item, size_t size);
+void markDirty(node* folder);
+void indexInsert(node* folder, node* child);
+void indexRemove(node* folder, node* child);
+void resizeIndex(node* folder, size_t capacity);
+size_t hashName(const char* name);
+
+// Functions to keep a folder's children ordered by name and by date
+void orderInsert(node* folder, enum orderKind kind, node* item);
+void orderRemove(node* folder, enum orderKind kind, node* item);
+void orderFree(struct orderPage* page);
+void setNodeDate(node* item, time_t date);
+
+// Function to visit a subtree on a work-stealing thread pool and reduce the per-thread results
+int parallelWalk(node* root, int threads, walkVisitor visit, void* argument,
+                 size_t accumulatorSize, walkReducer reduce, void* total);
+
+// Function to search a subtree by name glob and content, streaming matching paths
+void find(node* currentFolder, node* root, char* command);
+
+// Function to copy a host directory tree into the current folder, scanning it on a thread pool
+int importHostTree(node* currentFolder, char* command);
+
+// Function to get the seconds between two clock_gettime readings
+double elapsedSeconds(const struct timespec* start, const struct timespec* end);
+
+// Functions to time the hot helpers and count node allocations for "stats"
+uint64_t metricsNow(void);
+uint64_t metricsStart(enum helperMetric metric);
+void metricsRecord(enum helperMetric metric, uint64_t started);
+void nodeUsageAdd(const node* item, long long nodes, long long bytes);
+void metricsPrint(void);
+void metricsReset(void);
+void metricsPoll(int final);
+
 // Function to read and display the contents of a file
 void echo(node* currentFolder, char* fileName, node* root);
 
 // Function to display coloful nodes
 void displayNode(node* item);
 
-char* getString() {
-    size_t size = 10;
-    char* str = (char*)malloc(size);
-    size_t len = 0;
-    int ch;
+// Metrics for "stats": call counts and latency histograms for every command
+// and the hot helpers, and node allocations by type. Histograms are
+// HDR-style: values under 2^HISTOGRAM_SUB_BITS ns have a bucket each, and
+// every power of two above is split into 2^HISTOGRAM_SUB_BITS linear
+// buckets, so a value is known to within 1/16 over the whole 64-bit range
+// in under a thousand counters. The counters are relaxed atomics, since the
+// mirror worker and walker threads record too. Every helper call is
+// counted, but the lookups, which take well under a microsecond, are timed
+// on one call in METRICS_SAMPLE_PERIOD only, as a clock read costs tens of
+// nanoseconds.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+#define METRICS_COMMAND_SLOTS 64 // Room for every command table entry, checked below the table
+#define METRICS_SAMPLE_PERIOD 16
+
+typedef struct latencyHistogram {
+    atomic_ullong totalNs;
+    atomic_ullong buckets[HISTOGRAM_BUCKETS];
+} latencyHistogram;
+
+const char* helperMetricNames[HELPER_METRIC_COUNT] = {
+    "getNode", "getNodeTypeless", "parsePath", "mirrorOpenDirectory", "mirrorSyscall",
+    "saveDirectoryToFile", "loadDirectoryFromFile", "writeSnapshot", "readSnapshot",
+    "segmentWriteFolder", "segmentReadFolder",
+};
+
+// Node allocations since the last reset, by enum nodeType
+typedef struct nodeAllocations {
+    atomic_ullong created;
+    atomic_ullong freed;
+    atomic_ullong createdBytes;
+    atomic_ullong freedBytes;
+} nodeAllocations;
+
+typedef struct metricsState {
+    latencyHistogram helpers[HELPER_METRIC_COUNT];
+    atomic_ullong helperCalls[HELPER_METRIC_COUNT]; // Timed or not
+    latencyHistogram commands[METRICS_COMMAND_SLOTS]; // By command table entry
+    nodeAllocations allocations[3];
+    struct timespec since;   // Start, or the last reset
+    FILE* dump;              // "stats dump" target, NULL while off
+    double dumpInterval;     // Seconds between dumps
+    struct timespec lastDump;
+} metricsState;
+
+metricsState metrics;
+
+uint64_t metricsNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
 
-    while ((ch = fgetc(stdin)) != EOF && ch != '\n') {
-        if (len + 1 >= size) {
-            size += 16;
-            str = (char*)realloc(str, size);
-        }
-        str[len++] = ch;
-    }
-    str[len] = '\0';
-    return str;
+size_t histogramBucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return (size_t)value;
+    int magnitude = 63 - __builtin_clzll(value); // At least HISTOGRAM_SUB_BITS here
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    return (size_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
 }
 
-// Week 2: Count Total Files
-int countFiles(node* folder) {
-    if (!folder) return 0;
+// Highest value a bucket stands for, which is what percentiles report
+uint64_t histogramBucketLimit(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    int shift = (int)(bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t low = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
 
-    int count = 0;
-    if (folder->type == File) {
-        count++;
-    }
+void histogramRecord(latencyHistogram* histogram, uint64_t nanoseconds) {
+    atomic_fetch_add_explicit(&histogram->totalNs, nanoseconds, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->buckets[histogramBucket(nanoseconds)], 1, memory_order_relaxed);
+}
 
-    node* currentNode = folder->child;
-    while (currentNode) {
-        count += countFiles(currentNode);
-        currentNode = currentNode->next;
-    }
-    return count;
+// Count a helper call and read the clock if this call is to be timed; 0 if not
+uint64_t metricsStart(enum helperMetric metric) {
+    unsigned long long calls = atomic_fetch_add_explicit(&metrics.helperCalls[metric], 1, memory_order_relaxed);
+    int sampled = metric <= MetricParsePath;
+    return !sampled || calls % METRICS_SAMPLE_PERIOD == 0 ? metricsNow() : 0;
 }
 
-int countFolders(node* folder) {
-    if (!folder) return 0;
+// Time since started (a metricsStart reading) for one call of a helper
+void metricsRecord(enum helperMetric metric, uint64_t started) {
+    if (started) histogramRecord(&metrics.helpers[metric], metricsNow() - started);
+}
 
-    int count = 0;
-    if (folder->type == Folder) {
-        count++;
+// Account for nodes (and bytes) of item's type entering (positive) or leaving
+// (negative) the active arena
+void nodeUsageAdd(const node* item, long long nodes, long long bytes) {
+    nodeUsage* usage = &activeArena->usage[item->type];
+    nodeAllocations* allocations = &metrics.allocations[item->type];
+    usage->nodes += (size_t)nodes;
+    usage->bytes += (size_t)bytes;
+    if (nodes > 0) atomic_fetch_add_explicit(&allocations->created, (unsigned long long)nodes, memory_order_relaxed);
+    if (nodes < 0) atomic_fetch_add_explicit(&allocations->freed, (unsigned long long)-nodes, memory_order_relaxed);
+    if (bytes > 0) atomic_fetch_add_explicit(&allocations->createdBytes, (unsigned long long)bytes, memory_order_relaxed);
+    if (bytes < 0) atomic_fetch_add_explicit(&allocations->freedBytes, (unsigned long long)-bytes, memory_order_relaxed);
+}
+
+treeArena* arenaCreate(void) {
+    return calloc(1, sizeof(treeArena));
+}
+
+// Release every slab of the arena at once; no node needs to be visited
+void arenaDestroy(treeArena* arena) {
+    if (!arena) return;
+
+    unmapSnapshot(arena->mapping);
+    free(arena->segments.path);
+    free(arena->snapshots.list);
+    free(arena->snapshots.tracked);
+    arenaFreeNodeChunks(arena);
+    for (int type = 0; type < 3; type++) {
+        // Its nodes go without a visit, all of them freed at once
+        atomic_fetch_add(&metrics.allocations[type].freed, arena->usage[type].nodes);
+        atomic_fetch_add(&metrics.allocations[type].freedBytes, arena->usage[type].bytes);
     }
 
-    node* currentNode = folder->child;
-    while (currentNode) {
-        count += countFiles(currentNode);
-        currentNode = currentNode->next;
+    arenaBlock* block = arena->blocks;
+    while (block) {
+        arenaBlock* nextBlock = block->next;
+        free(block);
+        block = nextBlock;
     }
-    return count;
+    free(arena);
 }
 
-void getRealPath(node* currentFolder, char* realPath) {
-    // Temporary buffer to build the path
-    char tempPath[1024] = "";
-    node* folder = currentFolder;
+arenaBlock* arenaAddBlock(treeArena* arena, size_t size) {
+    arenaBlock* block = malloc(sizeof(arenaBlock) + size);
+    if (!block) return NULL;
 
-    while (folder != NULL && strcmp(folder->name, "/") != 0) {
-        // Prepend the current folder's name
-        char buffer[256];
-        snprintf(buffer, sizeof(buffer), "/%s", folder->name);
-        strcat(tempPath, buffer);
+    block->size = size;
+    block->previous = NULL;
+    block->next = arena->blocks;
+    if (arena->blocks) arena->blocks->previous = block;
+    arena->blocks = block;
+    return block;
+}
 
-        // Move to the parent folder
-        folder = folder->parent;
+// Carve size bytes (a multiple of 16) off the newest slab
+void* arenaCarve(treeArena* arena, size_t size) {
+    if (arena->bumpLeft < size) {
+        arenaBlock* slab = arenaAddBlock(arena, ARENA_SLAB_SIZE);
+        if (!slab) return NULL;
+        arena->bump = (char*)(slab + 1);
+        arena->bumpLeft = ARENA_SLAB_SIZE;
     }
+    void* memory = arena->bump;
+    arena->bump += size;
+    arena->bumpLeft -= size;
+    return memory;
+}
 
-    // Start from root if the current folder is the root node
-    if (folder == NULL) {
-        snprintf(realPath, 1024, "/");
-    } else {
-        // Reverse the constructed path to get the correct real path
-        snprintf(realPath, 1024, ".");
-        strncat(realPath, tempPath, 1024 - strlen(realPath) - 1);
+// Size class of an allocation, or -1 if it needs a block of its own
+int arenaClass(size_t size) {
+    size_t classSize = ARENA_MIN_CLASS;
+    for (int sizeClass = 0; sizeClass < ARENA_CLASS_COUNT; sizeClass++) {
+        if (size <= classSize) return sizeClass;
+        classSize <<= 1;
     }
+    return -1;
 }
 
-node* parsePath(node* currentFolder, char* path, node* root) {
-    // Handle absolute path
-    if (path[0] == '/') {
-        currentFolder = root;
-        path++; // Skip the initial '/'
+void* arenaAlloc(treeArena* arena, size_t size) {
+    int sizeClass = arenaClass(size);
+    if (sizeClass < 0) {
+        arenaBlock* block = arenaAddBlock(arena, size);
+        return block ? block + 1 : NULL;
     }
 
-    char* token = strtok(path, "/");
-    while (token != NULL) {
-        if (strcmp(token, "..") == 0) {
-            // Move to the parent directory
-            if (currentFolder->parent) {
-                currentFolder = currentFolder->parent;
-            } else {
-                printf("Already at the root directory.\n");
-            }
-        } else if (strcmp(token, ".") == 0) {
-            // Stay in the current directory (do nothing)
-        } else {
-            // Use getNodeTypeless to find the child node by name
-            node* nextFolder = getNodeTypeless(currentFolder, token);
-            if (nextFolder) {
-                currentFolder = nextFolder;
-            } else {
-                printf("Error: Directory or file '%s' not found.\n", token);
-                return NULL;
-            }
-        }
-        token = strtok(NULL, "/");
+    freeChunk* chunk = arena->freeLists[sizeClass];
+    if (chunk) {
+        arena->freeLists[sizeClass] = chunk->next;
+        return chunk;
     }
-
-    return currentFolder;
+    return arenaCarve(arena, (size_t)ARENA_MIN_CLASS << sizeClass);
 }
 
-
-// Function to read and display the contents of a file
-void echo(node* currentFolder, char* fileName, node* root) {
-    // Find the node with the given file name in the current folder
-    node* targetNode = getNodeTypeless(currentFolder, fileName);
-    if (targetNode == NULL) {
-        printf("Error: File '%s' not found.\n", fileName);
+// Return memory to the arena; size must match the size it was allocated with
+void arenaRelease(treeArena* arena, void* memory, size_t size) {
+    if (!memory) return;
+
+    int sizeClass = arenaClass(size);
+    if (sizeClass < 0) {
+        arenaBlock* block = (arenaBlock*)memory - 1;
+        if (block->previous) block->previous->next = block->next;
+        else arena->blocks = block->next;
+        if (block->next) block->next->previous = block->previous;
+        free(block);
         return;
     }
 
-    // If the node is a symlink, resolve it to its target
-    if (targetNode->type == Symlink) {
-        char* targetPath = targetNode->symlinkTarget;
-        printf("Following symlink '%s' -> '%s'\n", fileName, targetPath);
+    freeChunk* chunk = memory;
+    chunk->next = arena->freeLists[sizeClass];
+    arena->freeLists[sizeClass] = chunk;
+}
 
-        // Resolve the symlink path
-        targetNode = parsePath(currentFolder, targetPath, root);
-        if (targetNode == NULL) {
-            printf("Error: Target of symlink '%s' not found.\n", fileName);
-            return;
-        }
-    }
+char* arenaStrdup(treeArena* arena, const char* str) {
+    if (!str) return NULL;
 
-    // Ensure the resolved node is a file
-    if (targetNode->type != File) {
-        printf("Error: '%s' is not a file.\n", fileName);
-        return;
-    }
+    size_t length = strlen(str) + 1;
+    char* copy = arenaAlloc(arena, length);
+    if (copy) memcpy(copy, str, length);
+    return copy;
+}
 
-    // Construct the real file path
-    char realPath[MAX_PATH_LENGTH];
-    getRealPath(targetNode->parent, realPath);
-    char fullPath[MAX_PATH_LENGTH];
-    int n = snprintf(fullPath, sizeof(fullPath), "%s/%s", realPath, targetNode->name);
+// Strings are immutable once stored, so their length gives back their size class
+void arenaFreeString(treeArena* arena, char* str) {
+    if (str) arenaRelease(arena, str, strlen(str) + 1);
+}
 
-    // Check if the output was truncated
-    if (n < 0 || n >= (int)sizeof(fullPath)) {
-        fprintf(stderr, "Error: Path too long for file '%s'.\n", fileName);
-        return;
-    }
+// The node table: every node of every tree sits in a slot of one
+// process-wide table made of fixed-size chunks. Chunks never move, so a
+// slot number names a node for as long as it lives, and turning one back
+// into a pointer is an index into the chunk list. The chunk list has room
+// for every possible chunk up front, so it never moves either and walker
+// threads can read it while the command thread adds chunks; only the pages
+// of it in use become resident. Each arena takes whole chunks and hands
+// them back when it is destroyed.
+#define NODE_CHUNK_BITS 12
+#define NODE_CHUNK_SLOTS (1u << NODE_CHUNK_BITS) // 256 KiB of nodes per chunk
+#define NODE_CHUNK_COUNT (1u << (32 - NODE_CHUNK_BITS))
+
+typedef struct nodeTable {
+    node* chunks[NODE_CHUNK_COUNT]; // NULL where a chunk was handed back
+    uint32_t count;          // Chunk numbers ever used
+    uint32_t spare[NODE_CHUNK_COUNT]; // Handed back chunk numbers, for reuse
+    uint32_t spareCount;
+} nodeTable;
+
+nodeTable nodes;
+
+node* nodeAt(nodeRef ref) {
+    return ref ? nodes.chunks[ref >> NODE_CHUNK_BITS] + (ref & (NODE_CHUNK_SLOTS - 1)) : NULL;
+}
 
-    // Open and read the file contents
-    FILE* file = fopen(fullPath, "r");
-    if (file == NULL) {
-        printf("Error: Could not open file '%s'.\n", fullPath);
-        return;
+node* nodeParent(const node* item) {
+    return nodeAt(item->parentRef);
+}
+
+node* nodeNext(const node* item) {
+    return nodeAt(item->nextRef);
+}
+
+node* nodePrevious(const node* item) {
+    return nodeAt(item->previousRef);
+}
+
+// First child of a folder; NULL for other nodes
+node* nodeChild(const node* item) {
+    return item->type == Folder ? nodeAt(item->dir->child) : NULL;
+}
+
+// Take a chunk for the arena and start handing out its slots
+int arenaAddNodeChunk(treeArena* arena) {
+    if (arena->nodeChunkCount == arena->nodeChunkCapacity) {
+        uint32_t capacity = arena->nodeChunkCapacity ? arena->nodeChunkCapacity * 2 : 8;
+        uint32_t* owned = realloc(arena->nodeChunks, capacity * sizeof(uint32_t));
+        if (!owned) return -1;
+        arena->nodeChunks = owned;
+        arena->nodeChunkCapacity = capacity;
     }
 
-    printf("Contents of '%s':\n", fullPath);
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), file) != NULL) {
-        printf("%s", buffer);
+    uint32_t number;
+    if (nodes.spareCount) {
+        number = nodes.spare[--nodes.spareCount];
+    } else {
+        if (nodes.count == NODE_CHUNK_COUNT) return -1; // Every slot number is taken
+        number = nodes.count++;
+    }
+    node* chunk = malloc(NODE_CHUNK_SLOTS * sizeof(node));
+    if (!chunk) {
+        nodes.spare[nodes.spareCount++] = number;
+        return -1;
     }
 
-    fclose(file);
+    nodes.chunks[number] = chunk;
+    arena->nodeChunks[arena->nodeChunkCount++] = number;
+    arena->nextNode = number << NODE_CHUNK_BITS;
+    arena->nodesLeft = NODE_CHUNK_SLOTS;
+    if (arena->nextNode == 0) {
+        arena->nextNode++; // Slot 0 stands for no node
+        arena->nodesLeft--;
+    }
+    return 0;
 }
 
+// Hand the arena's chunks back to the node table
+void arenaFreeNodeChunks(treeArena* arena) {
+    for (uint32_t i = 0; i < arena->nodeChunkCount; i++) {
+        uint32_t number = arena->nodeChunks[i];
+        free(nodes.chunks[number]);
+        nodes.chunks[number] = NULL;
+        nodes.spare[nodes.spareCount++] = number;
+    }
+    free(arena->nodeChunks);
+}
 
-void saveDirectoryToFile(node* folder, FILE* file, int depth) {
-    if (!folder) return;
+node* arenaNewNode(treeArena* arena) {
+    nodeRef ref = arena->freeNodes;
+    if (ref) {
+        arena->freeNodes = nodeAt(ref)->nextRef;
+    } else {
+        if (arena->nodesLeft == 0 && arenaAddNodeChunk(arena) != 0) return NULL;
+        ref = arena->nextNode++;
+        arena->nodesLeft--;
+    }
+    node* item = nodeAt(ref);
+    item->self = ref;
+    return item;
+}
 
-    // Indentation for better readability
-    for (int i = 0; i < depth; i++) fprintf(file, "  ");
-    fprintf(file, "{\n");
+void arenaFreeNode(treeArena* arena, node* freeingNode) {
+    freeingNode->nextRef = arena->freeNodes;
+    arena->freeNodes = freeingNode->self;
+}
 
-    // Write folder/file properties
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "\"type\": \"%s\",\n", folder->type == Folder ? "Folder" : (folder->type == File ? "File" : "Symlink"));
+// A node's name, wherever it is kept
+char* nodeName(const node* item) {
+    return item->longName ? item->nameStorage.heap : (char*)item->nameStorage.inlined;
+}
 
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "\"name\": \"%s\",\n", folder->name);
+void nodeFreeName(node* item) {
+    if (item->longName) {
+        nodeUsageAdd(item, 0, -(long long)(strlen(item->nameStorage.heap) + 1));
+        arenaFreeString(activeArena, item->nameStorage.heap);
+    }
+    item->longName = 0;
+    item->nameStorage.inlined[0] = '\0';
+}
 
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "\"size\": %zu,\n", folder->size);
+// A symlink's target, NULL for other nodes (the field shares its storage)
+const char* nodeTarget(const node* item) {
+    return item->type == Symlink ? item->symlinkTarget : NULL;
+}
 
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "\"date\": %ld", folder->date);
+// Give a node a new name: inlined when it fits, otherwise in the arena
+int nodeSetName(node* item, const char* name) {
+    return nodeSetNameLength(item, name, strlen(name));
+}
 
-    if (folder->type == File && folder->content) {
-        fprintf(file, ",\n");
-        for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-        fprintf(file, "\"content\": \"%s\"", folder->content);
+// nodeSetName for a name that is not terminated, such as one in a snapshot's string table
+int nodeSetNameLength(node* item, const char* name, size_t length) {
+    char* heap = NULL;
+    if (length >= NODE_INLINE_NAME) {
+        heap = arenaAlloc(activeArena, length + 1);
+        if (!heap) return -1;
+        memcpy(heap, name, length);
+        heap[length] = '\0';
     }
-
-    if (folder->type == Symlink) {
-        fprintf(file, ",\n");
-        for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-        fprintf(file, "\"symlinkTarget\": \"%s\"", folder->symlinkTarget);
+    nodeFreeName(item);
+    if (heap) {
+        item->nameStorage.heap = heap;
+        item->longName = 1;
+        nodeUsageAdd(item, 0, (long long)length + 1);
+    } else {
+        memcpy(item->nameStorage.inlined, name, length);
+        item->nameStorage.inlined[length] = '\0';
     }
+    return 0;
+}
 
-    // Children
-    fprintf(file, ",\n");
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "\"children\": [\n");
-
-    node* current = folder->child;
-    while (current) {
-        saveDirectoryToFile(current, file, depth + 1);
-        current = current->next;
-        if (current) fprintf(file, ",\n");
+// File content is an array of fixed-size chunks in which every chunk but
+// the last is full, so an offset maps straight to its chunk and a write only
+// touches the chunks it covers. Chunks are refcounted: a chunk that more
+// than one file holds is copied before it is written (copy-on-write).
+#define CONTENT_CHUNK_SIZE 4096 // Header included, so a chunk is exactly one arena size class
+#define CONTENT_CHUNK_DATA (CONTENT_CHUNK_SIZE - 2 * sizeof(uint32_t))
+
+typedef struct contentChunk {
+    uint32_t references;
+    uint32_t length;         // Bytes of data in use
+    char data[CONTENT_CHUNK_DATA];
+} contentChunk;
+
+_Static_assert(sizeof(contentChunk) == CONTENT_CHUNK_SIZE, "contentChunk must fill its size class");
+
+typedef struct fileContent {
+    contentChunk** chunks;
+    size_t count;
+    size_t capacity;
+    size_t length;           // Total bytes over all chunks
+    uint32_t references;     // Files holding this content
+    int indexed;             // In the tree's content store under hash
+    uint64_t hash;
+    struct fileContent* hashNext; // Next content in the same store bucket
+    uint64_t segment;        // Offset in the tree's segmented snapshot, valid in segmentEpoch only
+    uint64_t segmentEpoch;
+} fileContent;
+
+// 64-bit hash of a whole content, eight bytes per step; not cryptographic,
+// equal hashes are always confirmed by comparing the bytes
+uint64_t hashContent(const char* data, size_t length) {
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t hash = length * multiplier;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
     }
+    uint64_t tail = 0;
+    if (i < length) memcpy(&tail, data + i, length - i);
+    hash = (hash ^ tail) * multiplier;
+
+    // Final mix so that every input bit reaches the low bits used for buckets
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
 
-    // Closing children array
-    fprintf(file, "\n");
-    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
-    fprintf(file, "]\n");
+fileContent* contentCreate(void) {
+    fileContent* content = arenaAlloc(activeArena, sizeof(fileContent));
+    if (!content) return NULL;
+    memset(content, 0, sizeof(fileContent));
+    content->references = 1;
+    activeArena->contents.references++;
+    activeArena->contents.distinct++;
+    return content;
+}
 
-    // Closing this node
-    for (int i = 0; i < depth; i++) fprintf(file, "  ");
-    fprintf(file, "}");
+void contentReleaseChunk(contentChunk* chunk) {
+    if (--chunk->references > 0) return;
+    activeArena->contents.storedBytes -= chunk->length;
+    arenaRelease(activeArena, chunk, sizeof(contentChunk));
 }
 
-void saveDirectory(node* root, const char* filename) {
-    FILE* file = fopen(filename, "w");
-    if (!file) {
-        printf("Error: Could not open file '%s' for saving.\n", filename);
-        return;
-    }
+void contentUnindex(fileContent* content) {
+    if (!content->indexed) return;
+    contentStore* store = &activeArena->contents;
+    fileContent** link = &store->buckets[content->hash & (store->bucketCount - 1)];
+    while (*link != content) link = &(*link)->hashNext;
+    *link = content->hashNext;
+    content->indexed = 0;
+    store->blobCount--;
+}
 
-    saveDirectoryToFile(root, file, 0);
-    fprintf(file, "\n"); // Final newline for cleanliness
-    fclose(file);
+// Drop one file's hold on a content; the last one frees it
+void contentRelease(fileContent* content) {
+    if (!content) return;
+    contentStore* store = &activeArena->contents;
+    store->references--;
+    store->logicalBytes -= content->length;
+    contentDrop(content);
+}
 
-    printf("Directory structure saved to '%s'.\n", filename);
+// Give one more file the content, as contentIntern does for identical bytes
+void contentShare(fileContent* content) {
+    if (!content) return;
+    content->references++;
+    activeArena->contents.references++;
+    activeArena->contents.logicalBytes += content->length;
 }
 
+// Hold a content for something other than a file (a snapshot's older state),
+// which keeps it alive without counting it in the per-file totals
+void contentHold(fileContent* content) {
+    if (content) content->references++;
+}
 
-node* loadDirectoryFromFile(FILE* file, node* parent) {
-    char line[1024];
-    node* firstChild = NULL;
-    node* previousSibling = NULL;
+void contentDrop(fileContent* content) {
+    if (!content || --content->references > 0) return;
 
-    while (fgets(line, sizeof(line), file)) {
-        // End of the current folder's children
-        if (strstr(line, "]")) break;
+    contentStore* store = &activeArena->contents;
+    contentUnindex(content);
+    store->distinct--;
+    for (size_t i = 0; i < content->count; i++) contentReleaseChunk(content->chunks[i]);
+    arenaRelease(activeArena, content->chunks, content->capacity * sizeof(contentChunk*));
+    arenaRelease(activeArena, content, sizeof(fileContent));
+}
 
-        // Check for opening brace indicating a new node
-        if (strstr(line, "{")) {
-            // Create a new node
-            node* newNode = malloc(sizeof(node));
-            newNode->parent = parent;
-            newNode->child = NULL;
-            newNode->next = NULL;
-            newNode->previous = previousSibling;
-            newNode->symlinkTarget = NULL;
-            newNode->numberOfItems = 0;
+// Make room for one more chunk pointer; the array doubles, so appends stay amortized O(1)
+int contentGrow(fileContent* content, size_t capacity) {
+    if (capacity <= content->capacity) return 0;
+    if (capacity < content->capacity * 2) capacity = content->capacity * 2;
+    if (capacity < 4) capacity = 4;
+
+    contentChunk** chunks = arenaAlloc(activeArena, capacity * sizeof(contentChunk*));
+    if (!chunks) return -1;
+    if (content->count) memcpy(chunks, content->chunks, content->count * sizeof(contentChunk*));
+    arenaRelease(activeArena, content->chunks, content->capacity * sizeof(contentChunk*));
+    content->chunks = chunks;
+    content->capacity = capacity;
+    return 0;
+}
 
-            // Parse node properties
-            while (fgets(line, sizeof(line), file) && !strstr(line, "}")) {
-                if (strstr(line, "\"type\":")) {
-                    if (strstr(line, "Folder")) {
-                        newNode->type = Folder;
-                    } else if (strstr(line, "File")) {
-                        newNode->type = File;
-                    } else if (strstr(line, "Symlink")) {
-                        newNode->type = Symlink;
-                    }
-                } else if (strstr(line, "\"name\":")) {
-                    char name[256];
-                    sscanf(line, " \"name\": \"%255[^\"]\"", name);
-                    newNode->name = strdup(name);
-                } else if (strstr(line, "\"size\":")) {
-                    sscanf(line, " \"size\": %zu", &newNode->size);
-                } else if (strstr(line, "\"date\":")) {
-                    sscanf(line, " \"date\": %ld", &newNode->date);
-                } else if (strstr(line, "\"symlinkTarget\":")) {
-                    char target[256];
-                    sscanf(line, " \"symlinkTarget\": \"%255[^\"]\"", target);
-                    newNode->symlinkTarget = strdup(target);
-                } else if (strstr(line, "\"content\":")) {
-                    char content[1024];
-                    sscanf(line, " \"content\": \"%1023[^\"]\"", content);
-                    newNode->content = strdup(content);
-                } else if (strstr(line, "\"children\":")) {
-                    // Recursively load children
-                    newNode->child = loadDirectoryFromFile(file, newNode);
-                    newNode->numberOfItems = countFiles(newNode);// + countFolders(newNode); // Update count
-                }
-            }
+// Content that one file may change in place. A content other files hold too
+// is replaced by a private copy that still shares every chunk, so only the
+// chunks that are then written get copied. Changed content leaves the index:
+// its hash no longer matches, and rehashing would cost O(size) per write.
+fileContent* contentWritable(fileContent* content) {
+    if (content->references == 1) {
+        contentUnindex(content);
+        return content;
+    }
 
-            // Link sibling nodes properly
-            if (!firstChild) {
-                firstChild = newNode; // First child under this parent
-            } else {
-                previousSibling->next = newNode; // Link as a sibling
-                newNode->previous = previousSibling; // Update previous pointer for the new node
-            }
-            previousSibling = newNode; // Update the last sibling pointer
+    fileContent* copy = arenaAlloc(activeArena, sizeof(fileContent));
+    if (!copy) return NULL;
+    memset(copy, 0, sizeof(fileContent));
+    if (contentGrow(copy, content->count) != 0) {
+        arenaRelease(activeArena, copy, sizeof(fileContent));
+        return NULL;
+    }
+    for (size_t i = 0; i < content->count; i++) {
+        copy->chunks[i] = content->chunks[i];
+        copy->chunks[i]->references++;
+    }
+    copy->count = content->count;
+    copy->length = content->length;
+    copy->references = 1;
+    content->references--; // The file's reference moves over, the byte totals stay the same
+    activeArena->contents.distinct++;
+    return copy;
+}
 
-            // Debug output to track structure
-            printf("Loaded: %s (%s)\n", newNode->name,
-                   (newNode->type == Folder ? "Folder" :
-                   (newNode->type == File ? "File" : "Symlink")));
-        }
+// Chunk at index, copied first if another content shares it; a new empty chunk at index == count
+contentChunk* contentWritableChunk(fileContent* content, size_t index) {
+    if (index < content->count && content->chunks[index]->references == 1) return content->chunks[index];
+    if (index == content->count && contentGrow(content, content->count + 1) != 0) return NULL;
+
+    contentChunk* chunk = arenaAlloc(activeArena, sizeof(contentChunk));
+    if (!chunk) return NULL;
+    chunk->references = 1;
+    chunk->length = 0;
+    if (index < content->count) {
+        contentChunk* shared = content->chunks[index];
+        chunk->length = shared->length;
+        memcpy(chunk->data, shared->data, shared->length);
+        activeArena->contents.storedBytes += chunk->length;
+        contentReleaseChunk(shared);
+    } else {
+        content->count++;
     }
+    content->chunks[index] = chunk;
+    return chunk;
+}
 
-    return firstChild;
+// Overwrite length bytes at offset (at most the current length) of a content
+// returned by contentWritable, growing it past its end as needed. Only the
+// chunks covering [offset, offset + length) are touched.
+int contentWrite(fileContent* content, size_t offset, const char* data, size_t length) {
+    if (offset > content->length) return -1;
+    content->segment = 0; // Saved bytes no longer match
+
+    contentStore* store = &activeArena->contents;
+    while (length > 0) {
+        size_t index = offset / CONTENT_CHUNK_DATA;
+        size_t within = offset % CONTENT_CHUNK_DATA;
+        contentChunk* chunk = contentWritableChunk(content, index);
+        if (!chunk) return -1;
+
+        size_t part = CONTENT_CHUNK_DATA - within;
+        if (part > length) part = length;
+        memcpy(chunk->data + within, data, part);
+        if (within + part > chunk->length) {
+            store->storedBytes += within + part - chunk->length;
+            chunk->length = (uint32_t)(within + part);
+        }
+
+        offset += part;
+        data += part;
+        length -= part;
+        if (offset > content->length) {
+            store->logicalBytes += offset - content->length;
+            content->length = offset;
+        }
+    }
+    return 0;
 }
 
-node* loadDirectory(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        printf("Error: Could not open file '%s' for loading.\n", filename);
-        return NULL;
+int contentEquals(const fileContent* content, const char* data, size_t length) {
+    if (content->length != length) return 0;
+    for (size_t i = 0; i < content->count; i++) {
+        if (memcmp(content->chunks[i]->data, data, content->chunks[i]->length) != 0) return 0;
+        data += content->chunks[i]->length;
     }
+    return 1;
+}
 
-    // node* root = malloc(sizeof(node));
-    // root->type = Folder;
-    // root->name = strdup("/");
-    // root->parent = NULL;
-    // root->child = NULL;
-    // root->next = NULL;
-    // root->previous = NULL;
-    // root->symlinkTarget = NULL;
-    // root->numberOfItems = 0;
+int contentIndexGrow(contentStore* store) {
+    size_t bucketCount = store->bucketCount ? store->bucketCount * 2 : 256;
+    fileContent** buckets = arenaAlloc(activeArena, bucketCount * sizeof(fileContent*));
+    if (!buckets) return -1;
+    memset(buckets, 0, bucketCount * sizeof(fileContent*));
+
+    for (size_t i = 0; i < store->bucketCount; i++) {
+        fileContent* content = store->buckets[i];
+        while (content) {
+            fileContent* next = content->hashNext;
+            fileContent** bucket = &buckets[content->hash & (bucketCount - 1)];
+            content->hashNext = *bucket;
+            *bucket = content;
+            content = next;
+        }
+    }
+    arenaRelease(activeArena, store->buckets, store->bucketCount * sizeof(fileContent*));
+    store->buckets = buckets;
+    store->bucketCount = bucketCount;
+    return 0;
+}
 
-    // Load the directory tree from the file
-    node* loadedRoot = loadDirectoryFromFile(file, NULL);
-    loadedRoot->numberOfItems = countFiles(loadedRoot);
-    fclose(file);
+// Content for a file that now holds these bytes: an identical content already
+// in the tree is shared (one more reference), otherwise a new one is stored
+// and indexed by its hash. Used by edit and by every loader.
+fileContent* contentIntern(const char* data, size_t length) {
+    contentStore* store = &activeArena->contents;
+    uint64_t hash = hashContent(data, length);
+    if (store->bucketCount) {
+        for (fileContent* content = store->buckets[hash & (store->bucketCount - 1)]; content;
+             content = content->hashNext) {
+            if (content->hash == hash && contentEquals(content, data, length)) {
+                content->references++;
+                store->references++;
+                store->logicalBytes += length;
+                store->hits++;
+                return content;
+            }
+        }
+    }
 
-    // Ensure the loaded root has the correct parent-child structure
-    if (loadedRoot) {
-        printf("Directory structure loaded from '%s'.\n", filename);
-        return loadedRoot;
-    } else {
-        printf("Error: Failed to load directory structure from '%s'.\n", filename);
+    fileContent* content = contentCreate();
+    if (!content) return NULL;
+    if (contentWrite(content, 0, data, length) != 0) {
+        contentRelease(content);
         return NULL;
     }
+    content->hash = hash;
+    if ((store->blobCount + 1) * 2 > store->bucketCount && contentIndexGrow(store) != 0) {
+        return content; // Still correct, just not shared with later copies
+    }
+    fileContent** bucket = &store->buckets[hash & (store->bucketCount - 1)];
+    content->hashNext = *bucket;
+    *bucket = content;
+    content->indexed = 1;
+    store->blobCount++;
+    return content;
 }
 
+// Flatten the content into one NUL-terminated malloc'd string
+char* contentString(const fileContent* content) {
+    size_t length = content ? content->length : 0;
+    char* str = malloc(length + 1);
+    if (!str) return NULL;
 
-// // Week 2: Save Directory Structure
-// // Function to save the directory to either a regular file or compressed file
-// void saveDirectory(node* folder, void* file) {
-//     if (!folder) return;
-
-//     gzFile gz = (gzFile)file;
-
-//     // Save folder/file details
-//     if (gz) {
-//         gzprintf(gz, "%d %s %ld %ld\n", folder->type, folder->name, folder->size, folder->date);
-//     }
-
-//     // Save file content if present
-//     if (folder->type == File && folder->content) {
-//         if (gz) {
-//             gzprintf(gz, "CONTENT:%s\n", folder->content);
-//         }
-//     }
+    size_t done = 0;
+    for (size_t i = 0; content && i < content->count; i++) {
+        memcpy(str + done, content->chunks[i]->data, content->chunks[i]->length);
+        done += content->chunks[i]->length;
+    }
+    str[done] = '\0';
+    return str;
+}
 
-//     // Recursively save child nodes
-//     node* currentNode = folder->child;
-//     while (currentNode) {
-//         saveDirectory(currentNode, file);
-//         currentNode = currentNode->next;
-//     }
+// Stream the content chunk by chunk, without flattening it
+void contentPrint(const fileContent* content, FILE* file) {
+    for (size_t i = 0; content && i < content->count; i++) {
+        fwrite(content->chunks[i]->data, 1, content->chunks[i]->length, file);
+    }
+}
 
-//     // Mark the end of the folder
-//     if (gz) {
-//         gzprintf(gz, "END\n");
-//     }
-// }
+// Print how much the content store saves over one copy per file
+void contentReport(void) {
+    const contentStore* store = &activeArena->contents;
+    uint64_t saved = store->logicalBytes > store->storedBytes ? store->logicalBytes - store->storedBytes : 0;
+    printf("Content store: %llu files, %llu distinct contents, %llu found already stored.\n",
+           (unsigned long long)store->references, (unsigned long long)store->distinct,
+           (unsigned long long)store->hits);
+    printf("Bytes: %llu logical, %llu stored, %llu saved (dedup ratio %.2f).\n",
+           (unsigned long long)store->logicalBytes, (unsigned long long)store->storedBytes,
+           (unsigned long long)saved,
+           store->storedBytes ? (double)store->logicalBytes / (double)store->storedBytes : 1.0);
+}
 
+// Read one line; the buffer doubles as it fills, so long lines cost O(length)
+char* getString() {
+    char* str = NULL;
+    size_t size = 0;
+    ssize_t len = getline(&str, &size, inputStream);
+    if (len < 0) {
+        free(str);
+        str = malloc(1);
+        if (str) str[0] = '\0';
+        return str;
+    }
+    if (len > 0 && str[len - 1] == '\n') str[len - 1] = '\0';
+    return str;
+}
 
-// // Week 2: Load Directory Structure
-// // Function to load the directory from either a regular file or compressed file
-// node* loadDirectory(gzFile gz, node* parent) {
-//     char line[1024];
-
-//     while (gzgets(gz, line, sizeof(line))) {
-//         if (strncmp(line, "END", 3) == 0) break;
-
-//         node* newNode = malloc(sizeof(node));
-//         newNode->parent = parent;
-//         newNode->child = NULL;
-//         newNode->next = NULL;
-//         newNode->previous = NULL;
-//         newNode->symlinkTarget = NULL;
-
-//         // Parse node details
-//         char nameBuffer[256];
-//         sscanf(line, "%d %s %zu %ld", (int*)&newNode->type, nameBuffer, &newNode->size, &newNode->date);
-//         newNode->name = strdup(nameBuffer);
-
-//         // Load content if present
-//         if (newNode->type == File && gzgets(gz, line, sizeof(line)) && strncmp(line, "CONTENT:", 8) == 0) {
-//             newNode->content = strdup(line + 8);
-//             newNode->content[strlen(newNode->content) - 1] = '\0';
-
-//             // Create real file
-//             char path[1024];
-//             snprintf(path, sizeof(path), "%s/%s", parent->name, newNode->name);
-//             FILE* file = fopen(path, "w");
-//             if (file) {
-//                 fprintf(file, "%s", newNode->content);
-//                 fclose(file);
-//             }
-//         } else if (newNode->type == File) {
-//             newNode->content = NULL;
-//         }
+// Week 2: Count Total Files
+// Both counters read the subtree totals, which include the folder itself
+int countFiles(node* folder) {
+    if (!folder) return 0;
+    return (int)nodeStats(folder).files;
+}
 
-//         // Create real folder if applicable
-//         if (newNode->type == Folder) {
-//             char path[1024];
-//             snprintf(path, sizeof(path), "%s/%s", parent->name, newNode->name);
-//             mkdir(path, 0755);
-//         }
+int countFolders(node* folder) {
+    if (!folder) return 0;
+    return (int)nodeStats(folder).folders;
+}
 
-//         // Recursively load children
-//         newNode->child = loadDirectory(gz, newNode);
+// Parallel traversal engine. A walk visits every node below a root on a pool
+// of threads. Work is a folder whose children still need visiting; each
+// thread pushes the subfolders it finds onto its own deque and pops from the
+// same end (depth first, cache friendly), while idle threads steal from the
+// other end of someone else's deque, which hands them the biggest remaining
+// subtrees. Every thread folds what it sees into a private accumulator; the
+// accumulators are reduced into the caller's total once the walk is over.
+#define WALK_MAX_THREADS 64
+
+typedef struct walkDeque {
+    pthread_mutex_t lock;
+    node** items;            // Pending folders in items[top..bottom)
+    size_t top;
+    size_t bottom;
+    size_t capacity;
+} walkDeque;
+
+typedef struct walkShared {
+    walkDeque deques[WALK_MAX_THREADS];
+    int threads;
+    atomic_size_t pending;   // Folders pushed but not finished yet
+    walkVisitor visit;
+    void* argument;
+    size_t accumulatorSize;
+    unsigned char* accumulators;
+    pthread_mutex_t materializeLock; // Building a lazy folder allocates from the arena
+} walkShared;
+
+typedef struct walkWorker {
+    walkShared* shared;
+    int index;
+} walkWorker;
+
+int walkPush(walkDeque* deque, node* folder) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        if (deque->top > 0) {
+            // Reuse the space thieves have freed at the front
+            memmove(deque->items, deque->items + deque->top, (deque->bottom - deque->top) * sizeof(node*));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        } else {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+            node** items = realloc(deque->items, capacity * sizeof(node*));
+            if (!items) {
+                pthread_mutex_unlock(&deque->lock);
+                return -1;
+            }
+            deque->items = items;
+            deque->capacity = capacity;
+        }
+    }
+    deque->items[deque->bottom++] = folder;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
 
-//         // Add to parent's children
-//         if (parent->child == NULL) {
-//             parent->child = newNode;
-//         } else {
-//             node* last = parent->child;
-//             while (last->next) last = last->next;
-//             last->next = newNode;
-//             newNode->previous = last;
-//         }
-//     }
+// Owner end: the most recently pushed folder
+node* walkPop(walkDeque* deque) {
+    node* folder = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) folder = deque->items[--deque->bottom];
+    if (deque->bottom == deque->top) deque->top = deque->bottom = 0;
+    pthread_mutex_unlock(&deque->lock);
+    return folder;
+}
 
-//     return parent ? parent->child : NULL;
-// }
+// Thief end: the oldest, and usually largest, pending subtree
+node* walkSteal(walkDeque* deque) {
+    node* folder = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) folder = deque->items[deque->top++];
+    if (deque->bottom == deque->top) deque->top = deque->bottom = 0;
+    pthread_mutex_unlock(&deque->lock);
+    return folder;
+}
 
-// Week 3: Rename Node
-void renameNode(node* currentNode, const char* newName) {
-    if (!currentNode) {
-        printf("Error: Node does not exist.\n");
-        return;
+void walkFolder(walkShared* shared, int index, node* folder, void* accumulator) {
+    if (folder->dir->lazyRecord) {
+        pthread_mutex_lock(&shared->materializeLock);
+        materialize(folder);
+        pthread_mutex_unlock(&shared->materializeLock);
     }
 
-    // Check for conflicting names in the same directory
-    node* sibling = currentNode->parent ? currentNode->parent->child : NULL;
-    while (sibling) {
-        if (sibling != currentNode && strcmp(sibling->name, newName) == 0) {
-            printf("Error: A node with the name '%s' already exists in the current directory.\n", newName);
-            return;
+    for (node* child = nodeChild(folder); child; child = nodeNext(child)) {
+        shared->visit(child, accumulator, shared->argument);
+        if (child->type == Folder && (child->dir->child || child->dir->lazyRecord)) {
+            atomic_fetch_add(&shared->pending, 1);
+            if (walkPush(&shared->deques[index], child) != 0) {
+                walkFolder(shared, index, child, accumulator); // Out of memory: walk it in place
+                atomic_fetch_sub(&shared->pending, 1);
+            }
         }
-        sibling = sibling->next;
     }
-
-    // Free the old name and assign the new name
-    free(currentNode->name);
-    currentNode->name = strdup(newName);
-    printf("Renamed to '%s'\n", currentNode->name);
 }
 
+void* walkThread(void* argument) {
+    walkWorker* worker = argument;
+    walkShared* shared = worker->shared;
+    int index = worker->index;
+    void* accumulator = shared->accumulators + (size_t)index * shared->accumulatorSize;
 
-// Week 3: Display Full Path
-void displayFullPath(node* currentNode) {
-    if (!currentNode) return;
-
-    if (currentNode->parent) {
-        displayFullPath(currentNode->parent);
+    while (1) {
+        node* folder = walkPop(&shared->deques[index]);
+        for (int k = 1; !folder && k < shared->threads; k++) {
+            folder = walkSteal(&shared->deques[(index + k) % shared->threads]);
+        }
+        if (!folder) {
+            if (atomic_load(&shared->pending) == 0) break; // Nothing queued and nobody busy
+            sched_yield();
+            continue;
+        }
+        walkFolder(shared, index, folder, accumulator);
+        atomic_fetch_sub(&shared->pending, 1);
     }
-    printf("/%s", currentNode->name);
+    return NULL;
 }
 
-node* getNode(node *currentFolder, char* name, enum nodeType type) {
-
-    if (currentFolder->child != NULL) {
+// Visit root and everything below it on up to `threads` threads. Each
+// thread gets a zeroed accumulator of accumulatorSize bytes that visit()
+// updates; reduce() folds each of them into total at the end. Returns the
+// number of threads used.
+int parallelWalk(node* root, int threads, walkVisitor visit, void* argument,
+                 size_t accumulatorSize, walkReducer reduce, void* total) {
+    if (threads < 1) threads = 1;
+    if (threads > WALK_MAX_THREADS) threads = WALK_MAX_THREADS;
+
+    walkShared* shared = calloc(1, sizeof(walkShared));
+    if (!shared) return 0;
+    shared->accumulators = calloc((size_t)threads, accumulatorSize ? accumulatorSize : 1);
+    if (!shared->accumulators) {
+        free(shared);
+        return 0;
+    }
+    shared->threads = threads;
+    shared->visit = visit;
+    shared->argument = argument;
+    shared->accumulatorSize = accumulatorSize;
+    pthread_mutex_init(&shared->materializeLock, NULL);
+    for (int i = 0; i < threads; i++) pthread_mutex_init(&shared->deques[i].lock, NULL);
+
+    visit(root, shared->accumulators, argument);
+    if (root->type == Folder) {
+        atomic_store(&shared->pending, 1);
+        walkPush(&shared->deques[0], root);
+    }
 
-        node *currentNode = currentFolder->child;
+    // The calling thread is worker 0
+    walkWorker workers[WALK_MAX_THREADS];
+    pthread_t handles[WALK_MAX_THREADS];
+    int started = 1;
+    for (int i = 0; i < threads; i++) {
+        workers[i].shared = shared;
+        workers[i].index = i;
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&handles[i], NULL, walkThread, &workers[i]) != 0) break;
+        started++;
+    }
+    walkThread(&workers[0]);
+    for (int i = 1; i < started; i++) pthread_join(handles[i], NULL);
 
-        while (currentNode->next != NULL) {
+    for (int i = 0; i < threads; i++) {
+        reduce(total, shared->accumulators + (size_t)i * accumulatorSize);
+        free(shared->deques[i].items);
+        pthread_mutex_destroy(&shared->deques[i].lock);
+    }
+    pthread_mutex_destroy(&shared->materializeLock);
+    free(shared->accumulators);
+    free(shared);
+    return started;
+}
 
-            if (strcmp(name, currentNode->name) == 0 && currentNode->type == type) {
-                return currentNode;
-            }
-            currentNode = currentNode->next;
-        }
+// Default pool size: one thread per online core
+int walkDefaultThreads(void) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? (processors < WALK_MAX_THREADS ? (int)processors : WALK_MAX_THREADS) : 1;
+}
 
-        if (strcmp(name, currentNode->name) == 0 && currentNode->type == type) {
-            return currentNode;
-        } else return NULL;
+// Counting and size aggregation as a walk: every node adds its own totals
+typedef struct walkCount {
+    subtreeStats stats;
+    uint64_t nodes;
+} walkCount;
+
+void countVisitor(node* item, void* accumulator, void* argument) {
+    (void)argument;
+    walkCount* count = accumulator;
+    subtreeStats own = ownStats(item);
+    addStats(&count->stats, &own);
+    count->nodes++;
+}
 
-    } else return NULL;
+void countReducer(void* total, const void* partial) {
+    walkCount* sum = total;
+    const walkCount* part = partial;
+    addStats(&sum->stats, &part->stats);
+    sum->nodes += part->nodes;
 }
 
-node* getNodeTypeless(node *currentFolder, char* name) {
+// Recount a subtree from scratch and compare it with the maintained totals
+void walkCountReport(node* folder, int threads) {
+    walkCount total = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int used = parallelWalk(folder, threads, countVisitor, NULL, sizeof(walkCount), countReducer, &total);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double milliseconds = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+
+    printf("Files: %llu\nFolders: %llu\nSymlinks: %llu\nBytes: %llu\n",
+           (unsigned long long)total.stats.files, (unsigned long long)total.stats.folders,
+           (unsigned long long)total.stats.symlinks, (unsigned long long)total.stats.bytes);
+    printf("Walked %llu nodes on %d threads in %.3f ms\n", (unsigned long long)total.nodes, used, milliseconds);
+    subtreeStats maintained = nodeStats(folder);
+    if (memcmp(&total.stats, &maintained, sizeof(subtreeStats)) != 0) {
+        printf("Warning: The maintained totals differ from the walk.\n");
+    }
+}
 
-    if (currentFolder->child != NULL) {
+// Path cache (a dcache in miniature): canonical absolute path -> node, with
+// negative entries for paths that do not resolve. It is direct-mapped and
+// bounded, so a colliding insert simply evicts. Entries are dropped
+// precisely: unlinking a node drops the positive entries at or below its
+// path, and linking one drops the negative entries at or below its new path.
+#define PATH_CACHE_SLOTS (1 << 16)
+
+typedef struct pathCacheEntry {
+    char* key;               // NULL when the slot is empty
+    size_t hash;
+    node* result;            // NULL for a negative entry
+    unsigned short missingStart;  // Last component of the key, which did not resolve (negative entries)
+    unsigned short missingLength;
+} pathCacheEntry;
+
+typedef struct pathCache {
+    pathCacheEntry slots[PATH_CACHE_SLOTS];
+    size_t positiveEntries;
+    size_t negativeEntries;
+    uint64_t hits;
+    uint64_t negativeHits;
+    uint64_t misses;
+    uint64_t invalidations;
+} pathCache;
+
+pathCache dentryCache;
+
+// Length of the absolute path of item, without the terminator
+size_t nodePathLength(node* item) {
+    size_t length = 0;
+    for (node* current = item; current && current->parentRef; current = nodeParent(current)) {
+        length += 1 + strlen(nodeName(current));
+    }
+    return length == 0 ? 1 : length; // The root itself is "/"
+}
 
-        node *currentNode = currentFolder->child;
+// Write the absolute path of item into buffer; -1 if it does not fit
+int nodePath(node* item, char* buffer, size_t bufferSize) {
+    size_t length = nodePathLength(item);
+    if (length + 1 > bufferSize) return -1;
+
+    buffer[length] = '\0';
+    buffer[0] = '/';
+    size_t end = length;
+    for (node* current = item; current && current->parentRef; current = nodeParent(current)) {
+        size_t nameLength = strlen(nodeName(current));
+        end -= nameLength;
+        memcpy(buffer + end, nodeName(current), nameLength);
+        buffer[--end] = '/';
+    }
+    return 0;
+}
 
-        while (currentNode->next != NULL) {
+void pathCacheDrop(pathCacheEntry* entry) {
+    if (!entry->key) return;
+    if (entry->result) dentryCache.positiveEntries--;
+    else dentryCache.negativeEntries--;
+    free(entry->key);
+    entry->key = NULL;
+    dentryCache.invalidations++;
+}
 
-            if (strcmp(name, currentNode->name) == 0) {
-                return currentNode;
-            }
-            currentNode = currentNode->next;
-        }
+void pathCacheClear(void) {
+    for (size_t i = 0; i < PATH_CACHE_SLOTS; i++) {
+        pathCacheDrop(&dentryCache.slots[i]);
+    }
+}
 
-        if (strcmp(name, currentNode->name) == 0) {
-            return currentNode;
-        } else return NULL;
+void pathCacheStore(const char* key, size_t hash, node* result, size_t missingStart, size_t missingLength) {
+    pathCacheEntry* entry = &dentryCache.slots[hash & (PATH_CACHE_SLOTS - 1)];
+    char* copy = strdup(key);
+    if (!copy) return;
 
-    } else return NULL;
+    if (entry->key) {
+        pathCacheDrop(entry);
+        dentryCache.invalidations--; // An eviction, not an invalidation
+    }
+    entry->key = copy;
+    entry->hash = hash;
+    entry->result = result;
+    entry->missingStart = (unsigned short)missingStart;
+    entry->missingLength = (unsigned short)missingLength;
+    if (result) dentryCache.positiveEntries++;
+    else dentryCache.negativeEntries++;
 }
 
-void make_dir(node* currentFolder, char* command) {
-    if (strtok(command, " ") != NULL) {
-        char* folderName = strtok(NULL, " ");
-        if (folderName != NULL) {
-            // Check if the folder already exists in the virtual tree
-            if (getNodeTypeless(currentFolder, folderName) == NULL) {
-                // Create the folder in the virtual file system
-                currentFolder->numberOfItems++;
-                node* newFolder = (node*)malloc(sizeof(node));
-                if (currentFolder->child == NULL) {
-                    currentFolder->child = newFolder;
-                    newFolder->previous = NULL;
-                } else {
-                    node* currentNode = currentFolder->child;
-                    while (currentNode->next != NULL) {
-                        currentNode = currentNode->next;
-                    }
-                    currentNode->next = newFolder;
-                    newFolder->previous = currentNode;
-                }
-
-                char* newFolderName = strdup(folderName);
-                newFolder->name = newFolderName;
-                newFolder->type = Folder;
-                newFolder->numberOfItems = 0;
-                newFolder->size = 0;
-                newFolder->date = time(NULL);
-                newFolder->content = NULL;
-                newFolder->parent = currentFolder;
-                newFolder->next = NULL;
-                newFolder->child = NULL;
-
-                printf("Folder '%s' added to the virtual filesystem.\n", newFolder->name);
-
-                // Get the real path and create the folder in the real file system
-                char realPath[1024];
-                getRealPath(currentFolder, realPath);
-                char fullPath[1024];
-                snprintf(fullPath, sizeof(fullPath), "%s/%s", realPath, folderName);
-
-                if (mkdir(fullPath, 0755) == 0) {
-                    printf("Folder '%s' created in the real filesystem.\n", fullPath);
-                } else {
-                    perror("Error creating folder in the real filesystem");
-                }
-            } else {
-                fprintf(stderr, "'%s' already exists in the current directory!\n", folderName);
-            }
+// Drop the entries of the given kind whose key is prefix or lies below it
+void pathCacheInvalidatePrefix(const char* prefix, int positive) {
+    size_t prefixLength = strlen(prefix);
+    for (size_t i = 0; i < PATH_CACHE_SLOTS; i++) {
+        pathCacheEntry* entry = &dentryCache.slots[i];
+        if (!entry->key || (entry->result != NULL) != positive) continue;
+        if (strncmp(entry->key, prefix, prefixLength) == 0 &&
+            (entry->key[prefixLength] == '\0' || entry->key[prefixLength] == '/' || prefixLength == 1)) {
+            pathCacheDrop(entry);
         }
     }
 }
 
-void touch(node* currentFolder, char* command, char* currentPath) {
-    if (strtok(command, " ") != NULL) {
-        char* fileName = strtok(NULL, " ");
-        if (fileName != NULL) {
-            if (getNodeTypeless(currentFolder, fileName) == NULL) {
-                currentFolder->numberOfItems++;
-                node* newFile = malloc(sizeof(node));
-                // ... (Virtual tree addition remains unchanged)
-
-                // Construct the real path
-                char realPath[MAX_PATH_LENGTH];
-                getRealPath(currentFolder, realPath);
-                char fullPath[MAX_PATH_LENGTH];
-                int n = snprintf(fullPath, sizeof(fullPath), "%s/%s", realPath, fileName);
-
-                // Check for truncation
-                if (n < 0 || n >= (int)sizeof(fullPath)) {
-                    fprintf(stderr, "Error: Path too long for file '%s'.\n", fileName);
-                    return;
-                }
-
-                FILE* file = fopen(fullPath, "w");
-                if (file) {
-                    fclose(file);
-                    printf("File '%s' created in the real filesystem.\n", fullPath);
-                } else {
-                    printf("Error: Could not create file '%s'.\n", fullPath);
-                }
-            } else {
-                fprintf(stderr, "'%s' already exists in the current directory!\n", fileName);
-            }
-        }
+// Drop the entry stored under exactly this key, if it is of the given kind
+void pathCacheInvalidateExact(const char* key, int positive) {
+    size_t hash = hashName(key);
+    pathCacheEntry* entry = &dentryCache.slots[hash & (PATH_CACHE_SLOTS - 1)];
+    if (entry->key && (entry->result != NULL) == positive && entry->hash == hash && strcmp(entry->key, key) == 0) {
+        pathCacheDrop(entry);
     }
 }
 
-void ls(node *currentFolder) {
-    if (currentFolder->child == NULL) {
-        printf("___Empty____\n");
+// Called while item is still linked where it used to be
+void pathCacheNodeLeaving(node* item) {
+    char key[MAX_PATH_LENGTH];
+    if (dentryCache.positiveEntries == 0) return;
+    if (nodePath(item, key, sizeof(key)) != 0) {
+        pathCacheClear(); // Too deep to name; play it safe
         return;
     }
+    if (!nodeChild(item) && !(item->type == Folder && item->dir->lazyRecord)) {
+        // Nothing can be cached below a leaf
+        pathCacheInvalidateExact(key, 1);
+    } else {
+        pathCacheInvalidatePrefix(key, 1);
+    }
+}
 
-    node *currentNode = currentFolder->child;
-
-    while (currentNode != NULL) {
-        struct tm *date_time = localtime(&currentNode->date);
-        char dateString[26];
-        strftime(dateString, 26, "%d %b %H:%M", date_time);
-
-        if (currentNode->type == Folder) {
-            printf("%s%d items\t%s\t%s/%s\n", CYAN, currentNode->numberOfItems, dateString, currentNode->name, RESET);
-        } else if (currentNode->type == File) {
-            printf("%s%dB\t%s\t%s%s\n", YELLOW, (int)currentNode->size, dateString, currentNode->name, RESET);
-        } else if (currentNode->type == Symlink) {
-            printf("%s\t%s\t%s%s\n", BLUE, dateString, currentNode->name, RESET);
-        }
-
-        currentNode = currentNode->next;
+// Called once item is linked at its new place
+void pathCacheNodeArrived(node* item) {
+    char key[MAX_PATH_LENGTH];
+    if (dentryCache.negativeEntries == 0) return;
+    if (nodePath(item, key, sizeof(key)) != 0) {
+        pathCacheClear();
+        return;
+    }
+    if (!nodeChild(item) && !(item->type == Folder && item->dir->lazyRecord)) {
+        // Misses are only cached when the last component was missing, and
+        // nothing below a new leaf exists yet, so only its own path changed
+        pathCacheInvalidateExact(key, 0);
+    } else {
+        pathCacheInvalidatePrefix(key, 0);
     }
 }
 
+void pathCacheReport(void) {
+    uint64_t lookups = dentryCache.hits + dentryCache.misses;
+    printf("Entries: %zu (%zu positive, %zu negative) in %d slots\n",
+           dentryCache.positiveEntries + dentryCache.negativeEntries,
+           dentryCache.positiveEntries, dentryCache.negativeEntries, PATH_CACHE_SLOTS);
+    printf("Hits: %llu (%llu negative)\nMisses: %llu\nHit rate: %.1f%%\nInvalidations: %llu\n",
+           (unsigned long long)dentryCache.hits, (unsigned long long)dentryCache.negativeHits,
+           (unsigned long long)dentryCache.misses,
+           lookups ? 100.0 * (double)dentryCache.hits / (double)lookups : 0.0,
+           (unsigned long long)dentryCache.invalidations);
+}
 
-void lsrecursive(node *currentFolder, int indentCount) {
-    if (currentFolder->child == NULL) {
-        for (int i = 0; i < indentCount; ++i) {
-            printf("\t");
+// Canonical key for path as seen from base. Leading "." and ".." are applied
+// to base, "." and empty components are dropped. A ".." after a real component
+// makes the path uncacheable (-1), since whether it resolves depends on the
+// component it cancels. On success *start is the node to walk from and
+// *walkOffset is where its path ends inside the key.
+int pathCacheKey(node* base, const char* path, node* root, char* key, size_t keySize,
+                 node** start, size_t* walkOffset) {
+    node* from = base;
+    if (path[0] == '/') {
+        from = root;
+    } else {
+        // Leading "." and ".." only move the starting point
+        while (1) {
+            if (path[0] == '.' && (path[1] == '/' || path[1] == '\0')) {
+                path += 1;
+            } else if (path[0] == '.' && path[1] == '.' && (path[2] == '/' || path[2] == '\0')) {
+                if (nodeParent(from)) from = nodeParent(from);
+                else printf("Already at the root directory.\n");
+                path += 2;
+            } else {
+                break;
+            }
+            while (*path == '/') path++;
         }
-        if (indentCount != 0) {
-            printf("└─");
+    }
+    if (nodePath(from, key, keySize) != 0) return -1;
+
+    size_t length = strlen(key);
+    *start = from;
+    *walkOffset = length;
+    while (*path) {
+        while (*path == '/') path++;
+        size_t componentLength = strcspn(path, "/");
+        if (componentLength == 0) break;
+        if (componentLength == 1 && path[0] == '.') {
+            path += 1;
+            continue;
         }
-        printf("___Empty____\n");
-    } else {
-        const char* YELLOW = "\033[38;5;226m"; // Google Yellow for files
-        const char* CYAN = "\033[36m";         // Cyan for folders
-        const char* BLUE = "\033[38;5;33m";    // Google Blue for symlinks
-        const char* RESET = "\033[0m";         // Reset color
-
-        node *currentNode = currentFolder->child;
+        if (componentLength == 2 && path[0] == '.' && path[1] == '.') return -1;
+
+        int needsSlash = length > 1; // The root's key is just "/"
+        if (length + needsSlash + componentLength + 1 > keySize) return -1;
+        if (needsSlash) key[length++] = '/';
+        memcpy(key + length, path, componentLength);
+        length += componentLength;
+        key[length] = '\0';
+        path += componentLength;
+    }
+    return 0;
+}
 
-        while (currentNode != NULL) {
-            for (int i = 0; i < indentCount; ++i) {
-                printf("\t");
-            }
-            if (indentCount != 0) {
-                printf("└─");
-            }
+// Resolve path from currentFolder the old way, one strtok'd component at a time
+node* walkPath(node* currentFolder, const char* path, node* root, char* missing, size_t missingSize) {
+    char* copy = strdup(path); // strtok must not cut up the caller's string
+    if (!copy) return NULL;
+    char* cursor = copy;
 
-            struct tm *date_time = localtime(&currentNode->date);
-            char dateString[26];
-            strftime(dateString, 26, "%d %b %H:%M", date_time);
+    // Handle absolute path
+    if (cursor[0] == '/') {
+        currentFolder = root;
+        cursor++; // Skip the initial '/'
+    }
 
-            if (currentNode->type == Folder) {
-                // Print folder with cyan color
-                printf("%s%d items\t%s\t%s%s\n", CYAN, currentNode->numberOfItems, dateString, currentNode->name, RESET);
-            } else if (currentNode->type == File) {
-                // Print file with yellow color
-                printf("%s%dB\t%s\t%s%s\n", YELLOW, (int)currentNode->size, dateString, currentNode->name, RESET);
-            } else if (currentNode->type == Symlink) {
-                // Print symlink with blue color
-                printf("%s\t%s\t%s%s\n", BLUE, dateString, currentNode->name, RESET);
+    char* token = strtok(cursor, "/");
+    while (token != NULL) {
+        if (strcmp(token, "..") == 0) {
+            // Move to the parent directory
+            if (nodeParent(currentFolder)) {
+                currentFolder = nodeParent(currentFolder);
+            } else {
+                printf("Already at the root directory.\n");
             }
-
-            // Recursively call lsrecursive for child folders
-            if (currentNode->type == Folder) {
-                lsrecursive(currentNode, indentCount + 1);
+        } else if (strcmp(token, ".") == 0) {
+            // Stay in the current directory (do nothing)
+        } else {
+            // Use getNodeTypeless to find the child node by name
+            node* nextFolder = getNodeTypeless(currentFolder, token);
+            if (nextFolder) {
+                currentFolder = nextFolder;
+            } else {
+                snprintf(missing, missingSize, "%s", token);
+                free(copy);
+                return NULL;
             }
-
-            currentNode = currentNode->next;
         }
+        token = strtok(NULL, "/");
     }
-}
 
-void edit(node* currentFolder, char* command) {
-    if (strtok(command, " ") != NULL) {
-        char* fileName = strtok(NULL, " ");
-        if (fileName != NULL) {
-            node* editingNode = getNode(currentFolder, fileName, File);
-            if (editingNode) {
-                printf("Enter new content for '%s':\n", fileName);
-                char* content = getString();
+    free(copy);
+    return currentFolder;
+}
 
-                // Update memory
-                if (editingNode->content) {
-                    free(editingNode->content);
-                }
-                editingNode->content = strdup(content);
-                editingNode->size = strlen(content);
-                editingNode->date = time(NULL);
-
-                // Write to the real file
-                char path[1024];
-                snprintf(path, sizeof(path), "%s/%s", currentFolder->name, fileName);
-                FILE* file = fopen(path, "w");
-                if (file) {
-                    fprintf(file, "%s", content);
-                    fclose(file);
-                    printf("Content written to file '%s' in the real filesystem.\n", path);
-                } else {
-                    printf("Error: Could not write to file '%s'.\n", path);
-                }
+// Resolve a path through the path cache. On failure the component that did
+// not resolve is copied to missing.
+node* resolvePath(node* currentFolder, const char* path, node* root, char* missing, size_t missingSize) {
+    char key[MAX_PATH_LENGTH];
+    node* start;
+    size_t walkOffset;
+    if (pathCacheKey(currentFolder, path, root, key, sizeof(key), &start, &walkOffset) != 0) {
+        return walkPath(currentFolder, path, root, missing, missingSize);
+    }
 
-                free(content);
-            } else {
-                printf("File '%s' not found.\n", fileName);
+    size_t hash = hashName(key);
+    pathCacheEntry* entry = &dentryCache.slots[hash & (PATH_CACHE_SLOTS - 1)];
+    if (entry->key && entry->hash == hash && strcmp(entry->key, key) == 0) {
+        dentryCache.hits++;
+        if (!entry->result) {
+            dentryCache.negativeHits++;
+            snprintf(missing, missingSize, "%.*s", (int)entry->missingLength, entry->key + entry->missingStart);
+        }
+        return entry->result;
+    }
+    dentryCache.misses++;
+
+    // Walk the canonical components after the starting point
+    node* current = start;
+    size_t position = walkOffset;
+    while (key[position] != '\0') {
+        if (key[position] == '/') position++;
+        size_t componentLength = strcspn(key + position, "/");
+        char saved = key[position + componentLength];
+        key[position + componentLength] = '\0';
+        node* next = getNodeTypeless(current, key + position);
+        key[position + componentLength] = saved;
+
+        if (!next) {
+            snprintf(missing, missingSize, "%.*s", (int)componentLength, key + position);
+            // Only cache misses on the last component; a deeper path fails early anyway
+            if (saved == '\0' && position <= USHRT_MAX && componentLength <= USHRT_MAX) {
+                pathCacheStore(key, hash, NULL, position, componentLength);
             }
+            return NULL;
         }
+        current = next;
+        position += componentLength;
     }
+    pathCacheStore(key, hash, current, 0, 0);
+    return current;
 }
 
-void clear() {
-    #ifdef _WIN32
-        system("cls"); // Windows-specific command to clear the screen
-    #else
-        system("clear"); // Unix/Linux/Mac command to clear the screen
-    #endif
+node* parsePath(node* currentFolder, char* path, node* root) {
+    char missing[256];
+    uint64_t started = metricsStart(MetricParsePath);
+    node* target = resolvePath(currentFolder, path, root, missing, sizeof(missing));
+    metricsRecord(MetricParsePath, started);
+    if (!target) {
+        printf("Error: Directory or file '%s' not found.\n", missing);
+    }
+    return target;
 }
 
+// find: match names with a glob and File contents with a substring or a
+// regular expression, walking the subtree in parallel. Matches are written
+// as full paths as soon as a thread finds them.
+typedef struct findQuery {
+    const char* namePattern;     // fnmatch glob, or NULL
+    const char* substring;       // Content substring, or NULL
+    size_t substringLength;
+    regex_t regex;               // Content regex, when hasRegex
+    int hasRegex;
+    pthread_mutex_t outputLock;  // One path per write, whole
+} findQuery;
+
+typedef struct findCount {
+    uint64_t matches;
+    uint64_t nodes;
+} findCount;
+
+// Find needle in haystack[0..length). With SSE2 the needle's first and last
+// bytes are compared against 16 positions at once, and only positions where
+// both match are checked in full.
+const char* findSubstring(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    if (needleLength == 0) return haystack;
+    if (needleLength > length) return NULL;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    for (; i + needleLength - 1 + 16 <= length; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(haystack + i + bit, needle, needleLength) == 0) return haystack + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + needleLength <= length; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needleLength) == 0) return haystack + i;
+    }
+    return NULL;
+}
 
-void pwd(char *path) {
-    if (path && strlen(path) > 0) {
-        // Print the path directly without trimming the last character
-        printf("%s\n", path);
-    } else {
-        // Default to root if the path is not set or invalid
-        printf("/\n");
+int findMatches(node* item, findQuery* query) {
+    if (query->namePattern && fnmatch(query->namePattern, nodeName(item), 0) != 0) return 0;
+    if (query->substring || query->hasRegex) {
+        if (item->type != File || !item->content) return 0;
+
+        // One-chunk files are searched in place; longer ones are flattened so
+        // that matches across chunk boundaries are found
+        fileContent* content = item->content;
+        if (query->substring && !query->hasRegex && content->count == 1) {
+            return findSubstring(content->chunks[0]->data, content->length,
+                                 query->substring, query->substringLength) != NULL;
+        }
+        char* text = contentString(content);
+        if (!text) return 0;
+        int matched = 1;
+        if (query->substring && !findSubstring(text, content->length, query->substring, query->substringLength)) {
+            matched = 0;
+        }
+        if (matched && query->hasRegex && regexec(&query->regex, text, 0, NULL, 0) != 0) matched = 0;
+        free(text);
+        return matched;
     }
+    return 1;
 }
 
-node* cd(node *currentFolder, char *command, char **path, node *root) {
-    if (strtok(command, " ") != NULL) {
-        char* targetPath = strtok(NULL, " ");
-        if (targetPath != NULL) {
-            // Check if the path is absolute
-            if (targetPath[0] == '/') {
-                // Navigate to root explicitly for absolute paths
-                currentFolder = root;
-                *path = realloc(*path, sizeof(char) * 2);
-                strcpy(*path, "/");
-                targetPath++; // Skip the initial '/'
-            }
+void findVisitor(node* item, void* accumulator, void* argument) {
+    findQuery* query = argument;
+    findCount* count = accumulator;
+    count->nodes++;
+    if (!findMatches(item, query)) return;
+    count->matches++;
+
+    char buffer[MAX_PATH_LENGTH];
+    size_t length = nodePathLength(item);
+    char* path = length < sizeof(buffer) ? buffer : malloc(length + 1);
+    if (!path) return;
+    nodePath(item, path, length + 1);
+    path[length] = '\n';
+
+    pthread_mutex_lock(&query->outputLock);
+    fwrite(path, 1, length + 1, stdout);
+    if (!batchMode) fflush(stdout); // Show results while the search is still going
+    pthread_mutex_unlock(&query->outputLock);
+
+    if (path != buffer) free(path);
+}
 
-            // Tokenize the path and navigate step-by-step
-            char* token = strtok(targetPath, "/");
-            while (token != NULL) {
-                if (strcmp(token, "..") == 0) {
-                    // Navigate to the parent directory
-                    if (currentFolder->parent != NULL) {
-                        currentFolder = currentFolder->parent;
-                        // Update the path
-                        char* lastSlash = strrchr(*path, '/');
-                        if (lastSlash && lastSlash != *path) {
-                            *lastSlash = '\0';
-                        } else {
-                            strcpy(*path, "/");
-                        }
-                    } else {
-                        printf("Already at the root directory.\n");
-                    }
-                } else if (strcmp(token, ".") == 0) {
-                    // Stay in the current directory (no-op)
-                } else {
-                    // Navigate to a child directory
-                    node* destinationFolder = getNode(currentFolder, token, Folder);
-                    if (destinationFolder != NULL) {
-                        currentFolder = destinationFolder;
-
-                        // Update the path
-                        size_t newPathLength = strlen(*path) + strlen(destinationFolder->name) + 2;
-                        *path = realloc(*path, sizeof(char) * newPathLength);
-                        if (strcmp(*path, "/") == 0) {
-                            strcat(*path, token);
-                        } else {
-                            strcat(strcat(*path, "/"), token);
-                        }
-                    } else {
-                        fprintf(stderr, "There is no '%s' folder in the current directory!\n", token);
-                        return currentFolder;
-                    }
-                }
+void findReducer(void* total, const void* partial) {
+    findCount* sum = total;
+    const findCount* part = partial;
+    sum->matches += part->matches;
+    sum->nodes += part->nodes;
+}
 
-                token = strtok(NULL, "/");
-            }
+// Split a find command line into words; "double quotes" keep spaces inside one word
+int findSplitArguments(char* line, char** words, int maxWords) {
+    int count = 0;
+    char* cursor = line;
+    while (*cursor && count < maxWords) {
+        while (*cursor == ' ') cursor++;
+        if (!*cursor) break;
+        if (*cursor == '"') {
+            words[count++] = ++cursor;
+            while (*cursor && *cursor != '"') cursor++;
         } else {
-            printf("Error: No path provided.\n");
+            words[count++] = cursor;
+            while (*cursor && *cursor != ' ') cursor++;
         }
+        if (*cursor) *cursor++ = '\0';
     }
-    return currentFolder;
+    return count;
 }
 
-node* cdup(node *currentFolder, char **path) {
-
-    size_t newPathLength = strlen(*path) - strlen(currentFolder->name);
-
-    while (currentFolder->previous != NULL) {
-        currentFolder = currentFolder->previous;
+// find [path] [-name glob] [-content text | -regex pattern] [-t threads]
+void find(node* currentFolder, node* root, char* command) {
+    char* words[16];
+    int count = findSplitArguments(command, words, 16);
+
+    findQuery query;
+    memset(&query, 0, sizeof(query));
+    const char* startPath = NULL;
+    const char* regexPattern = NULL;
+    int threads = walkDefaultThreads();
+
+    for (int i = 1; i < count; i++) {
+        int hasValue = i + 1 < count;
+        if (strcmp(words[i], "-name") == 0 && hasValue) {
+            query.namePattern = words[++i];
+        } else if (strcmp(words[i], "-content") == 0 && hasValue) {
+            query.substring = words[++i];
+            query.substringLength = strlen(query.substring);
+        } else if (strcmp(words[i], "-regex") == 0 && hasValue) {
+            regexPattern = words[++i];
+        } else if (strcmp(words[i], "-t") == 0 && hasValue) {
+            threads = atoi(words[++i]);
+            if (threads < 1 || threads > WALK_MAX_THREADS) {
+                printf("Error: Thread count must be between 1 and %d.\n", WALK_MAX_THREADS);
+                return;
+            }
+        } else if (words[i][0] != '-' && !startPath) {
+            startPath = words[i];
+        } else {
+            printf("Error: Usage: find [path] [-name glob] [-content text] [-regex pattern] [-t threads]\n");
+            return;
+        }
     }
-    if (currentFolder->parent != NULL ) {
 
-        *path = (char *) realloc(*path, sizeof(char)* newPathLength);
-        (*path)[newPathLength-1] = '\0';
+    node* start = startPath ? parsePath(currentFolder, (char*)startPath, root) : currentFolder;
+    if (!start) return;
 
-        currentFolder = currentFolder->parent;
-        return currentFolder;
-    } else {
-        return currentFolder;
+    if (regexPattern) {
+        int status = regcomp(&query.regex, regexPattern, REG_EXTENDED | REG_NOSUB);
+        if (status != 0) {
+            char message[256];
+            regerror(status, &query.regex, message, sizeof(message));
+            printf("Error: Invalid regex '%s': %s\n", regexPattern, message);
+            return;
+        }
+        query.hasRegex = 1;
     }
-}
+    pthread_mutex_init(&query.outputLock, NULL);
 
-void freeNode(node *freeingNode) {
+    findCount total = {0};
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    int used = parallelWalk(start, threads, findVisitor, &query, sizeof(findCount), findReducer, &total);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double milliseconds = (double)(end.tv_sec - begin.tv_sec) * 1e3 + (double)(end.tv_nsec - begin.tv_nsec) / 1e6;
 
-    if (freeingNode->child != NULL) {
+    printf("%llu matches in %llu nodes (%d threads, %.3f ms)\n", (unsigned long long)total.matches,
+           (unsigned long long)total.nodes, used, milliseconds);
 
-        node* currentNode = freeingNode->child;
+    pthread_mutex_destroy(&query.outputLock);
+    if (query.hasRegex) regfree(&query.regex);
+}
 
-        while (currentNode->next != NULL) {
-            node* nextNode = currentNode->next;
-            freeNode(currentNode);
-            currentNode = nextNode;
-        }
-        freeNode(currentNode);
+// Function to read and display the contents of a file
+void echo(node* currentFolder, char* fileName, node* root) {
+    // Find the node with the given file name in the current folder
+    node* targetNode = getNodeTypeless(currentFolder, fileName);
+    if (targetNode == NULL) {
+        printf("Error: File '%s' not found.\n", fileName);
+        return;
     }
-    free(freeingNode->name);
-    free(freeingNode->content);
-    free(freeingNode);
 
+    // If the node is a symlink, resolve it to its target
+    if (targetNode->type == Symlink) {
+        char* targetPath = targetNode->symlinkTarget;
+        printf("Following symlink '%s' -> '%s'\n", fileName, targetPath);
+
+        // Resolve the symlink path
+        targetNode = parsePath(currentFolder, targetPath, root);
+        if (targetNode == NULL) {
+            printf("Error: Target of symlink '%s' not found.\n", fileName);
+            return;
+        }
+    }
+
+    // Ensure the resolved node is a file
+    if (targetNode->type != File) {
+        printf("Error: '%s' is not a file.\n", fileName);
+        return;
+    }
+
+    // The tree is authoritative (the mirror may still be catching up), so print from memory
+    printf("Contents of '%s':\n", nodeName(targetNode));
+    if (targetNode->content) {
+        contentPrint(targetNode->content, stdout);
+        printf("\n");
+    }
+}
+
+
+void saveDirectoryToFile(node* folder, FILE* file, int depth) {
+    if (!folder) return;
+    materialize(folder);
+
+    // Indentation for better readability
+    for (int i = 0; i < depth; i++) fprintf(file, "  ");
+    fprintf(file, "{\n");
+
+    // Write folder/file properties
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "\"type\": \"%s\",\n", folder->type == Folder ? "Folder" : (folder->type == File ? "File" : "Symlink"));
+
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "\"name\": \"%s\",\n", nodeName(folder));
+
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "\"size\": %zu,\n", folder->size);
+
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "\"date\": %ld", folder->date);
+
+    if (folder->type == File && folder->content) {
+        fprintf(file, ",\n");
+        for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+        fprintf(file, "\"content\": \"");
+        contentPrint(folder->content, file);
+        fprintf(file, "\"");
+    }
+
+    if (folder->type == Symlink) {
+        fprintf(file, ",\n");
+        for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+        fprintf(file, "\"symlinkTarget\": \"%s\"", folder->symlinkTarget);
+    }
+
+    // Children
+    fprintf(file, ",\n");
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "\"children\": [\n");
+
+    node* current = nodeChild(folder);
+    while (current) {
+        saveDirectoryToFile(current, file, depth + 1);
+        current = nodeNext(current);
+        if (current) fprintf(file, ",\n");
+    }
+
+    // Closing children array
+    fprintf(file, "\n");
+    for (int i = 0; i <= depth; i++) fprintf(file, "  ");
+    fprintf(file, "]\n");
+
+    // Closing this node
+    for (int i = 0; i < depth; i++) fprintf(file, "  ");
+    fprintf(file, "}");
+}
+
+void saveDirectory(node* root, const char* filename) {
+    materializeTree(root); // The target may be the very snapshot the tree is mapped from
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        printf("Error: Could not open file '%s' for saving.\n", filename);
+        return;
+    }
+
+    uint64_t started = metricsStart(MetricSaveText);
+    saveDirectoryToFile(root, file, 0);
+    metricsRecord(MetricSaveText, started);
+    fprintf(file, "\n"); // Final newline for cleanliness
+    fclose(file);
+
+    printf("Directory structure saved to '%s'.\n", filename);
+}
+
+
+node* loadDirectoryFromFile(FILE* file, node* parent) {
+    char line[1024];
+    node* firstChild = NULL;
+
+    while (fgets(line, sizeof(line), file)) {
+        // End of the current folder's children
+        if (strstr(line, "]")) break;
+
+        // Check for opening brace indicating a new node
+        if (strstr(line, "{")) {
+            // The node is created once its type is known, which is saved first
+            node* newNode = NULL;
+
+            // Parse node properties
+            while (fgets(line, sizeof(line), file) && !strstr(line, "}")) {
+                if (!newNode) {
+                    enum nodeType type = Folder;
+                    if (strstr(line, "\"type\":") && strstr(line, "File")) {
+                        type = File;
+                    } else if (strstr(line, "\"type\":") && strstr(line, "Symlink")) {
+                        type = Symlink;
+                    }
+                    newNode = createNode(type, "");
+                }
+                if (strstr(line, "\"type\":")) {
+                    continue;
+                } else if (strstr(line, "\"name\":")) {
+                    char name[256];
+                    sscanf(line, " \"name\": \"%255[^\"]\"", name);
+                    nodeSetName(newNode, name);
+                } else if (strstr(line, "\"size\":")) {
+                    sscanf(line, " \"size\": %zu", &newNode->size);
+                } else if (strstr(line, "\"date\":")) {
+                    sscanf(line, " \"date\": %ld", &newNode->date);
+                } else if (strstr(line, "\"symlinkTarget\":") && newNode->type == Symlink) {
+                    char target[256];
+                    sscanf(line, " \"symlinkTarget\": \"%255[^\"]\"", target);
+                    newNode->symlinkTarget = arenaStrdup(activeArena, target);
+                } else if (strstr(line, "\"content\":") && newNode->type == File) {
+                    char content[1024] = "";
+                    sscanf(line, " \"content\": \"%1023[^\"]\"", content);
+                    newNode->content = contentIntern(content, strlen(content));
+                } else if (strstr(line, "\"children\":") && newNode->type == Folder) {
+                    // Recursively load children; they add their totals as they link
+                    loadDirectoryFromFile(file, newNode);
+                }
+            }
+            if (!newNode) newNode = createNode(Folder, "");
+
+            // Link the node under its parent (the name is known by now)
+            if (parent) {
+                linkChild(parent, newNode);
+            }
+            if (!firstChild) {
+                firstChild = newNode; // First child under this parent
+            }
+
+            // Debug output to track structure
+            printf("Loaded: %s (%s)\n", nodeName(newNode),
+                   (newNode->type == Folder ? "Folder" :
+                   (newNode->type == File ? "File" : "Symlink")));
+        }
+    }
+
+    return firstChild;
+}
+
+node* loadDirectory(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        printf("Error: Could not open file '%s' for loading.\n", filename);
+        return NULL;
+    }
+
+    // node* root = malloc(sizeof(node));
+    // root->type = Folder;
+    // root->name = strdup("/");
+    // root->parent = NULL;
+    // root->child = NULL;
+    // root->next = NULL;
+    // root->previous = NULL;
+    // root->symlinkTarget = NULL;
+    // root->numberOfItems = 0;
+
+    // Load the directory tree from the file
+    uint64_t started = metricsStart(MetricLoadText);
+    node* loadedRoot = loadDirectoryFromFile(file, NULL);
+    metricsRecord(MetricLoadText, started);
+    fclose(file);
+
+    // Ensure the loaded root has the correct parent-child structure
+    if (loadedRoot) {
+        printf("Directory structure loaded from '%s'.\n", filename);
+        return loadedRoot;
+    } else {
+        printf("Error: Failed to load directory structure from '%s'.\n", filename);
+        return NULL;
+    }
+}
+
+
+// Binary snapshot format (save -b / load -b), all integers little-endian:
+//   snapshotHeader
+//   string table: stringCount entries of { uint32 length; char bytes[length]; }
+//   node table:   nodeCount snapshotRecords in preorder
+// Records refer to strings by byte offset into the string table, and
+// identical strings are stored once.
+#define SNAPSHOT_MAGIC "SFSB"
+#define SNAPSHOT_VERSION 2         // Version 2 added the subtree totals to each record
+#define SNAPSHOT_V1_RECORD_SIZE 56
+#define SNAPSHOT_NO_STRING UINT64_MAX
+#define SNAPSHOT_BATCH 4096 // Records per read/write call
+
+typedef struct snapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t nodeCount;
+    uint64_t stringCount;
+    uint64_t stringBytes;    // Size of the string table, length prefixes included
+} snapshotHeader;
+
+typedef struct snapshotRecord {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t childCount;
+    uint64_t size;
+    int64_t date;
+    uint64_t descendants;    // Nodes below this one, so a reader can skip the subtree
+    uint64_t name;           // String table offsets, SNAPSHOT_NO_STRING when absent
+    uint64_t content;
+    uint64_t symlinkTarget;
+    subtreeStats stats;      // Totals of the subtree rooted here (version 2+)
+} snapshotRecord;
+
+_Static_assert(sizeof(snapshotHeader) == 32, "snapshotHeader must not be padded");
+_Static_assert(sizeof(snapshotRecord) == 88, "snapshotRecord must not be padded");
+
+typedef struct stringSlot {
+    const char* str;
+    uint64_t offset;
+} stringSlot;
+
+typedef struct contentSlot {
+    const fileContent* content;
+    uint64_t offset;
+} contentSlot;
+
+// One string table entry: a plain string, or a file content written chunk by chunk
+typedef struct tableEntry {
+    const char* str;
+    const fileContent* content;
+} tableEntry;
+
+// State gathered by the first pass of saveSnapshot
+typedef struct snapshotPlan {
+    stringSlot* slots;       // Open-addressing set of distinct strings
+    size_t slotCapacity;
+    contentSlot* contentSlots; // Open-addressing set of the contents already in the table
+    size_t contentSlotCapacity;
+    uint64_t contentCount;
+    tableEntry* strings;     // Distinct strings and contents in table order
+    uint64_t stringCount;
+    uint64_t stringBytes;
+    uint64_t* descendants;   // Descendant count per node, in preorder
+    uint64_t* contents;      // Content string offset per node, in preorder
+    uint64_t nodeCount;
+    int failed;
+} snapshotPlan;
+
+int planGrow(snapshotPlan* plan) {
+    size_t capacity = plan->slotCapacity ? plan->slotCapacity * 2 : 1024;
+    stringSlot* slots = calloc(capacity, sizeof(stringSlot));
+    tableEntry* strings = realloc(plan->strings, capacity / 2 * sizeof(tableEntry));
+    if (!slots || !strings) {
+        free(slots);
+        if (strings) plan->strings = strings;
+        return -1;
+    }
+    plan->strings = strings;
+
+    for (size_t i = 0; i < plan->slotCapacity; i++) {
+        if (!plan->slots[i].str) continue;
+        size_t slot = hashName(plan->slots[i].str) & (capacity - 1);
+        while (slots[slot].str) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = plan->slots[i];
+    }
+    free(plan->slots);
+    plan->slots = slots;
+    plan->slotCapacity = capacity;
+    return 0;
+}
+
+// Return the string table offset of str, adding it on first sight
+uint64_t planString(snapshotPlan* plan, const char* str) {
+    if (!str) return SNAPSHOT_NO_STRING;
+    if ((plan->stringCount + 1) * 2 > plan->slotCapacity && planGrow(plan) != 0) {
+        plan->failed = 1;
+        return SNAPSHOT_NO_STRING;
+    }
+
+    size_t slot = hashName(str) & (plan->slotCapacity - 1);
+    while (plan->slots[slot].str) {
+        if (strcmp(plan->slots[slot].str, str) == 0) return plan->slots[slot].offset;
+        slot = (slot + 1) & (plan->slotCapacity - 1);
+    }
+
+    plan->slots[slot].str = str;
+    plan->slots[slot].offset = plan->stringBytes;
+    plan->strings[plan->stringCount].str = str;
+    plan->strings[plan->stringCount++].content = NULL;
+    plan->stringBytes += sizeof(uint32_t) + strlen(str);
+    return plan->slots[slot].offset;
+}
+
+// Contents are deduplicated by the content store, so one entry per content
+// is enough; its chunks are written straight into the table, never flattened
+uint64_t planContent(snapshotPlan* plan, const fileContent* content) {
+    if (!content) return SNAPSHOT_NO_STRING;
+    if ((plan->contentCount + 1) * 2 > plan->contentSlotCapacity) {
+        size_t capacity = plan->contentSlotCapacity ? plan->contentSlotCapacity * 2 : 1024;
+        contentSlot* slots = calloc(capacity, sizeof(contentSlot));
+        if (!slots) {
+            plan->failed = 1;
+            return SNAPSHOT_NO_STRING;
+        }
+        for (size_t i = 0; i < plan->contentSlotCapacity; i++) {
+            if (!plan->contentSlots[i].content) continue;
+            size_t slot = ((uintptr_t)plan->contentSlots[i].content >> 4) & (capacity - 1);
+            while (slots[slot].content) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = plan->contentSlots[i];
+        }
+        free(plan->contentSlots);
+        plan->contentSlots = slots;
+        plan->contentSlotCapacity = capacity;
+    }
+
+    size_t slot = ((uintptr_t)content >> 4) & (plan->contentSlotCapacity - 1);
+    while (plan->contentSlots[slot].content) {
+        if (plan->contentSlots[slot].content == content) return plan->contentSlots[slot].offset;
+        slot = (slot + 1) & (plan->contentSlotCapacity - 1);
+    }
+
+    // The table entry shares the strings array, which grows with the string slots
+    if ((plan->stringCount + 1) * 2 > plan->slotCapacity && planGrow(plan) != 0) {
+        plan->failed = 1;
+        return SNAPSHOT_NO_STRING;
+    }
+    plan->contentSlots[slot].content = content;
+    plan->contentSlots[slot].offset = plan->stringBytes;
+    plan->contentCount++;
+    plan->strings[plan->stringCount].str = NULL;
+    plan->strings[plan->stringCount++].content = content;
+    plan->stringBytes += sizeof(uint32_t) + content->length;
+    return plan->contentSlots[slot].offset;
+}
+
+// First pass: number the nodes in preorder, record subtree sizes and collect strings
+uint64_t planNode(snapshotPlan* plan, node* current, size_t* descendantsCapacity) {
+    uint64_t position = plan->nodeCount++;
+    if (position >= *descendantsCapacity) {
+        size_t capacity = *descendantsCapacity ? *descendantsCapacity * 2 : 1024;
+        uint64_t* descendants = realloc(plan->descendants, capacity * sizeof(uint64_t));
+        if (descendants) plan->descendants = descendants;
+        uint64_t* contents = realloc(plan->contents, capacity * sizeof(uint64_t));
+        if (contents) plan->contents = contents;
+        if (!descendants || !contents) {
+            plan->failed = 1;
+            return 0;
+        }
+        *descendantsCapacity = capacity;
+    }
+
+    materialize(current);
+    planString(plan, nodeName(current));
+    plan->contents[position] = planContent(plan, current->type == File ? current->content : NULL);
+    planString(plan, nodeTarget(current));
+
+    uint64_t below = 0;
+    for (node* child = nodeChild(current); child && !plan->failed; child = nodeNext(child)) {
+        below += 1 + planNode(plan, child, descendantsCapacity);
+    }
+    plan->descendants[position] = below;
+    return below;
+}
+
+// Lookup of a string that is known to be in the plan
+uint64_t planOffset(snapshotPlan* plan, const char* str) {
+    if (!str) return SNAPSHOT_NO_STRING;
+    size_t slot = hashName(str) & (plan->slotCapacity - 1);
+    while (strcmp(plan->slots[slot].str, str) != 0) slot = (slot + 1) & (plan->slotCapacity - 1);
+    return plan->slots[slot].offset;
+}
+
+// Destination of a serialized snapshot: a plain file or the gzip pipeline
+typedef struct snapshotSink {
+    int (*write)(void* context, const void* data, size_t length);
+    void* context;
+    int failed;
+} snapshotSink;
+
+void sinkWrite(snapshotSink* sink, const void* data, size_t length) {
+    if (!sink->failed && length > 0 && sink->write(sink->context, data, length) != 0) {
+        sink->failed = 1;
+    }
+}
+
+int fileSinkWrite(void* context, const void* data, size_t length) {
+    return fwrite(data, 1, length, (FILE*)context) == length ? 0 : -1;
+}
+
+// Second pass: emit the node table in the same preorder as planNode
+void writeRecords(snapshotPlan* plan, node* current, snapshotRecord* batch, size_t* batchCount,
+                  uint64_t* position, snapshotSink* sink) {
+    snapshotRecord* record = &batch[(*batchCount)++];
+    memset(record, 0, sizeof(*record));
+    record->type = (uint8_t)current->type;
+    record->childCount = current->type == Folder ? (uint32_t)current->dir->numberOfItems : 0;
+    record->size = current->size;
+    record->date = (int64_t)current->date;
+    record->descendants = plan->descendants[*position];
+    record->content = plan->contents[(*position)++];
+    record->name = planOffset(plan, nodeName(current));
+    record->symlinkTarget = planOffset(plan, nodeTarget(current));
+    record->stats = nodeStats(current);
+
+    if (*batchCount == SNAPSHOT_BATCH) {
+        sinkWrite(sink, batch, *batchCount * sizeof(snapshotRecord));
+        *batchCount = 0;
+    }
+    for (node* child = nodeChild(current); child; child = nodeNext(child)) {
+        writeRecords(plan, child, batch, batchCount, position, sink);
+    }
+}
+
+void freePlan(snapshotPlan* plan) {
+    free(plan->slots);
+    free(plan->strings);
+    free(plan->descendants);
+    free(plan->contents);
+    free(plan->contentSlots);
+}
+
+// First pass over the tree; also builds every lazy folder before any output is truncated
+int planSnapshot(snapshotPlan* plan, node* root) {
+    size_t descendantsCapacity = 0;
+    planString(plan, nodeName(root));
+    planNode(plan, root, &descendantsCapacity);
+    return plan->failed ? -1 : 0;
+}
+
+// Stream a planned tree to the sink: header, string table, node table
+int writeSnapshot(snapshotPlan* plan, node* root, snapshotSink* sink) {
+    snapshotHeader header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.nodeCount = plan->nodeCount;
+    header.stringCount = plan->stringCount;
+    header.stringBytes = plan->stringBytes;
+    sinkWrite(sink, &header, sizeof(header));
+
+    for (uint64_t i = 0; i < plan->stringCount; i++) {
+        const fileContent* content = plan->strings[i].content;
+        uint32_t length = (uint32_t)(content ? content->length : strlen(plan->strings[i].str));
+        sinkWrite(sink, &length, sizeof(length));
+        if (!content) {
+            sinkWrite(sink, plan->strings[i].str, length);
+            continue;
+        }
+        for (size_t k = 0; k < content->count; k++) {
+            sinkWrite(sink, content->chunks[k]->data, content->chunks[k]->length);
+        }
+    }
+
+    snapshotRecord* batch = malloc(SNAPSHOT_BATCH * sizeof(snapshotRecord));
+    if (!batch) return -1;
+    size_t batchCount = 0;
+    uint64_t position = 0;
+    writeRecords(plan, root, batch, &batchCount, &position, sink);
+    sinkWrite(sink, batch, batchCount * sizeof(snapshotRecord));
+    free(batch);
+    return sink->failed ? -1 : 0;
+}
+
+// Write a snapshot file; durable also syncs it to disk. Returns -1 and prints why on failure
+int snapshotToFile(node* root, const char* filename, int durable, snapshotPlan* plan) {
+    if (planSnapshot(plan, root) != 0) {
+        printf("Error: Out of memory while saving '%s'.\n", filename);
+        return -1;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        printf("Error: Could not open file '%s' for saving.\n", filename);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    snapshotSink sink = {fileSinkWrite, file, 0};
+    uint64_t started = metricsStart(MetricSaveBinary);
+    int failed = writeSnapshot(plan, root, &sink) != 0;
+    metricsRecord(MetricSaveBinary, started);
+    if (durable && (fflush(file) != 0 || fsync(fileno(file)) != 0)) failed = 1;
+    if (fclose(file) != 0) failed = 1;
+    if (failed) {
+        printf("Error: Could not write snapshot '%s'.\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+void saveSnapshot(node* root, const char* filename) {
+    snapshotPlan plan = {0};
+    if (snapshotToFile(root, filename, 0, &plan) == 0) {
+        printf("Directory structure saved to '%s' (%llu nodes, %llu distinct strings).\n",
+               filename, (unsigned long long)plan.nodeCount, (unsigned long long)plan.stringCount);
+    }
+    freePlan(&plan);
+}
+
+// Copy a string out of the loaded string table into the active arena
+int snapshotString(const char* table, uint64_t tableBytes, uint64_t offset, char** out) {
+    *out = NULL;
+    if (offset == SNAPSHOT_NO_STRING) return 0;
+    if (offset > tableBytes || tableBytes - offset < sizeof(uint32_t)) return -1;
+
+    uint32_t length;
+    memcpy(&length, table + offset, sizeof(length));
+    if (tableBytes - offset - sizeof(uint32_t) < length) return -1;
+
+    char* str = arenaAlloc(activeArena, (size_t)length + 1);
+    if (!str) return -1;
+    memcpy(str, table + offset + sizeof(uint32_t), length);
+    str[length] = '\0';
+    *out = str;
+    return 0;
+}
+
+// Build chunked content straight out of the loaded string table
+int snapshotContent(const char* table, uint64_t tableBytes, uint64_t offset, fileContent** out) {
+    *out = NULL;
+    if (offset == SNAPSHOT_NO_STRING) return 0;
+    if (offset > tableBytes || tableBytes - offset < sizeof(uint32_t)) return -1;
+
+    uint32_t length;
+    memcpy(&length, table + offset, sizeof(length));
+    if (tableBytes - offset - sizeof(uint32_t) < length) return -1;
+
+    *out = contentIntern(table + offset + sizeof(uint32_t), length);
+    return *out ? 0 : -1;
+}
+
+// Name a node after a string in the table; unlike other strings, a name is required
+int snapshotName(const char* table, uint64_t tableBytes, uint64_t offset, node* item) {
+    if (offset == SNAPSHOT_NO_STRING) return -1;
+    if (offset > tableBytes || tableBytes - offset < sizeof(uint32_t)) return -1;
+
+    uint32_t length;
+    memcpy(&length, table + offset, sizeof(length));
+    if (tableBytes - offset - sizeof(uint32_t) < length) return -1;
+    return nodeSetNameLength(item, table + offset + sizeof(uint32_t), length);
+}
+
+// Build a detached node from a snapshot record, NULL if a string reference is bad
+node* nodeFromRecord(const snapshotRecord* record, const char* table, uint64_t tableBytes) {
+    node* newNode = createNode((enum nodeType)record->type, "");
+    if (!newNode) return NULL;
+
+    newNode->size = record->size;
+    newNode->date = (time_t)record->date;
+    int failed = snapshotName(table, tableBytes, record->name, newNode) != 0;
+    if (!failed && newNode->type == File) {
+        failed = snapshotContent(table, tableBytes, record->content, &newNode->content) != 0;
+    } else if (!failed && newNode->type == Symlink) {
+        failed = snapshotString(table, tableBytes, record->symlinkTarget, &newNode->symlinkTarget) != 0;
+    }
+    if (failed) {
+        freeNode(newNode);
+        return NULL;
+    }
+    return newNode;
+}
+
+typedef struct snapshotFrame {
+    node* folder;
+    uint32_t remaining;      // Children of folder still to be read
+} snapshotFrame;
+
+// Origin of a serialized snapshot: a plain file or a gzip stream
+typedef struct snapshotSource {
+    size_t (*read)(void* context, void* data, size_t length); // Bytes read, short on EOF/error
+    void* context;
+    uint64_t limit;          // Most bytes the stream can hold, header included
+} snapshotSource;
+
+size_t fileSourceRead(void* context, void* data, size_t length) {
+    return fread(data, 1, length, (FILE*)context);
+}
+
+// Buffers held while a snapshot is being read
+typedef struct snapshotReader {
+    char* table;
+    unsigned char* batch;    // Raw records, which are shorter in version 1
+    snapshotFrame* stack;
+    size_t stackCapacity;
+    size_t depth;
+} snapshotReader;
+
+void closeSnapshotReader(snapshotReader* reader) {
+    free(reader->table);
+    free(reader->batch);
+    free(reader->stack);
+}
+
+// Close the innermost folders whose children are all read, handing their
+// finished totals to the folder above
+void closeSnapshotFolders(snapshotReader* reader) {
+    while (reader->depth > 0 && reader->stack[reader->depth - 1].remaining == 0) {
+        reader->depth--;
+        node* folder = reader->stack[reader->depth].folder;
+        if (nodeParent(folder)) {
+            addStats(&nodeParent(folder)->dir->stats, &folder->dir->stats);
+        }
+    }
+}
+
+// Attach a freshly read node under the innermost open folder and open it if
+// it has children. Totals are summed bottom-up, so loading stays linear.
+int placeSnapshotNode(snapshotReader* reader, node* newNode, uint32_t childCount) {
+    if (reader->depth > 0) {
+        node* folder = reader->stack[reader->depth - 1].folder;
+        reader->stack[reader->depth - 1].remaining--;
+        attachChild(folder, newNode);
+        if (childCount == 0) {
+            subtreeStats stats = nodeStats(newNode); // A leaf is complete already
+            addStats(&folder->dir->stats, &stats);
+        }
+    }
+    if (childCount == 0) return 0;
+
+    if (reader->depth == reader->stackCapacity) {
+        size_t capacity = reader->stackCapacity ? reader->stackCapacity * 2 : 64;
+        snapshotFrame* stack = realloc(reader->stack, capacity * sizeof(snapshotFrame));
+        if (!stack) return -1;
+        reader->stack = stack;
+        reader->stackCapacity = capacity;
+    }
+    reader->stack[reader->depth].folder = newNode;
+    reader->stack[reader->depth].remaining = childCount;
+    reader->depth++;
+    return 0;
+}
+
+// Rebuild a tree from a sequential snapshot stream into the active arena. On
+// failure the partially built tree is left in the arena for the caller to drop.
+node* readSnapshot(snapshotSource* source, const char* filename) {
+    snapshotReader reader = {0};
+    snapshotHeader header;
+    if (source->read(source->context, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0) {
+        printf("Error: '%s' is not a binary snapshot.\n", filename);
+        return NULL;
+    }
+    if (header.version < 1 || header.version > SNAPSHOT_VERSION) {
+        printf("Error: Unsupported snapshot version %u in '%s'.\n", header.version, filename);
+        return NULL;
+    }
+    size_t recordSize = header.version == 1 ? SNAPSHOT_V1_RECORD_SIZE : sizeof(snapshotRecord);
+
+    // Sizes are checked against the stream before anything is allocated for them
+    uint64_t available = source->limit - sizeof(header);
+    if (source->limit < sizeof(header) || header.stringBytes > available ||
+        header.nodeCount > (available - header.stringBytes) / recordSize) {
+        printf("Error: '%s' has a corrupt header.\n", filename);
+        return NULL;
+    }
+
+    reader.table = malloc(header.stringBytes ? header.stringBytes : 1);
+    reader.batch = malloc(SNAPSHOT_BATCH * sizeof(snapshotRecord));
+    if (!reader.table || !reader.batch ||
+        source->read(source->context, reader.table, header.stringBytes) != header.stringBytes) {
+        printf("Error: Could not read the string table of '%s'.\n", filename);
+        closeSnapshotReader(&reader);
+        return NULL;
+    }
+
+    node* root = NULL;
+    uint64_t loaded = 0;
+    while (loaded < header.nodeCount) {
+        uint64_t left = header.nodeCount - loaded;
+        size_t wanted = left < SNAPSHOT_BATCH ? (size_t)left : SNAPSHOT_BATCH;
+        if (source->read(source->context, reader.batch, wanted * recordSize) != wanted * recordSize) {
+            printf("Error: '%s' is truncated.\n", filename);
+            closeSnapshotReader(&reader);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < wanted; i++, loaded++) {
+            // Totals stored in the record are not trusted here; they are recomputed bottom-up
+            snapshotRecord decoded = {0};
+            snapshotRecord* record = &decoded;
+            memcpy(record, reader.batch + i * recordSize, recordSize);
+            closeSnapshotFolders(&reader);
+
+            // Only the first record may sit outside a folder, and only folders have children
+            if ((loaded == 0) != (reader.depth == 0) || record->type > Symlink ||
+                (record->type != Folder && record->childCount != 0)) {
+                printf("Error: '%s' has a corrupt node table.\n", filename);
+                closeSnapshotReader(&reader);
+                return NULL;
+            }
+
+            node* newNode = nodeFromRecord(record, reader.table, header.stringBytes);
+            if (!newNode) {
+                printf("Error: '%s' has a corrupt string reference.\n", filename);
+                closeSnapshotReader(&reader);
+                return NULL;
+            }
+
+            if (!root) root = newNode;
+            if (placeSnapshotNode(&reader, newNode, record->childCount) != 0) {
+                printf("Error: Memory allocation failed.\n");
+                closeSnapshotReader(&reader);
+                return NULL;
+            }
+        }
+    }
+
+    closeSnapshotFolders(&reader);
+    closeSnapshotReader(&reader);
+    if (!root || reader.depth != 0) {
+        printf("Error: '%s' has a corrupt node table.\n", filename);
+        return NULL;
+    }
+    printf("Directory structure loaded from '%s' (%llu nodes).\n", filename, (unsigned long long)loaded);
+    return root;
+}
+
+node* loadSnapshot(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("Error: Could not open file '%s' for loading.\n", filename);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    struct stat info;
+    snapshotSource source = {fileSourceRead, file, fstat(fileno(file), &info) == 0 ? (uint64_t)info.st_size : 0};
+    uint64_t started = metricsStart(MetricLoadBinary);
+    node* root = readSnapshot(&source, filename);
+    metricsRecord(MetricLoadBinary, started);
+    fclose(file);
+    return root;
+}
+
+// A snapshot mapped read-only into memory for lazy loading (load -m).
+// Folders keep the index of their record until something asks for their
+// children, so untouched subtrees cost nothing but address space.
+typedef struct snapshotMapping {
+    const char* base;
+    size_t length;
+    snapshotHeader header;
+    const char* table;       // String table inside the mapping
+    const char* records;     // Node table inside the mapping (not necessarily aligned)
+} snapshotMapping;
+
+void unmapSnapshot(snapshotMapping* mapping) {
+    if (!mapping) return;
+    munmap((void*)mapping->base, mapping->length);
+    free(mapping);
+}
+
+void readMappedRecord(const snapshotMapping* mapping, uint64_t position, snapshotRecord* record) {
+    memcpy(record, mapping->records + position * sizeof(snapshotRecord), sizeof(snapshotRecord));
+}
+
+// Build the direct children of a folder that still points into the mapped snapshot
+void materializeFolder(node* folder) {
+    snapshotMapping* mapping = activeArena->mapping;
+    uint64_t position = folder->dir->lazyRecord - 1;
+    folder->dir->lazyRecord = 0;
+    folder->dir->numberOfItems = 0; // Held the record's child count until now
+    if (!mapping || position >= mapping->header.nodeCount) return;
+
+    snapshotRecord record;
+    readMappedRecord(mapping, position, &record);
+    uint32_t childCount = record.childCount;
+    uint64_t next = position + 1;
+    for (uint32_t i = 0; i < childCount; i++) {
+        if (next >= mapping->header.nodeCount) {
+            printf("Error: Snapshot record %llu is out of range.\n", (unsigned long long)next);
+            return;
+        }
+        readMappedRecord(mapping, next, &record);
+        int valid = record.type <= Symlink && (record.type == Folder || record.childCount == 0);
+        node* child = valid ? nodeFromRecord(&record, mapping->table, mapping->header.stringBytes) : NULL;
+        if (!child) {
+            printf("Error: Snapshot record %llu is corrupt.\n", (unsigned long long)next);
+            return;
+        }
+        if (record.childCount > 0) {
+            child->dir->lazyRecord = next + 1;
+            child->dir->numberOfItems = (int)record.childCount;
+            child->dir->stats = record.stats; // Known without building the subtree
+        }
+        attachChild(folder, child); // The folder's totals already cover its children
+
+        if (record.descendants >= mapping->header.nodeCount - next) {
+            next = mapping->header.nodeCount; // Corrupt span, the next lookup reports it
+        } else {
+            next += 1 + record.descendants;
+        }
+    }
+}
+
+void materialize(node* folder) {
+    if (folder && folder->type == Folder && folder->dir->lazyRecord) {
+        materializing++;
+        materializeFolder(folder);
+        materializing--;
+    }
+}
+
+// Build every lazy folder below this one
+void materializeTree(node* folder) {
+    materialize(folder);
+    for (node* child = nodeChild(folder); child; child = nodeNext(child)) {
+        if (child->type == Folder && child->dir->lazyRecord) materializeTree(child);
+    }
+}
+
+// Map a binary snapshot and return its root with the children left unbuilt.
+// The mapping is handed to the active arena, which unmaps it when the tree is dropped.
+node* loadSnapshotLazy(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file '%s' for loading.\n", filename);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(snapshotHeader)) {
+        printf("Error: '%s' is not a binary snapshot.\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (base == MAP_FAILED) {
+        perror("Error mapping snapshot");
+        return NULL;
+    }
+
+    snapshotMapping* mapping = malloc(sizeof(snapshotMapping));
+    if (!mapping) {
+        munmap(base, (size_t)info.st_size);
+        printf("Error: Memory allocation failed.\n");
+        return NULL;
+    }
+    mapping->base = base;
+    mapping->length = (size_t)info.st_size;
+    memcpy(&mapping->header, base, sizeof(snapshotHeader));
+    mapping->table = mapping->base + sizeof(snapshotHeader);
+
+    snapshotHeader* header = &mapping->header;
+    uint64_t available = mapping->length - sizeof(snapshotHeader);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) == 0 && header->version == 1) {
+        printf("Error: '%s' is a version 1 snapshot without subtree totals; load it with load -b and save it again.\n", filename);
+        unmapSnapshot(mapping);
+        return NULL;
+    }
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 || header->version != SNAPSHOT_VERSION ||
+        header->nodeCount == 0 || header->stringBytes > available ||
+        header->nodeCount > (available - header->stringBytes) / sizeof(snapshotRecord)) {
+        printf("Error: '%s' is not a valid binary snapshot.\n", filename);
+        unmapSnapshot(mapping);
+        return NULL;
+    }
+    mapping->records = mapping->table + header->stringBytes;
+
+    snapshotRecord record;
+    readMappedRecord(mapping, 0, &record);
+    node* root = record.type == Folder ? nodeFromRecord(&record, mapping->table, header->stringBytes) : NULL;
+    if (!root) {
+        printf("Error: '%s' has a corrupt root record.\n", filename);
+        unmapSnapshot(mapping);
+        return NULL;
+    }
+    if (record.childCount > 0 && root->type == Folder) {
+        root->dir->lazyRecord = 1;
+        root->dir->numberOfItems = (int)record.childCount;
+        root->dir->stats = record.stats;
+    }
+
+    activeArena->mapping = mapping;
+    printf("Directory structure mapped from '%s' (%llu nodes, loaded on demand).\n",
+           filename, (unsigned long long)header->nodeCount);
+    return root;
+}
+
+// Segmented snapshots (save -s / load -s). Each folder's children are
+// encoded as one segment; a folder record points at the segment of its own
+// children and a file record at a content blob, both by file offset, and
+// children are always written before the folder that points at them.
+// Every mutation marks the changed folder and its ancestors dirty (a zero
+// segment offset), so saving again into the same file only appends the
+// segments of dirty folders, plus the contents not stored there yet, and
+// then rewrites the header. Clean subtrees are referenced where they are.
+// Once the file has grown to twice its size after the last full rewrite,
+// the next save rewrites it from scratch into a new file that replaces it.
+#define SEGMENT_MAGIC "SFSS"
+#define SEGMENT_VERSION 1
+#define SEGMENT_BUFFER_SIZE (1 << 20)
+#define SEGMENT_COMPACT_MIN (1 << 20) // Smaller files are never compacted
+
+typedef struct segmentHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t generation;     // Saves into this file
+    uint64_t root;           // Segment holding the root's own record
+    uint64_t end;            // Bytes in use; anything after is an interrupted save
+    uint64_t compactedEnd;   // end after the last full rewrite
+    uint64_t nodeCount;
+} segmentHeader;
+
+typedef struct segmentHead {
+    uint32_t count;          // Records that follow
+    uint32_t reserved;
+    uint64_t bytes;          // Whole segment, this head included
+} segmentHead;
+
+// Followed by the name and the symlink target
+typedef struct segmentRecord {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t nameLength;
+    uint32_t targetLength;
+    uint32_t reserved2;
+    int64_t date;
+    uint64_t size;
+    uint64_t offset;         // Folders: their children's segment, Files: their content blob (0 = none)
+} segmentRecord;
+
+_Static_assert(sizeof(segmentHeader) == 48, "segmentHeader must not be padded");
+_Static_assert(sizeof(segmentRecord) == 40, "segmentRecord must not be padded");
+
+typedef struct segmentWriter {
+    int fd;
+    uint64_t base;           // File offset of buffer[0]
+    char* buffer;
+    size_t length;
+    int full;                // Re-encode every folder, ignoring their offsets
+    int failed;
+    uint64_t epoch;
+    uint64_t folders;        // Segments encoded by this save
+    uint64_t contents;       // Content blobs written by this save
+} segmentWriter;
+
+void segmentFlush(segmentWriter* writer) {
+    size_t written = 0;
+    while (written < writer->length && !writer->failed) {
+        ssize_t result = pwrite(writer->fd, writer->buffer + written, writer->length - written,
+                                (off_t)(writer->base + written));
+        if (result < 0 && errno != EINTR) writer->failed = 1;
+        if (result > 0) written += (size_t)result;
+    }
+    writer->base += writer->length;
+    writer->length = 0;
+}
+
+void segmentPut(segmentWriter* writer, const void* data, size_t length) {
+    if (writer->length + length > SEGMENT_BUFFER_SIZE) segmentFlush(writer);
+    if (length > SEGMENT_BUFFER_SIZE) {
+        // Larger than the whole buffer: straight to the file
+        size_t written = 0;
+        while (written < length && !writer->failed) {
+            ssize_t result = pwrite(writer->fd, (const char*)data + written, length - written,
+                                    (off_t)(writer->base + written));
+            if (result < 0 && errno != EINTR) writer->failed = 1;
+            if (result > 0) written += (size_t)result;
+        }
+        writer->base += length;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+// Offset of the next byte written
+uint64_t segmentPosition(const segmentWriter* writer) {
+    return writer->base + writer->length;
+}
+
+// Store a content unless this file already holds it; returns its offset
+uint64_t segmentWriteContent(segmentWriter* writer, fileContent* content) {
+    if (content->segment && content->segmentEpoch == writer->epoch) return content->segment;
+    uint64_t offset = segmentPosition(writer);
+    uint64_t length = content->length;
+    segmentPut(writer, &length, sizeof(length));
+    for (size_t i = 0; i < content->count; i++) {
+        segmentPut(writer, content->chunks[i]->data, content->chunks[i]->length);
+    }
+    content->segment = offset;
+    content->segmentEpoch = writer->epoch;
+    writer->contents++;
+    return offset;
+}
+
+void segmentPutRecord(segmentWriter* writer, node* item) {
+    segmentRecord record = {0};
+    record.type = (uint8_t)item->type;
+    record.nameLength = (uint32_t)strlen(nodeName(item));
+    const char* target = nodeTarget(item);
+    record.targetLength = target ? (uint32_t)strlen(target) : 0;
+    record.date = (int64_t)item->date;
+    record.size = item->size;
+    if (item->type == Folder) record.offset = item->dir->segment;
+    else if (item->type == File && item->content) record.offset = item->content->segment;
+    segmentPut(writer, &record, sizeof(record));
+    segmentPut(writer, nodeName(item), record.nameLength);
+    if (record.targetLength) segmentPut(writer, target, record.targetLength);
+}
+
+size_t segmentRecordBytes(node* item) {
+    const char* target = nodeTarget(item);
+    return sizeof(segmentRecord) + strlen(nodeName(item)) + (target ? strlen(target) : 0);
+}
+
+// Write the segment of folder's children after everything it points at; a clean folder is only referenced
+uint64_t segmentWriteFolder(segmentWriter* writer, node* folder) {
+    if (folder->dir->segment && !writer->full) return folder->dir->segment;
+    materialize(folder);
+
+    uint64_t bytes = sizeof(segmentHead);
+    for (node* child = nodeChild(folder); child; child = nodeNext(child)) {
+        if (child->type == Folder) segmentWriteFolder(writer, child);
+        else if (child->type == File && child->content) segmentWriteContent(writer, child->content);
+        bytes += segmentRecordBytes(child);
+    }
+
+    uint64_t offset = segmentPosition(writer);
+    segmentHead head = {(uint32_t)folder->dir->numberOfItems, 0, bytes};
+    segmentPut(writer, &head, sizeof(head));
+    for (node* child = nodeChild(folder); child; child = nodeNext(child)) segmentPutRecord(writer, child);
+    folder->dir->segment = offset;
+    writer->folders++;
+    return offset;
+}
+
+// Save the tree into filename. Saving again into the file the tree was last
+// saved to or loaded from only appends what changed since
+void saveSegmented(node* root, const char* filename) {
+    segmentFile* saved = &activeArena->segments;
+    segmentHeader header = {0};
+    char temporary[MAX_PATH_LENGTH + 8];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+
+    // Append only if the file is exactly as this tree left it
+    int fd = -1;
+    int incremental = 0;
+    if (saved->path && strcmp(saved->path, filename) == 0) {
+        fd = open(filename, O_RDWR);
+        struct stat info;
+        incremental = fd >= 0 && fstat(fd, &info) == 0 && info.st_dev == saved->device &&
+                      info.st_ino == saved->inode && (uint64_t)info.st_size == saved->end &&
+                      pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                      memcmp(header.magic, SEGMENT_MAGIC, 4) == 0 && header.generation == saved->generation &&
+                      !(header.end > SEGMENT_COMPACT_MIN && header.end > 2 * header.compactedEnd);
+        if (!incremental && fd >= 0) close(fd);
+    }
+    if (!incremental) {
+        fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Error: Could not open file '%s' for saving.\n", temporary);
+            return;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SEGMENT_MAGIC, 4);
+        header.version = SEGMENT_VERSION;
+        saved->epoch++; // Content offsets into any other file are void from here on
+    }
+
+    segmentWriter writer = {.fd = fd, .base = incremental ? header.end : sizeof(header),
+                            .full = !incremental, .epoch = saved->epoch};
+    writer.buffer = malloc(SEGMENT_BUFFER_SIZE);
+    if (!writer.buffer) writer.failed = 1;
+
+    uint64_t start = writer.base;
+    uint64_t rootOffset = 0;
+    if (!writer.failed) {
+        uint64_t started = metricsStart(MetricSaveSegments);
+        segmentWriteFolder(&writer, root);
+        metricsRecord(MetricSaveSegments, started);
+        rootOffset = segmentPosition(&writer);
+        segmentHead head = {1, 0, sizeof(segmentHead) + segmentRecordBytes(root)};
+        segmentPut(&writer, &head, sizeof(head));
+        segmentPutRecord(&writer, root);
+        segmentFlush(&writer);
+    }
+
+    // The header goes last and only once the segments it points at are on disk
+    header.generation++;
+    header.root = rootOffset;
+    header.end = writer.base;
+    if (!incremental) header.compactedEnd = header.end;
+    header.nodeCount = nodeStats(root).files + nodeStats(root).folders + nodeStats(root).symlinks;
+    int failed = writer.failed || fdatasync(fd) != 0 ||
+                 pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(fd) != 0 ||
+                 (!incremental && rename(temporary, filename) != 0);
+    struct stat info;
+    if (!failed && fstat(fd, &info) != 0) failed = 1;
+    close(fd);
+    free(writer.buffer);
+
+    free(saved->path);
+    saved->path = NULL;
+    if (failed) {
+        // Offsets handed out by this save may point at nothing: the next save starts over
+        if (!incremental) unlink(temporary);
+        printf("Error: Could not write segmented snapshot '%s'.\n", filename);
+        return;
+    }
+    saved->path = strdup(filename);
+    saved->device = info.st_dev;
+    saved->inode = info.st_ino;
+    saved->end = header.end;
+    saved->generation = header.generation;
+
+    printf("Directory structure saved to '%s' (%s: %llu folders and %llu contents encoded, %llu bytes written).\n",
+           filename, incremental ? "incremental" : "full", (unsigned long long)writer.folders,
+           (unsigned long long)writer.contents, (unsigned long long)(header.end - start));
+}
+
+typedef struct segmentReader {
+    const char* base;        // The mapped file
+    uint64_t epoch;
+    uint64_t nodes;
+    char* name;              // NUL-terminated copy of the record's name or target
+    size_t nameCapacity;
+    int failed;
+} segmentReader;
+
+// Copy length bytes at data into the reader's name buffer; NULL if they hold a NUL
+const char* segmentName(segmentReader* reader, const char* data, size_t length) {
+    if (memchr(data, '\0', length)) return NULL;
+    if (length + 1 > reader->nameCapacity) {
+        size_t capacity = reader->nameCapacity ? reader->nameCapacity : 256;
+        while (capacity < length + 1) capacity *= 2;
+        char* name = realloc(reader->name, capacity);
+        if (!name) return NULL;
+        reader->name = name;
+        reader->nameCapacity = capacity;
+    }
+    memcpy(reader->name, data, length);
+    reader->name[length] = '\0';
+    return reader->name;
+}
+
+// Build the children of folder from the segment at offset. Everything a
+// segment points at was written before it, so offsets must decrease, which
+// also keeps a corrupt file from looping
+void segmentReadFolder(segmentReader* reader, node* folder, uint64_t offset, uint64_t limit) {
+    segmentHead head;
+    if (offset < sizeof(segmentHeader) || offset >= limit || limit - offset < sizeof(head)) {
+        reader->failed = 1;
+        return;
+    }
+    memcpy(&head, reader->base + offset, sizeof(head));
+    // Every record takes room in the segment, which bounds the count before the index is sized for it
+    if (head.bytes < sizeof(head) || head.bytes > limit - offset ||
+        head.count > (head.bytes - sizeof(head)) / sizeof(segmentRecord)) {
+        reader->failed = 1;
+        return;
+    }
+    if (head.count > folder->dir->indexCapacity) {
+        size_t capacity = 8;
+        while (capacity < head.count) capacity *= 2;
+        resizeIndex(folder, capacity);
+    }
+
+    uint64_t position = offset + sizeof(head);
+    uint64_t end = offset + head.bytes;
+    for (uint32_t i = 0; i < head.count && !reader->failed; i++) {
+        segmentRecord record;
+        if (end - position < sizeof(record)) break;
+        memcpy(&record, reader->base + position, sizeof(record));
+        position += sizeof(record);
+        // Only folders and files point elsewhere in the file
+        if (record.type > Symlink || record.nameLength == 0 || (record.type == Symlink && record.offset != 0) ||
+            (uint64_t)record.nameLength + record.targetLength > end - position) {
+            break;
+        }
+
+        const char* name = segmentName(reader, reader->base + position, record.nameLength);
+        node* child = name && !getNodeTypeless(folder, (char*)name) ? createNode((enum nodeType)record.type, name) : NULL;
+        position += record.nameLength;
+        if (!child) break;
+        child->date = (time_t)record.date;
+        child->size = record.type == File ? record.size : 0;
+        if (record.targetLength) {
+            name = segmentName(reader, reader->base + position, record.targetLength);
+            if (record.type == Symlink) child->symlinkTarget = name ? arenaStrdup(activeArena, name) : NULL;
+            position += record.targetLength;
+        }
+
+        if (record.type == File && record.offset) {
+            uint64_t length = 0;
+            if (record.offset < sizeof(segmentHeader) || record.offset >= offset ||
+                offset - record.offset < sizeof(length)) {
+                break;
+            }
+            memcpy(&length, reader->base + record.offset, sizeof(length));
+            if (length > offset - record.offset - sizeof(length)) break;
+            if (length > 0) {
+                child->content = contentIntern(reader->base + record.offset + sizeof(length), length);
+                if (child->content && child->content->segmentEpoch != reader->epoch) {
+                    child->content->segment = record.offset; // Saving again need not store it anew
+                    child->content->segmentEpoch = reader->epoch;
+                }
+            }
+        } else if (record.type == Folder) {
+            segmentReadFolder(reader, child, record.offset, offset);
+            child->dir->segment = record.offset; // Clean once its children are in place
+        }
+        attachChild(folder, child);
+        subtreeStats stats = nodeStats(child);
+        addStats(&folder->dir->stats, &stats);
+        reader->nodes++;
+    }
+    if (folder->dir->numberOfItems != (int)head.count) reader->failed = 1;
+}
+
+node* loadSegmented(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file '%s' for loading.\n", filename);
+        return NULL;
+    }
+    struct stat info;
+    segmentHeader header;
+    if (fstat(fd, &info) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, SEGMENT_MAGIC, 4) != 0 || header.version != SEGMENT_VERSION ||
+        header.end > (uint64_t)info.st_size || header.root >= header.end) {
+        printf("Error: '%s' is not a segmented snapshot.\n", filename);
+        close(fd);
+        return NULL;
+    }
+    void* base = mmap(NULL, (size_t)header.end, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Error: Could not map '%s'.\n", filename);
+        return NULL;
+    }
+
+    // The top segment holds the root's own record
+    activeArena->segments.epoch = 1;
+    segmentReader reader = {.base = base, .epoch = 1};
+    segmentHead head = {0};
+    segmentRecord record = {0};
+    node* root = NULL;
+    if (header.root >= sizeof(header) && header.end - header.root >= sizeof(head) + sizeof(record)) {
+        memcpy(&head, reader.base + header.root, sizeof(head));
+        memcpy(&record, reader.base + header.root + sizeof(head), sizeof(record));
+    }
+    if (head.count == 1) {
+        const char* name = record.type == Folder && record.nameLength <= header.end - header.root - sizeof(head) - sizeof(record)
+                         ? segmentName(&reader, reader.base + header.root + sizeof(head) + sizeof(record), record.nameLength)
+                         : NULL;
+        root = name ? createNode(Folder, name) : NULL;
+    }
+    if (root) {
+        root->date = (time_t)record.date;
+        if (record.offset) {
+            uint64_t started = metricsStart(MetricLoadSegments);
+            segmentReadFolder(&reader, root, record.offset, header.root);
+            metricsRecord(MetricLoadSegments, started);
+        }
+        root->dir->segment = record.offset;
+    }
+    munmap(base, (size_t)header.end);
+    free(reader.name);
+    if (!root || reader.failed) {
+        printf("Error: '%s' has a corrupt segment.\n", filename);
+        return NULL;
+    }
+
+    segmentFile* saved = &activeArena->segments;
+    saved->path = strdup(filename);
+    saved->device = info.st_dev;
+    saved->inode = info.st_ino;
+    saved->end = (uint64_t)info.st_size;
+    saved->generation = header.generation;
+    printf("Directory structure loaded from '%s' (%llu nodes).\n", filename, (unsigned long long)reader.nodes + 1);
+    return root;
+}
+
+// Week 3: Rename Node
+void renameNode(node* currentNode, const char* newName) {
+    if (!currentNode) {
+        printf("Error: Node does not exist.\n");
+        return;
+    }
+
+    // Check for conflicting names in the same directory
+    node* folder = nodeParent(currentNode);
+    node* sibling = folder ? getNodeTypeless(folder, (char*)newName) : NULL;
+    if (sibling && sibling != currentNode) {
+        printf("Error: A node with the name '%s' already exists in the current directory.\n", newName);
+        return;
+    }
+
+    journalRename(currentNode, newName);
+    renameChild(currentNode, newName);
+    printf("Renamed to '%s'\n", nodeName(currentNode));
+}
+
+// Free the old name and assign the new name, rehashing it in the parent's index
+void renameChild(node* currentNode, const char* newName) {
+    node* folder = nodeParent(currentNode);
+    preserveNode(currentNode);
+    preserveNode(folder); // Snapshots look children up by the names they had then
+    markDirty(folder);
+    if (folder) {
+        indexRemove(folder, currentNode);
+        orderRemove(folder, OrderByName, currentNode);
+        orderRemove(folder, OrderByDate, currentNode); // Dates tie-break on the name
+    }
+    pathCacheNodeLeaving(currentNode);
+    nodeSetName(currentNode, newName);
+    if (folder) {
+        indexInsert(folder, currentNode);
+        orderInsert(folder, OrderByName, currentNode);
+        orderInsert(folder, OrderByDate, currentNode);
+    }
+    pathCacheNodeArrived(currentNode);
+}
+
+
+// Week 3: Display Full Path
+void displayFullPath(node* currentNode) {
+    if (!currentNode) return;
+
+    if (nodeParent(currentNode)) {
+        displayFullPath(nodeParent(currentNode));
+    }
+    printf("/%s", nodeName(currentNode));
+}
+
+node* createNode(enum nodeType type, const char* name) {
+    folderData* dir = NULL;
+    if (type == Folder) {
+        dir = arenaAlloc(activeArena, sizeof(folderData));
+        if (!dir) return NULL;
+        memset(dir, 0, sizeof(folderData));
+        dir->stats.folders = 1;
+    }
+    node* newNode = arenaNewNode(activeArena);
+    if (!newNode) {
+        arenaRelease(activeArena, dir, sizeof(folderData));
+        return NULL;
+    }
+
+    newNode->type = type;
+    newNode->longName = 0;
+    newNode->hasHistory = 0;
+    newNode->nameStorage.inlined[0] = '\0';
+    newNode->parentRef = 0;
+    newNode->previousRef = 0;
+    newNode->nextRef = 0;
+    newNode->hashNextRef = 0;
+    newNode->size = 0;
+    newNode->date = time(NULL);
+    newNode->content = NULL;
+    if (type == Folder) newNode->dir = dir;
+    nodeUsageAdd(newNode, 1, (long long)(sizeof(node) + (dir ? sizeof(folderData) : 0)));
+    if (nodeSetName(newNode, name) != 0) {
+        releaseNode(newNode);
+        return NULL;
+    }
+    nodeHistoryCreate(newNode);
+    return newNode;
+}
+
+// FNV-1a hash of a node name, used by the per-folder name index
+size_t hashName(const char* name) {
+    size_t hash = 14695981039346656037ULL;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Grow the folder's bucket array and rehash its children into it
+void resizeIndex(node* folder, size_t capacity) {
+    folderData* dir = folder->dir;
+    nodeRef* buckets = arenaAlloc(activeArena, capacity * sizeof(nodeRef));
+    if (!buckets) return; // Keep the old (slower but valid) index
+    memset(buckets, 0, capacity * sizeof(nodeRef));
+
+    for (size_t i = 0; i < dir->indexCapacity; i++) {
+        node* entry = nodeAt(dir->index[i]);
+        while (entry) {
+            node* nextEntry = nodeAt(entry->hashNextRef);
+            size_t bucket = hashName(nodeName(entry)) & (capacity - 1);
+            entry->hashNextRef = buckets[bucket];
+            buckets[bucket] = entry->self;
+            entry = nextEntry;
+        }
+    }
+    arenaRelease(activeArena, dir->index, dir->indexCapacity * sizeof(nodeRef));
+    dir->index = buckets;
+    dir->indexCapacity = (uint32_t)capacity;
+}
+
+void indexInsert(node* folder, node* child) {
+    folderData* dir = folder->dir;
+    if (dir->indexCount + 1 > dir->indexCapacity) {
+        resizeIndex(folder, dir->indexCapacity ? (size_t)dir->indexCapacity * 2 : 8);
+    }
+    if (!dir->index) return;
+    size_t bucket = hashName(nodeName(child)) & (dir->indexCapacity - 1);
+    child->hashNextRef = dir->index[bucket];
+    dir->index[bucket] = child->self;
+    dir->indexCount++;
+}
+
+void indexRemove(node* folder, node* child) {
+    folderData* dir = folder->dir;
+    if (!dir->index) return;
+
+    nodeRef* link = &dir->index[hashName(nodeName(child)) & (dir->indexCapacity - 1)];
+    while (*link) {
+        if (*link == child->self) {
+            *link = child->hashNextRef;
+            child->hashNextRef = 0;
+            dir->indexCount--;
+            return;
+        }
+        link = &nodeAt(*link)->hashNextRef;
+    }
+}
+
+// Look up a child by name; when anyType is zero the child must also match type
+node* indexLookup(node* folder, const char* name, int anyType, enum nodeType type) {
+    materialize(folder);
+    if (!folder || folder->type != Folder || !folder->dir->index) return NULL;
+
+    node* entry = nodeAt(folder->dir->index[hashName(name) & (folder->dir->indexCapacity - 1)]);
+    while (entry) {
+        if ((anyType || entry->type == type) && strcmp(nodeName(entry), name) == 0) {
+            return entry;
+        }
+        entry = nodeAt(entry->hashNextRef);
+    }
+    return NULL;
+}
+
+// Ordered indexes over a folder's children, one by name and one by date
+// (ties broken by name), kept up to date by every link, unlink, rename and
+// date change, so sorted listings and range queries never sort. Each index
+// is a B+ tree of node pointers: leaf pages hold the children in key order
+// and are chained left to right, inner pages hold the first child below
+// each of their pages. A folder's single leaf starts small and grows through
+// the arena size classes before it first splits, so small folders stay cheap.
+#define ORDER_PAGE_KEYS 60   // Full leaf: 512 bytes, inner page: 992 bytes
+
+typedef struct orderPage {
+    struct orderPage* parent;
+    struct orderPage* next;      // Leaves only: neighbours in key order
+    struct orderPage* previous;
+    uint16_t count;
+    uint16_t capacity;           // Keys the page has room for
+    uint16_t leaf;
+    node* keys[];                // Inner pages: followed by ORDER_PAGE_KEYS page pointers
+} orderPage;
+
+// Position inside an ordered index, for iterating from a key onwards
+typedef struct orderCursor {
+    orderPage* page;
+    int position;
+} orderCursor;
+
+size_t orderPageBytes(int leaf, int capacity) {
+    return sizeof(orderPage) + (size_t)capacity * sizeof(node*) * (leaf ? 1 : 2);
+}
+
+orderPage** orderChildren(orderPage* page) {
+    return (orderPage**)(page->keys + ORDER_PAGE_KEYS);
+}
+
+orderPage* orderNewPage(int leaf, int capacity) {
+    orderPage* page = arenaAlloc(activeArena, orderPageBytes(leaf, capacity));
+    if (!page) return NULL;
+    memset(page, 0, sizeof(orderPage));
+    page->leaf = (uint16_t)leaf;
+    page->capacity = (uint16_t)capacity;
+    return page;
+}
+
+void orderFree(orderPage* page) {
+    if (!page) return;
+    if (!page->leaf) {
+        for (int i = 0; i < page->count; i++) orderFree(orderChildren(page)[i]);
+    }
+    arenaRelease(activeArena, page, orderPageBytes(page->leaf, page->capacity));
+}
+
+// Compare a child with the key (name, date); dates are compared as time_t, never narrowed
+int orderCompare(enum orderKind kind, const node* item, const char* name, time_t date) {
+    if (kind == OrderByDate && item->date != date) return item->date < date ? -1 : 1;
+    return strcmp(nodeName(item), name);
+}
+
+// Position of the first key that is not below (name, date)
+int orderLowerBound(orderPage* page, enum orderKind kind, const char* name, time_t date) {
+    int low = 0, high = page->count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (orderCompare(kind, page->keys[middle], name, date) < 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Leaf whose range holds (name, date)
+orderPage* orderFindLeaf(orderPage* page, enum orderKind kind, const char* name, time_t date) {
+    while (page && !page->leaf) {
+        int position = orderLowerBound(page, kind, name, date);
+        if (position == page->count || orderCompare(kind, page->keys[position], name, date) > 0) position--;
+        page = orderChildren(page)[position < 0 ? 0 : position];
+    }
+    return page;
+}
+
+int orderPosition(orderPage* parent, orderPage* page) {
+    int position = 0;
+    while (orderChildren(parent)[position] != page) position++;
+    return position;
+}
+
+// A page's first key changed: update the copies of it in the pages above
+void orderFixFirst(orderPage* page) {
+    while (page->parent && page->count > 0) {
+        int position = orderPosition(page->parent, page);
+        page->parent->keys[position] = page->keys[0];
+        if (position != 0) break;
+        page = page->parent;
+    }
+}
+
+// Move the upper half of a full page into a new right sibling and return it
+orderPage* orderSplit(node* folder, enum orderKind kind, orderPage* page) {
+    if (page->parent && page->parent->count == ORDER_PAGE_KEYS && !orderSplit(folder, kind, page->parent)) {
+        return NULL;
+    }
+    orderPage* sibling = orderNewPage(page->leaf, ORDER_PAGE_KEYS);
+    if (!sibling) return NULL;
+    orderPage* parent = page->parent;
+    if (!parent) {
+        parent = orderNewPage(0, ORDER_PAGE_KEYS);
+        if (!parent) {
+            orderFree(sibling);
+            return NULL;
+        }
+        parent->keys[0] = page->keys[0];
+        orderChildren(parent)[0] = page;
+        parent->count = 1;
+        page->parent = parent;
+        folder->dir->order[kind] = parent;
+    }
+
+    int half = page->count / 2;
+    sibling->count = (uint16_t)(page->count - half);
+    memcpy(sibling->keys, page->keys + half, sibling->count * sizeof(node*));
+    if (!page->leaf) {
+        memcpy(orderChildren(sibling), orderChildren(page) + half, sibling->count * sizeof(orderPage*));
+        for (int i = 0; i < sibling->count; i++) orderChildren(sibling)[i]->parent = sibling;
+    } else {
+        sibling->next = page->next;
+        if (page->next) page->next->previous = sibling;
+        page->next = sibling;
+        sibling->previous = page;
+    }
+    page->count = (uint16_t)half;
+
+    int position = orderPosition(parent, page) + 1;
+    memmove(parent->keys + position + 1, parent->keys + position, (parent->count - position) * sizeof(node*));
+    memmove(orderChildren(parent) + position + 1, orderChildren(parent) + position,
+            (parent->count - position) * sizeof(orderPage*));
+    parent->keys[position] = sibling->keys[0];
+    orderChildren(parent)[position] = sibling;
+    parent->count++;
+    sibling->parent = parent;
+    return sibling;
+}
+
+void orderInsert(node* folder, enum orderKind kind, node* item) {
+    if (!folder->dir->order[kind]) {
+        folder->dir->order[kind] = orderNewPage(1, 4);
+        if (!folder->dir->order[kind]) return;
+    }
+
+    orderPage* leaf = orderFindLeaf(folder->dir->order[kind], kind, nodeName(item), item->date);
+    if (leaf->count == leaf->capacity) {
+        if (leaf->capacity < ORDER_PAGE_KEYS) {
+            // Only a lone root leaf is ever smaller than a full page: move it up a size class
+            int capacity = leaf->capacity * 2 + 4;
+            orderPage* grown = orderNewPage(1, capacity);
+            if (!grown) return;
+            grown->count = leaf->count;
+            memcpy(grown->keys, leaf->keys, leaf->count * sizeof(node*));
+            arenaRelease(activeArena, leaf, orderPageBytes(1, leaf->capacity));
+            folder->dir->order[kind] = leaf = grown;
+        } else {
+            orderPage* sibling = orderSplit(folder, kind, leaf);
+            if (!sibling) return;
+            if (orderCompare(kind, sibling->keys[0], nodeName(item), item->date) < 0) leaf = sibling;
+        }
+    }
+
+    int position = orderLowerBound(leaf, kind, nodeName(item), item->date);
+    memmove(leaf->keys + position + 1, leaf->keys + position, (leaf->count - position) * sizeof(node*));
+    leaf->keys[position] = item;
+    leaf->count++;
+    if (position == 0) orderFixFirst(leaf);
+}
+
+// Take an emptied page out of the tree, and its parent too if that empties
+void orderDropPage(node* folder, enum orderKind kind, orderPage* page) {
+    if (page->leaf) {
+        if (page->previous) page->previous->next = page->next;
+        if (page->next) page->next->previous = page->previous;
+    }
+    orderPage* parent = page->parent;
+    arenaRelease(activeArena, page, orderPageBytes(page->leaf, page->capacity));
+    if (!parent) {
+        folder->dir->order[kind] = NULL;
+        return;
+    }
+
+    int position = orderPosition(parent, page);
+    parent->count--;
+    memmove(parent->keys + position, parent->keys + position + 1, (parent->count - position) * sizeof(node*));
+    memmove(orderChildren(parent) + position, orderChildren(parent) + position + 1,
+            (parent->count - position) * sizeof(orderPage*));
+    if (parent->count == 0) orderDropPage(folder, kind, parent);
+    else if (position == 0) orderFixFirst(parent);
+}
+
+void orderRemove(node* folder, enum orderKind kind, node* item) {
+    orderPage* leaf = orderFindLeaf(folder->dir->order[kind], kind, nodeName(item), item->date);
+    if (!leaf) return;
+    int position = orderLowerBound(leaf, kind, nodeName(item), item->date);
+    if (position == leaf->count || leaf->keys[position] != item) return;
+
+    leaf->count--;
+    memmove(leaf->keys + position, leaf->keys + position + 1, (leaf->count - position) * sizeof(node*));
+    if (leaf->count == 0) orderDropPage(folder, kind, leaf);
+    else if (position == 0) orderFixFirst(leaf);
+
+    // A root left with a single page hands the root over to it
+    orderPage* root = folder->dir->order[kind];
+    while (root && !root->leaf && root->count == 1) {
+        folder->dir->order[kind] = orderChildren(root)[0];
+        folder->dir->order[kind]->parent = NULL;
+        arenaRelease(activeArena, root, orderPageBytes(0, root->capacity));
+        root = folder->dir->order[kind];
+    }
+}
+
+// Position an iterator on the first child at or after (name, date); from the start when name is NULL
+orderCursor orderSeek(node* folder, enum orderKind kind, const char* name, time_t date) {
+    orderCursor cursor = {folder->dir->order[kind], 0};
+    if (!cursor.page) return cursor;
+    if (!name) {
+        while (!cursor.page->leaf) cursor.page = orderChildren(cursor.page)[0];
+        return cursor;
+    }
+    cursor.page = orderFindLeaf(cursor.page, kind, name, date);
+    cursor.position = orderLowerBound(cursor.page, kind, name, date);
+    return cursor;
+}
+
+// Child under the cursor, advancing it; NULL past the last child
+node* orderNext(orderCursor* cursor) {
+    while (cursor->page && cursor->position >= cursor->page->count) {
+        cursor->page = cursor->page->next;
+        cursor->position = 0;
+    }
+    return cursor->page ? cursor->page->keys[cursor->position++] : NULL;
+}
+
+// Move a linked node to a new date, keeping its folder's date index in order
+void setNodeDate(node* item, time_t date) {
+    node* folder = nodeParent(item);
+    preserveNode(item);
+    markDirty(folder);
+    if (folder) orderRemove(folder, OrderByDate, item);
+    item->date = date;
+    if (folder) orderInsert(folder, OrderByDate, item);
+}
+
+// Contribution of a single node to the totals of the subtrees containing it
+subtreeStats ownStats(node* item) {
+    subtreeStats stats = {0};
+    if (item->type == File) {
+        stats.files = 1;
+        stats.bytes = item->size;
+    } else if (item->type == Folder) {
+        stats.folders = 1;
+    } else {
+        stats.symlinks = 1;
+    }
+    return stats;
+}
+
+// Totals of the subtree below a node: kept for folders, a file or symlink is its own
+subtreeStats nodeStats(node* item) {
+    return item->type == Folder ? item->dir->stats : ownStats(item);
+}
+
+void addStats(subtreeStats* total, const subtreeStats* delta) {
+    total->files += delta->files;
+    total->folders += delta->folders;
+    total->symlinks += delta->symlinks;
+    total->bytes += delta->bytes;
+}
+
+// Add (sign = 1) or subtract (sign = -1) delta on the folder and all its ancestors
+void propagateStats(node* folder, const subtreeStats* delta, int sign) {
+    for (; folder; folder = nodeParent(folder)) {
+        subtreeStats* stats = &folder->dir->stats;
+        if (sign > 0) {
+            addStats(stats, delta);
+        } else {
+            stats->files -= delta->files;
+            stats->folders -= delta->folders;
+            stats->symlinks -= delta->symlinks;
+            stats->bytes -= delta->bytes;
+        }
+    }
+}
+
+// Change a file's size and move the difference up the parent chain
+void setNodeSize(node* item, size_t size) {
+    node* folder = nodeParent(item);
+    preserveNode(item);
+    markDirty(folder);
+    subtreeStats delta = {0};
+    if (item->type == File && size >= item->size) {
+        delta.bytes = size - item->size;
+        propagateStats(folder, &delta, 1);
+    } else if (item->type == File) {
+        delta.bytes = item->size - size;
+        propagateStats(folder, &delta, -1);
+    }
+    item->size = size;
+}
+
+// Mark the folder's segment as stale, and those of its ancestors, which refer to it.
+// A dirty folder's ancestors are always dirty too, so the walk stops at the first one
+void markDirty(node* folder) {
+    for (; folder && folder->dir->segment; folder = nodeParent(folder)) folder->dir->segment = 0;
+}
+
+// Append a detached node to the folder's child list and name index
+void linkChild(node* folder, node* child) {
+    attachChild(folder, child);
+    subtreeStats stats = nodeStats(child);
+    propagateStats(folder, &stats, 1);
+    pathCacheNodeArrived(child);
+}
+
+// linkChild without touching the ancestors' totals, for loaders that sum subtrees bottom-up
+void attachChild(node* folder, node* child) {
+    materialize(folder);
+    preserveNode(folder);
+    markDirty(folder);
+    folderData* dir = folder->dir;
+    child->parentRef = folder->self;
+    child->nextRef = 0;
+    child->previousRef = dir->lastChild;
+    if (dir->lastChild == 0) {
+        dir->child = child->self;
+    } else {
+        nodeAt(dir->lastChild)->nextRef = child->self;
+    }
+    dir->lastChild = child->self;
+    dir->numberOfItems++;
+    indexInsert(folder, child);
+    orderInsert(folder, OrderByName, child);
+    orderInsert(folder, OrderByDate, child);
+}
+
+// Detach a node from its parent's child list and name index
+void unlinkChild(node* child) {
+    node* folder = nodeParent(child);
+    if (folder) {
+        preserveNode(folder);
+        markDirty(folder);
+        pathCacheNodeLeaving(child);
+        subtreeStats stats = nodeStats(child);
+        propagateStats(folder, &stats, -1);
+        indexRemove(folder, child);
+        orderRemove(folder, OrderByName, child);
+        orderRemove(folder, OrderByDate, child);
+        folderData* dir = folder->dir;
+        if (dir->child == child->self) {
+            dir->child = child->nextRef;
+        }
+        if (dir->lastChild == child->self) {
+            dir->lastChild = child->previousRef;
+        }
+        dir->numberOfItems--;
+    }
+    if (child->previousRef) nodePrevious(child)->nextRef = child->nextRef;
+    if (child->nextRef) nodeNext(child)->previousRef = child->previousRef;
+    child->previousRef = 0;
+    child->nextRef = 0;
+    child->parentRef = 0;
+}
+
+node* getNode(node *currentFolder, char* name, enum nodeType type) {
+    uint64_t started = metricsStart(MetricGetNode);
+    node* found = indexLookup(currentFolder, name, 0, type);
+    metricsRecord(MetricGetNode, started);
+    return found;
+}
+
+node* getNodeTypeless(node *currentFolder, char* name) {
+    uint64_t started = metricsStart(MetricGetNodeTypeless);
+    node* found = indexLookup(currentFolder, name, 1, File);
+    metricsRecord(MetricGetNodeTypeless, started);
+    return found;
+}
+
+// Write-behind mirror: commands update the tree and queue the matching host
+// filesystem change; a background worker applies the queue in order. While
+// an operation is still queued it can be coalesced: a repeated edit replaces
+// the queued content, and removing something whose creation is still queued
+// drops both. The queue is bounded, so a burst of commands waits for the
+// worker instead of growing it without limit.
+//
+// Host directories are named by id rather than by path: every mirrored
+// folder gets an id, registered with the worker as (parent id, name), and
+// each operation is (directory id, name). The worker keeps an LRU of open
+// directory fds and does all I/O with the *at() calls relative to the
+// parent's fd, so its cost does not depend on depth and no path is built.
+#define MIRROR_QUEUE_LIMIT 8192
+#define MIRROR_BUCKETS 16384 // Power of two
+#define MIRROR_ROOT_ID 1     // The working directory; 0 means "no id yet"
+#define MIRROR_MAX_OPEN_DIRS 64
+
+typedef struct mirrorOp {
+    enum mirrorOpType type;
+    uint64_t directory;      // Id of the host directory the op works in
+    char* name;              // Entry inside that directory
+    char* content;           // MirrorWrite: the whole file, MirrorPatch: the bytes at offset
+    size_t offset;           // MirrorPatch only
+    size_t length;           // Bytes in content
+    uint64_t id;             // MirrorRegister/MirrorMkdir/MirrorRemoveDir: the folder's own id
+    size_t hash;             // Of (directory, name)
+    struct mirrorOp* previous;
+    struct mirrorOp* next;
+    struct mirrorOp* hashNext;  // Next queued op in the same bucket
+} mirrorOp;
+
+typedef struct mirrorQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t progress;     // An op finished or left the queue
+    mirrorOp* head;
+    mirrorOp* tail;
+    size_t queued;
+    int busy;                    // The worker is applying an op
+    int started;
+    int stopping;
+    pthread_t worker;
+    mirrorOp* buckets[MIRROR_BUCKETS];
+    uint64_t written;
+    uint64_t coalesced;
+    uint64_t errors;
+} mirrorQueue;
+
+mirrorQueue mirror = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .workAvailable = PTHREAD_COND_INITIALIZER,
+    .progress = PTHREAD_COND_INITIALIZER,
+};
+
+// Parent id of every id handed out, indexed by id; owned by the command thread
+uint64_t* mirrorParents;
+size_t mirrorIdCount = MIRROR_ROOT_ID + 1;
+size_t mirrorIdCapacity;
+
+// A host directory as the worker knows it; owned by the worker thread
+typedef struct mirrorDirectory {
+    uint64_t parent;
+    char* name;
+    int fd;                  // -1 while not open
+    uint64_t newer;          // LRU neighbours among the open directories (0 = none)
+    uint64_t older;
+} mirrorDirectory;
+
+mirrorDirectory* mirrorDirectories;
+size_t mirrorDirectoryCapacity;
+uint64_t mirrorNewest;
+uint64_t mirrorOldest;
+int mirrorOpenCount;
+
+uint64_t mirrorNewId(uint64_t parent) {
+    if (mirrorIdCount >= mirrorIdCapacity) {
+        size_t capacity = mirrorIdCapacity ? mirrorIdCapacity * 2 : 1024;
+        uint64_t* parents = realloc(mirrorParents, capacity * sizeof(uint64_t));
+        if (!parents) return 0;
+        mirrorParents = parents;
+        mirrorIdCapacity = capacity;
+    }
+    mirrorParents[mirrorIdCount] = parent;
+    return mirrorIdCount++;
+}
+
+// Is directory the folder with the given id, or somewhere below it?
+int mirrorIsBelow(uint64_t directory, uint64_t id) {
+    while (directory > MIRROR_ROOT_ID) {
+        if (directory == id) return 1;
+        directory = mirrorParents[directory];
+    }
+    return directory == id;
+}
+
+size_t mirrorHash(uint64_t directory, const char* name) {
+    return hashName(name) ^ (directory * 0x9E3779B97F4A7C15ULL);
+}
+
+void mirrorFreeOp(mirrorOp* op) {
+    free(op->name);
+    free(op->content);
+    free(op);
+}
+
+// Take a queued op out of the FIFO and the bucket index (lock held)
+void mirrorUnqueue(mirrorOp* op) {
+    if (op->previous) op->previous->next = op->next;
+    else mirror.head = op->next;
+    if (op->next) op->next->previous = op->previous;
+    else mirror.tail = op->previous;
+
+    mirrorOp** link = &mirror.buckets[op->hash & (MIRROR_BUCKETS - 1)];
+    while (*link != op) link = &(*link)->hashNext;
+    *link = op->hashNext;
+    mirror.queued--;
+}
+
+// Drop a queued op that no longer needs to reach the disk (lock held)
+void mirrorCancel(mirrorOp* op) {
+    mirrorUnqueue(op);
+    mirrorFreeOp(op);
+    mirror.coalesced++;
+}
+
+// Worker side: make sure the registry has a slot for id
+mirrorDirectory* mirrorDirectoryEntry(uint64_t id) {
+    if (id >= mirrorDirectoryCapacity) {
+        size_t capacity = mirrorDirectoryCapacity ? mirrorDirectoryCapacity : 1024;
+        while (capacity <= id) capacity *= 2;
+        mirrorDirectory* directories = realloc(mirrorDirectories, capacity * sizeof(mirrorDirectory));
+        if (!directories) return NULL;
+        for (size_t i = mirrorDirectoryCapacity; i < capacity; i++) {
+            directories[i] = (mirrorDirectory){0, NULL, -1, 0, 0};
+        }
+        mirrorDirectories = directories;
+        mirrorDirectoryCapacity = capacity;
+    }
+    return &mirrorDirectories[id];
+}
+
+void mirrorLruUnlink(uint64_t id) {
+    mirrorDirectory* directory = &mirrorDirectories[id];
+    if (directory->newer) mirrorDirectories[directory->newer].older = directory->older;
+    else mirrorNewest = directory->older;
+    if (directory->older) mirrorDirectories[directory->older].newer = directory->newer;
+    else mirrorOldest = directory->newer;
+    directory->newer = directory->older = 0;
+}
+
+void mirrorLruPushNewest(uint64_t id) {
+    mirrorDirectory* directory = &mirrorDirectories[id];
+    directory->older = mirrorNewest;
+    directory->newer = 0;
+    if (mirrorNewest) mirrorDirectories[mirrorNewest].newer = id;
+    else mirrorOldest = id;
+    mirrorNewest = id;
+}
+
+void mirrorCloseDirectory(uint64_t id) {
+    if (id >= mirrorDirectoryCapacity || mirrorDirectories[id].fd < 0) return;
+    mirrorLruUnlink(id);
+    close(mirrorDirectories[id].fd);
+    mirrorDirectories[id].fd = -1;
+    mirrorOpenCount--;
+}
+
+// Worker side: fd of a registered host directory, opened relative to its parent on demand
+int mirrorOpenDirectory(uint64_t id) {
+    if (id == MIRROR_ROOT_ID) return AT_FDCWD;
+    if (id >= mirrorDirectoryCapacity || !mirrorDirectories[id].name) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    mirrorDirectory* directory = &mirrorDirectories[id];
+    if (directory->fd >= 0) {
+        mirrorLruUnlink(id);
+        mirrorLruPushNewest(id);
+        return directory->fd;
+    }
+
+    int parentFd = mirrorOpenDirectory(directory->parent);
+    if (parentFd < 0 && parentFd != AT_FDCWD) return -1;
+    int fd = openat(parentFd, directory->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (mirrorOpenCount == MIRROR_MAX_OPEN_DIRS) mirrorCloseDirectory(mirrorOldest);
+    directory->fd = fd;
+    mirrorOpenCount++;
+    mirrorLruPushNewest(id);
+    return fd;
+}
+
+// Remove name (a directory inside parentFd) and everything below it
+int mirrorRemoveTree(int parentFd, const char* name) {
+    int fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    DIR* directory = fdopendir(fd);
+    if (!directory) {
+        close(fd);
+        return -1;
+    }
+
+    struct dirent* entry;
+    int result = 0;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        struct stat info;
+        if (fstatat(fd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode)) {
+            if (mirrorRemoveTree(fd, entry->d_name) != 0) result = -1;
+        } else if (unlinkat(fd, entry->d_name, 0) != 0) {
+            result = -1;
+        }
+    }
+    closedir(directory); // Closes fd as well
+    if (unlinkat(parentFd, name, AT_REMOVEDIR) != 0) result = -1;
+    return result;
+}
+
+// The host filesystem calls of one op, inside its parent directory
+int mirrorSyscall(mirrorOp* op, int parentFd) {
+    switch (op->type) {
+        case MirrorRegister:
+            return 0;
+        case MirrorMkdir:
+            return mkdirat(parentFd, mirrorDirectories[op->id].name, 0755) == 0 || errno == EEXIST ? 0 : -1;
+        case MirrorCreate:
+        case MirrorWrite:
+        case MirrorPatch: {
+            // A patch rewrites only its own range of the file
+            int flags = O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC | (op->type == MirrorPatch ? 0 : O_TRUNC);
+            int fd = openat(parentFd, op->name, flags, 0644);
+            if (fd < 0) return -1;
+            size_t done = 0;
+            while (done < op->length) {
+                ssize_t written = pwrite(fd, op->content + done, op->length - done, (off_t)(op->offset + done));
+                if (written <= 0) {
+                    close(fd);
+                    return -1;
+                }
+                done += (size_t)written;
+            }
+            return close(fd);
+        }
+        case MirrorRemoveFile:
+            return unlinkat(parentFd, op->name, 0);
+        case MirrorRemoveDir: {
+            // A folder renamed in the tree keeps the host name it was created with
+            int registered = op->id && op->id < mirrorDirectoryCapacity && mirrorDirectories[op->id].name;
+            mirrorCloseDirectory(op->id);
+            return mirrorRemoveTree(parentFd, registered ? mirrorDirectories[op->id].name : op->name);
+        }
+    }
+    return -1;
+}
+
+// Apply one op to the host filesystem; 0 on success
+int mirrorApply(mirrorOp* op) {
+    if (op->type == MirrorRegister || op->type == MirrorMkdir) {
+        mirrorDirectory* directory = mirrorDirectoryEntry(op->id);
+        if (!directory) return -1;
+        free(directory->name);
+        directory->parent = op->directory;
+        directory->name = op->name;
+        op->name = NULL; // The registry owns it now
+        if (op->type == MirrorRegister) return 0;
+    }
+
+    uint64_t started = metricsStart(MetricMirrorResolve);
+    int parentFd = mirrorOpenDirectory(op->directory);
+    metricsRecord(MetricMirrorResolve, started);
+    if (parentFd < 0 && parentFd != AT_FDCWD) return -1;
+
+    started = metricsStart(MetricMirrorSyscall);
+    int result = mirrorSyscall(op, parentFd);
+    metricsRecord(MetricMirrorSyscall, started);
+    return result;
+}
+
+void* mirrorWorker(void* argument) {
+    (void)argument;
+    pthread_mutex_lock(&mirror.lock);
+    while (1) {
+        while (!mirror.head && !mirror.stopping) {
+            pthread_cond_wait(&mirror.workAvailable, &mirror.lock);
+        }
+        if (!mirror.head) break; // Stopping and drained
+
+        mirrorOp* op = mirror.head;
+        mirrorUnqueue(op);
+        mirror.busy = 1;
+        pthread_cond_broadcast(&mirror.progress); // A slot is free again
+        pthread_mutex_unlock(&mirror.lock);
+
+        const char* name = op->name; // Still valid after a mkdir hands it to the registry
+        int failed = mirrorApply(op) != 0;
+        if (failed) {
+            fprintf(stderr, "Error: Mirror could not apply change to '%s': %s\n", name, strerror(errno));
+        }
+        mirrorFreeOp(op);
+
+        pthread_mutex_lock(&mirror.lock);
+        mirror.busy = 0;
+        if (failed) mirror.errors++;
+        else mirror.written++;
+        pthread_cond_broadcast(&mirror.progress);
+    }
+    pthread_mutex_unlock(&mirror.lock);
+
+    // Nothing is left to do in the cached directories
+    while (mirrorOldest) mirrorCloseDirectory(mirrorOldest);
+    return NULL;
+}
+
+// Start the worker on first use (lock held)
+int mirrorStart(void) {
+    if (mirror.started) return 0;
+    if (pthread_create(&mirror.worker, NULL, mirrorWorker, NULL) != 0) {
+        printf("Error: Could not start the mirror worker.\n");
+        return -1;
+    }
+    mirror.started = 1;
+    return 0;
+}
+
+// Newest queued op of an entry; ops are pushed at the front of their bucket (lock held)
+mirrorOp* mirrorNewestOp(size_t hash, uint64_t directory, const char* name) {
+    for (mirrorOp* op = mirror.buckets[hash & (MIRROR_BUCKETS - 1)]; op; op = op->hashNext) {
+        if (op->directory == directory && strcmp(op->name, name) == 0) return op;
+    }
+    return NULL;
+}
+
+// Wait for a free slot, then queue a filled-in op behind everything else (lock held)
+void mirrorAppend(mirrorOp* op) {
+    while (mirror.queued >= MIRROR_QUEUE_LIMIT) {
+        pthread_cond_wait(&mirror.progress, &mirror.lock);
+    }
+
+    op->previous = mirror.tail;
+    if (mirror.tail) mirror.tail->next = op;
+    else mirror.head = op;
+    mirror.tail = op;
+    mirrorOp** bucket = &mirror.buckets[op->hash & (MIRROR_BUCKETS - 1)];
+    op->hashNext = *bucket;
+    *bucket = op;
+    mirror.queued++;
+
+    pthread_cond_signal(&mirror.workAvailable);
+}
+
+// Queue a host filesystem change in the given host directory; the command
+// does not wait for it. id is the folder's own id for the folder ops.
+void mirrorSubmit(enum mirrorOpType type, uint64_t directory, const char* name, const char* content, uint64_t id) {
+    size_t hash = mirrorHash(directory, name);
+    pthread_mutex_lock(&mirror.lock);
+
+    if (mirrorStart() != 0) {
+        pthread_mutex_unlock(&mirror.lock);
+        return;
+    }
+
+    if (type == MirrorWrite) {
+        // Queued patches are overwritten by the whole file, and a queued
+        // write of the same file just takes the newer content
+        mirrorOp* op = mirror.buckets[hash & (MIRROR_BUCKETS - 1)];
+        while (op) {
+            mirrorOp* next = op->hashNext;
+            if (op->type == MirrorPatch && op->directory == directory && strcmp(op->name, name) == 0) {
+                mirrorCancel(op);
+            }
+            op = next;
+        }
+        for (op = mirror.buckets[hash & (MIRROR_BUCKETS - 1)]; op; op = op->hashNext) {
+            if (op->type == MirrorWrite && op->directory == directory && strcmp(op->name, name) == 0) {
+                char* copy = strdup(content);
+                if (copy) {
+                    free(op->content);
+                    op->content = copy;
+                    op->length = strlen(copy);
+                    mirror.coalesced++;
+                    pthread_cond_broadcast(&mirror.progress);
+                    pthread_mutex_unlock(&mirror.lock);
+                    return;
+                }
+            }
+        }
+    } else if (type == MirrorRemoveFile || type == MirrorRemoveDir) {
+        // Queued creates, writes and patches of this entry are moot; if the
+        // create never reached the disk, neither does the remove
+        int createQueued = 0;
+        mirrorOp* op = mirror.buckets[hash & (MIRROR_BUCKETS - 1)];
+        while (op) {
+            mirrorOp* next = op->hashNext;
+            if (op->directory == directory && strcmp(op->name, name) == 0 &&
+                (op->type == MirrorMkdir || op->type == MirrorCreate || op->type == MirrorWrite ||
+                 op->type == MirrorPatch)) {
+                if (op->type == MirrorMkdir || op->type == MirrorCreate) createQueued = 1;
+                mirrorCancel(op);
+            }
+            op = next;
+        }
+        if (type == MirrorRemoveDir) {
+            // Everything queued inside the folder goes away with it
+            op = mirror.head;
+            while (op) {
+                mirrorOp* next = op->next;
+                if (mirrorIsBelow(op->directory, id)) mirrorCancel(op);
+                op = next;
+            }
+        }
+        if (createQueued) {
+            mirror.coalesced++;
+            pthread_cond_broadcast(&mirror.progress);
+            pthread_mutex_unlock(&mirror.lock);
+            return;
+        }
+    }
+
+    mirrorOp* op = calloc(1, sizeof(mirrorOp));
+    if (op) {
+        op->name = strdup(name);
+        op->content = content ? strdup(content) : NULL;
+    }
+    if (!op || !op->name || (content && !op->content)) {
+        if (op) mirrorFreeOp(op);
+        pthread_mutex_unlock(&mirror.lock);
+        printf("Error: Memory allocation failed.\n");
+        return;
+    }
+    op->type = type;
+    op->directory = directory;
+    op->id = id;
+    op->hash = hash;
+    op->length = content ? strlen(content) : 0;
+    mirrorAppend(op);
+    pthread_mutex_unlock(&mirror.lock);
+}
+
+// Queue a write of length bytes at offset into a file, without touching the
+// rest of it. A queued whole-file write or a queued patch that this one
+// continues or overlaps absorbs it, so a run of appends lands as one pwrite.
+void mirrorSubmitPatch(uint64_t directory, const char* name, size_t offset, const char* data, size_t length) {
+    size_t hash = mirrorHash(directory, name);
+    pthread_mutex_lock(&mirror.lock);
+
+    if (mirrorStart() != 0) {
+        pthread_mutex_unlock(&mirror.lock);
+        return;
+    }
+
+    // Only the newest op of the file may absorb the patch, so nothing queued after it is reordered
+    mirrorOp* newest = mirrorNewestOp(hash, directory, name);
+    if (newest && (newest->type == MirrorWrite || newest->type == MirrorPatch)) {
+        size_t base = newest->type == MirrorPatch ? newest->offset : 0;
+        if (offset >= base && offset - base <= newest->length) {
+            size_t end = offset - base + length;
+            size_t grownLength = end > newest->length ? end : newest->length;
+            char* grown = grownLength > newest->length ? realloc(newest->content, grownLength + 1) : newest->content;
+            if (grown) {
+                memcpy(grown + (offset - base), data, length);
+                grown[grownLength] = '\0';
+                newest->content = grown;
+                newest->length = grownLength;
+                mirror.coalesced++;
+                pthread_mutex_unlock(&mirror.lock);
+                return;
+            }
+        }
+    }
+
+    mirrorOp* op = calloc(1, sizeof(mirrorOp));
+    if (op) {
+        op->name = strdup(name);
+        op->content = malloc(length + 1);
+    }
+    if (!op || !op->name || !op->content) {
+        if (op) mirrorFreeOp(op);
+        pthread_mutex_unlock(&mirror.lock);
+        printf("Error: Memory allocation failed.\n");
+        return;
+    }
+    memcpy(op->content, data, length);
+    op->content[length] = '\0';
+    op->type = MirrorPatch;
+    op->directory = directory;
+    op->offset = offset;
+    op->length = length;
+    op->hash = hash;
+    mirrorAppend(op);
+    pthread_mutex_unlock(&mirror.lock);
+}
+
+// Host directory id of a folder. Folders that were not created by mkdir in
+// this session (the loaded ones) are registered on first use, parents first.
+uint64_t mirrorFolderId(node* folder) {
+    if (!nodeParent(folder)) return MIRROR_ROOT_ID;
+    if (folder->dir->mirrorId) return folder->dir->mirrorId;
+
+    uint64_t parent = mirrorFolderId(nodeParent(folder));
+    uint64_t id = parent ? mirrorNewId(parent) : 0;
+    if (!id) return 0;
+    folder->dir->mirrorId = id;
+    mirrorSubmit(MirrorRegister, parent, nodeName(folder), NULL, id);
+    return id;
+}
+
+// Wait until every queued change has reached the host filesystem
+void mirrorFlush(void) {
+    pthread_mutex_lock(&mirror.lock);
+    while (mirror.head || mirror.busy) {
+        pthread_cond_wait(&mirror.progress, &mirror.lock);
+    }
+    pthread_mutex_unlock(&mirror.lock);
+}
+
+// Flush and stop the worker; used on exit
+void mirrorShutdown(void) {
+    pthread_mutex_lock(&mirror.lock);
+    if (!mirror.started) {
+        pthread_mutex_unlock(&mirror.lock);
+        return;
+    }
+    mirror.stopping = 1;
+    pthread_cond_signal(&mirror.workAvailable);
+    pthread_mutex_unlock(&mirror.lock);
+
+    pthread_join(mirror.worker, NULL); // The worker drains the queue before it returns
+    mirror.started = 0;
+    mirror.stopping = 0;
+
+    for (size_t i = 0; i < mirrorDirectoryCapacity; i++) free(mirrorDirectories[i].name);
+    free(mirrorDirectories);
+    mirrorDirectories = NULL;
+    mirrorDirectoryCapacity = 0;
+    free(mirrorParents);
+    mirrorParents = NULL;
+    mirrorIdCount = MIRROR_ROOT_ID + 1;
+    mirrorIdCapacity = 0;
+}
+
+void mirrorReport(void) {
+    pthread_mutex_lock(&mirror.lock);
+    printf("Mirror flushed: %llu written, %llu coalesced, %llu failed.\n",
+           (unsigned long long)mirror.written, (unsigned long long)mirror.coalesced,
+           (unsigned long long)mirror.errors);
+    pthread_mutex_unlock(&mirror.lock);
+}
+
+// Write-ahead journal (-j <base>): every change to the tree is appended to
+// <base>.journal as a checksummed record that names nodes by their path
+// from the root. A writer thread commits the records with one write() and
+// one fdatasync() per group, so changes made while a sync is in flight
+// share the next one; interactive commands wait for their group before the
+// next prompt, scripts only at exit. Once the journal passes
+// JOURNAL_CHECKPOINT_BYTES (or on "checkpoint") the tree is saved as the
+// binary snapshot <base>.<generation>.snap and a new, empty journal of that
+// generation is renamed over the old one, which is the commit point. On
+// startup the checkpoint named by the journal is loaded and the records are
+// replayed onto it, up to the first torn or corrupt one.
+#define JOURNAL_MAGIC "SFSJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_CHECKPOINT_BYTES (64u << 20)
+#define JOURNAL_PENDING_LIMIT (16u << 20) // Unwritten bytes before commands wait for the writer
+
+enum journalOp {
+    JournalCreate = 1,       // path: parent folder, argument: name, data: symlink target
+    JournalEdit,             // path: file, data: the whole content
+    JournalWrite,            // path: file, data: bytes written at offset
+    JournalRemove,           // path: the removed node
+    JournalMove,             // path: the node, argument: destination folder, data: new name (optional)
+    JournalRename,           // path: the node, argument: new name
+    JournalSort,             // path: folder, kind: the order
+};
+
+typedef struct journalHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t generation;     // Checkpoint the records apply to; 0 is the empty tree
+} journalHeader;
+
+// Followed by the path, argument and data fields. Paths are the names below
+// the root, each terminated by a NUL (the root itself is empty), and names
+// in the argument and data fields keep their terminator too.
+typedef struct journalRecord {
+    uint32_t length;         // Whole record, this header included
+    uint32_t checksum;       // crc32 of everything after this field
+    uint8_t op;
+    uint8_t kind;            // JournalCreate: node type, JournalSort: order
+    uint16_t reserved;
+    uint32_t pathLength;
+    uint32_t argumentLength;
+    uint32_t dataLength;
+    int64_t date;            // JournalCreate/Edit/Write: the node's new date
+    uint64_t offset;         // JournalWrite
+} journalRecord;
+
+_Static_assert(sizeof(journalHeader) == 16, "journalHeader must not be padded");
+_Static_assert(sizeof(journalRecord) == 40, "journalRecord must not be padded");
+
+typedef struct journalState {
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t committed;    // durable moved forward
+    char* base;                  // NULL while journaling is off
+    int fd;
+    uint64_t generation;
+    char* pending;               // Records not handed to the writer yet
+    size_t pendingLength;
+    size_t pendingCapacity;
+    char* spare;                 // The writer's buffer, swapped with pending per group
+    size_t spareCapacity;
+    uint64_t appended;           // Record bytes since the checkpoint, pending ones included
+    uint64_t durable;            // Of those, written and synced
+    int failed;                  // A record was lost; only a checkpoint makes the journal whole again
+    int started;
+    int stopping;
+    pthread_t writer;
+    uint64_t records;
+    uint64_t commits;
+    uint64_t checkpoints;
+} journalState;
+
+journalState journal = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .workAvailable = PTHREAD_COND_INITIALIZER,
+    .committed = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+void* journalWriter(void* argument) {
+    (void)argument;
+    pthread_mutex_lock(&journal.lock);
+    while (1) {
+        while (journal.pendingLength == 0 && !journal.stopping) {
+            pthread_cond_wait(&journal.workAvailable, &journal.lock);
+        }
+        if (journal.pendingLength == 0) break; // Stopping and drained
+
+        // Take everything queued so far as one group; commands keep appending to the other buffer
+        char* group = journal.pending;
+        size_t groupLength = journal.pendingLength;
+        size_t groupCapacity = journal.pendingCapacity;
+        journal.pending = journal.spare;
+        journal.pendingCapacity = journal.spareCapacity;
+        journal.pendingLength = 0;
+        int fd = journal.fd;
+        pthread_mutex_unlock(&journal.lock);
+
+        int failed = 0;
+        for (size_t written = 0; written < groupLength && !failed;) {
+            ssize_t result = write(fd, group + written, groupLength - written);
+            if (result < 0 && errno != EINTR) failed = 1;
+            if (result > 0) written += (size_t)result;
+        }
+        if (!failed && fdatasync(fd) != 0) failed = 1;
+        if (failed) fprintf(stderr, "Error: Journal write failed: %s\n", strerror(errno));
+
+        pthread_mutex_lock(&journal.lock);
+        journal.spare = group;
+        journal.spareCapacity = groupCapacity;
+        journal.durable += groupLength;
+        journal.commits++;
+        if (failed) journal.failed = 1;
+        pthread_cond_broadcast(&journal.committed);
+    }
+    pthread_mutex_unlock(&journal.lock);
+    return NULL;
+}
+
+// Bytes of a node's journaled path
+size_t journalPathLength(node* item) {
+    size_t length = 0;
+    for (node* current = item; current && nodeParent(current); current = nodeParent(current)) {
+        length += strlen(nodeName(current)) + 1;
+    }
+    return length;
+}
+
+void journalPutPath(char* buffer, size_t length, node* item) {
+    for (node* current = item; current && nodeParent(current); current = nodeParent(current)) {
+        size_t nameLength = strlen(nodeName(current)) + 1;
+        length -= nameLength;
+        memcpy(buffer + length, nodeName(current), nameLength);
+    }
+}
+
+// Queue one record. The argument is either the path of destination or the string argument
+void journalAppend(journalRecord* record, node* item, node* destination, const char* argument,
+                   const char* data, size_t dataLength) {
+    size_t pathLength = journalPathLength(item);
+    size_t argumentLength = destination ? journalPathLength(destination) : argument ? strlen(argument) + 1 : 0;
+    size_t length = sizeof(journalRecord) + pathLength + argumentLength + dataLength;
+
+    pthread_mutex_lock(&journal.lock);
+    if (journal.failed) {
+        pthread_mutex_unlock(&journal.lock);
+        return;
+    }
+    if (length > UINT32_MAX) {
+        printf("Error: Change too large for the journal; run 'checkpoint' to persist the tree.\n");
+        journal.failed = 1;
+        pthread_mutex_unlock(&journal.lock);
+        return;
+    }
+    while (journal.pendingLength > JOURNAL_PENDING_LIMIT) {
+        pthread_cond_wait(&journal.committed, &journal.lock); // The writer is behind
+    }
+    if (journal.pendingLength + length > journal.pendingCapacity) {
+        size_t capacity = journal.pendingCapacity ? journal.pendingCapacity : 1 << 16;
+        while (capacity < journal.pendingLength + length) capacity *= 2;
+        char* pending = realloc(journal.pending, capacity);
+        if (!pending) {
+            printf("Error: Memory allocation failed; run 'checkpoint' to persist the tree.\n");
+            journal.failed = 1;
+            pthread_mutex_unlock(&journal.lock);
+            return;
+        }
+        journal.pending = pending;
+        journal.pendingCapacity = capacity;
+    }
+
+    char* out = journal.pending + journal.pendingLength;
+    char* field = out + sizeof(journalRecord);
+    journalPutPath(field, pathLength, item);
+    field += pathLength;
+    if (destination) journalPutPath(field, argumentLength, destination);
+    else if (argument) memcpy(field, argument, argumentLength);
+    field += argumentLength;
+    if (dataLength) memcpy(field, data, dataLength);
+
+    record->length = (uint32_t)length;
+    record->pathLength = (uint32_t)pathLength;
+    record->argumentLength = (uint32_t)argumentLength;
+    record->dataLength = (uint32_t)dataLength;
+    memcpy(out, record, sizeof(journalRecord));
+    record->checksum = (uint32_t)crc32(0L, (const Bytef*)out + 8, (uInt)(length - 8));
+    memcpy(out + 4, &record->checksum, sizeof(uint32_t));
+
+    journal.pendingLength += length;
+    journal.appended += length;
+    journal.records++;
+    pthread_cond_signal(&journal.workAvailable);
+    pthread_mutex_unlock(&journal.lock);
+}
+
+void journalCreate(node* item) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalCreate, .kind = (uint8_t)item->type, .date = (int64_t)item->date};
+    const char* target = nodeTarget(item);
+    journalAppend(&record, nodeParent(item), NULL, nodeName(item), target, target ? strlen(target) + 1 : 0);
+}
+
+void journalEdit(node* file, const char* data, size_t length) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalEdit, .date = (int64_t)file->date};
+    journalAppend(&record, file, NULL, NULL, data, length);
+}
+
+void journalWrite(node* file, size_t offset, const char* data, size_t length) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalWrite, .date = (int64_t)file->date, .offset = offset};
+    journalAppend(&record, file, NULL, NULL, data, length);
+}
+
+void journalRemove(node* item) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalRemove};
+    journalAppend(&record, item, NULL, NULL, NULL, 0);
+}
+
+void journalMove(node* item, node* destination, const char* newName) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalMove};
+    journalAppend(&record, item, destination, NULL, newName, newName ? strlen(newName) + 1 : 0);
+}
+
+void journalRename(node* item, const char* newName) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalRename};
+    journalAppend(&record, item, NULL, newName, NULL, 0);
+}
+
+void journalSort(node* folder, enum orderKind kind) {
+    if (!journal.base) return;
+    journalRecord record = {.op = JournalSort, .kind = (uint8_t)kind};
+    journalAppend(&record, folder, NULL, NULL, NULL, 0);
+}
+
+// Wait until every queued record is on disk
+void journalSync(void) {
+    pthread_mutex_lock(&journal.lock);
+    while (journal.durable < journal.appended) {
+        pthread_cond_wait(&journal.committed, &journal.lock);
+    }
+    pthread_mutex_unlock(&journal.lock);
+}
+
+// "<base>.journal", or "<base>.<generation>.snap" for a checkpoint
+void journalFileName(char* buffer, size_t size, uint64_t generation, int checkpoint) {
+    if (checkpoint) snprintf(buffer, size, "%s.%llu.snap", journal.base, (unsigned long long)generation);
+    else snprintf(buffer, size, "%s.journal", journal.base);
+}
+
+// Make renames in the journal's directory durable
+void journalSyncDirectory(void) {
+    char directory[MAX_PATH_LENGTH];
+    const char* slash = strrchr(journal.base, '/');
+    if (slash) snprintf(directory, sizeof(directory), "%.*s", (int)(slash - journal.base + 1), journal.base);
+    else strcpy(directory, ".");
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// Put an empty journal of the given generation in place; returns its fd, positioned after the header
+int journalCreateFile(uint64_t generation) {
+    char fileName[MAX_PATH_LENGTH];
+    char temporary[MAX_PATH_LENGTH + 8];
+    journalFileName(fileName, sizeof(fileName), generation, 0);
+    snprintf(temporary, sizeof(temporary), "%s.tmp", fileName);
+
+    int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    journalHeader header = {0};
+    memcpy(header.magic, JOURNAL_MAGIC, 4);
+    header.version = JOURNAL_VERSION;
+    header.generation = generation;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || fsync(fd) != 0 ||
+        rename(temporary, fileName) != 0) {
+        close(fd);
+        unlink(temporary);
+        return -1;
+    }
+    journalSyncDirectory();
+    return fd;
+}
+
+// Save the tree as the next checkpoint and start an empty journal on top of it
+int journalCheckpoint(node* root) {
+    if (!journal.base) return -1;
+    journalSync();
+
+    uint64_t generation = journal.generation + 1;
+    char snapshotName[MAX_PATH_LENGTH];
+    journalFileName(snapshotName, sizeof(snapshotName), generation, 1);
+    snapshotPlan plan = {0};
+    int failed = snapshotToFile(root, snapshotName, 1, &plan) != 0;
+    freePlan(&plan);
+    int fd = failed ? -1 : journalCreateFile(generation);
+    if (fd < 0) {
+        unlink(snapshotName);
+        printf("Error: Checkpoint failed; the journal stays at generation %llu.\n",
+               (unsigned long long)journal.generation);
+        return -1;
+    }
+
+    // The writer is idle: everything was synced and only this thread appends
+    pthread_mutex_lock(&journal.lock);
+    int previousFd = journal.fd;
+    journal.fd = fd;
+    journal.generation = generation;
+    journal.appended = journal.durable = 0;
+    journal.failed = 0;
+    journal.checkpoints++;
+    pthread_mutex_unlock(&journal.lock);
+    close(previousFd);
+
+    if (generation > 1) {
+        journalFileName(snapshotName, sizeof(snapshotName), generation - 1, 1);
+        unlink(snapshotName);
+    }
+    return 0;
+}
+
+// The whole tree was replaced (load, decompress, import): it becomes the next checkpoint
+void journalReset(node* root) {
+    if (!journal.base || journalCheckpoint(root) == 0) return;
+    pthread_mutex_lock(&journal.lock);
+    journal.failed = 1; // The records on disk no longer lead to this tree
+    pthread_mutex_unlock(&journal.lock);
+    printf("Error: Journaling is suspended until a 'checkpoint' succeeds.\n");
+}
+
+// Follow a journaled path from the root; NULL if any name is missing
+node* journalResolve(node* root, const char* path, size_t length) {
+    node* current = root;
+    size_t position = 0;
+    while (position < length) {
+        const char* name = path + position;
+        size_t nameLength = strnlen(name, length - position);
+        if (nameLength == length - position || current->type != Folder) return NULL;
+        current = getNodeTypeless(current, (char*)name);
+        if (!current) return NULL;
+        position += nameLength + 1;
+    }
+    return current;
+}
+
+// A name field: non-empty and terminated inside the record
+int journalName(const char* field, size_t length) {
+    return length > 1 && strnlen(field, length) == length - 1;
+}
+
+// Apply one record to the tree, quietly and without mirroring; -1 if it does not fit the tree
+int journalApply(node* root, const journalRecord* record, const char* fields) {
+    const char* argument = fields + record->pathLength;
+    const char* data = argument + record->argumentLength;
+    node* item = journalResolve(root, fields, record->pathLength);
+    if (!item) return -1;
+
+    switch (record->op) {
+    case JournalCreate: {
+        if (item->type != Folder || record->kind > Symlink || !journalName(argument, record->argumentLength) ||
+            getNodeTypeless(item, (char*)argument)) {
+            return -1;
+        }
+        node* created = createNode((enum nodeType)record->kind, argument);
+        if (!created) return -1;
+        if (record->kind == Symlink && journalName(data, record->dataLength)) {
+            created->symlinkTarget = arenaStrdup(activeArena, data);
+        }
+        created->date = (time_t)record->date;
+        linkChild(item, created);
+        return 0;
+    }
+    case JournalEdit:
+        if (item->type != File) return -1;
+        return setContent(item, data, record->dataLength, (time_t)record->date);
+    case JournalWrite:
+        if (item->type != File || record->offset > (item->content ? item->content->length : 0)) return -1;
+        return writeContent(item, (size_t)record->offset, data, record->dataLength, (time_t)record->date);
+    case JournalRemove:
+        if (item == root) return -1;
+        unlinkChild(item);
+        freeNode(item);
+        return 0;
+    case JournalMove: {
+        node* destination = journalResolve(root, argument, record->argumentLength);
+        if (!destination || destination->type != Folder || item == root) return -1;
+        for (node* ancestor = destination; ancestor; ancestor = nodeParent(ancestor)) {
+            if (ancestor == item) return -1; // Into its own subtree
+        }
+        int renamed = journalName(data, record->dataLength);
+        node* existing = getNodeTypeless(destination, renamed ? (char*)data : nodeName(item));
+        if (existing && existing != item) return -1;
+        unlinkChild(item);
+        if (renamed) renameChild(item, data);
+        linkChild(destination, item);
+        return 0;
+    }
+    case JournalRename: {
+        if (item == root || !journalName(argument, record->argumentLength)) return -1;
+        node* existing = getNodeTypeless(nodeParent(item), (char*)argument);
+        if (existing && existing != item) return -1;
+        renameChild(item, argument);
+        return 0;
+    }
+    case JournalSort:
+        if (item->type != Folder || record->kind > OrderByDate) return -1;
+        sortChildren(item, (enum orderKind)record->kind);
+        return 0;
+    }
+    return -1;
+}
+
+// Replay the records after the header onto root; returns the end of the last intact record
+off_t journalReplay(int fd, node* root, uint64_t* replayed, uint64_t* skipped) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= (off_t)sizeof(journalHeader)) return sizeof(journalHeader);
+    size_t size = (size_t)info.st_size;
+    char* records = malloc(size);
+    size_t loaded = 0;
+    while (records && loaded < size) {
+        ssize_t result = pread(fd, records + loaded, size - loaded, (off_t)loaded);
+        if (result <= 0) break;
+        loaded += (size_t)result;
+    }
+    if (!records) {
+        printf("Error: Memory allocation failed while replaying the journal.\n");
+        return -1;
+    }
+
+    size_t position = sizeof(journalHeader);
+    while (loaded - position >= sizeof(journalRecord)) {
+        journalRecord record;
+        memcpy(&record, records + position, sizeof(record));
+        uint64_t fieldBytes = (uint64_t)record.pathLength + record.argumentLength + record.dataLength;
+        if (record.length < sizeof(journalRecord) || record.length > loaded - position ||
+            record.length != sizeof(journalRecord) + fieldBytes ||
+            record.checksum != (uint32_t)crc32(0L, (const Bytef*)records + position + 8, record.length - 8)) {
+            break; // Torn or corrupt: nothing after it was acknowledged as durable
+        }
+        if (journalApply(root, &record, records + position + sizeof(journalRecord)) == 0) (*replayed)++;
+        else (*skipped)++;
+        position += record.length;
+    }
+    free(records);
+    return (off_t)position;
+}
+
+// Recover the tree from base's checkpoint and journal (or start a new journal) and
+// start the writer. Returns the recovered root, which may replace root, or NULL
+node* journalOpen(const char* base, node* root) {
+    journal.base = strdup(base);
+    char fileName[MAX_PATH_LENGTH];
+    journalFileName(fileName, sizeof(fileName), 0, 0);
+
+    int fd = open(fileName, O_RDWR);
+    uint64_t replayed = 0, skipped = 0;
+    if (fd < 0 && errno == ENOENT) {
+        fd = journalCreateFile(0); // A new journal for the empty tree
+        if (fd < 0) {
+            printf("Error: Could not create journal '%s': %s\n", fileName, strerror(errno));
+            return NULL;
+        }
+    } else if (fd < 0) {
+        printf("Error: Could not open journal '%s': %s\n", fileName, strerror(errno));
+        return NULL;
+    } else {
+        journalHeader header;
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(header.magic, JOURNAL_MAGIC, 4) != 0 || header.version != JOURNAL_VERSION) {
+            printf("Error: '%s' is not a journal.\n", fileName);
+            close(fd);
+            return NULL;
+        }
+        journal.generation = header.generation;
+        if (journal.generation > 0) {
+            char snapshotName[MAX_PATH_LENGTH];
+            journalFileName(snapshotName, sizeof(snapshotName), journal.generation, 1);
+            node* loaded = loadSnapshot(snapshotName);
+            if (!loaded) {
+                close(fd);
+                return NULL;
+            }
+            freeNode(root);
+            root = loaded;
+        }
+
+        off_t end = journalReplay(fd, root, &replayed, &skipped);
+        if (end < 0 || ftruncate(fd, end) != 0 || fsync(fd) != 0 || lseek(fd, end, SEEK_SET) < 0) {
+            printf("Error: Could not recover journal '%s'.\n", fileName);
+            close(fd);
+            return NULL;
+        }
+        journal.appended = journal.durable = (uint64_t)end - sizeof(journalHeader);
+    }
+
+    // A checkpoint interrupted before its journal was renamed into place
+    char staleName[MAX_PATH_LENGTH];
+    journalFileName(staleName, sizeof(staleName), journal.generation + 1, 1);
+    unlink(staleName);
+
+    journal.fd = fd;
+    if (pthread_create(&journal.writer, NULL, journalWriter, NULL) != 0) {
+        printf("Error: Could not start the journal writer.\n");
+        close(fd);
+        return NULL;
+    }
+    journal.started = 1;
+    printf("Journal '%s': generation %llu, %llu changes replayed",
+           fileName, (unsigned long long)journal.generation, (unsigned long long)replayed);
+    if (skipped) printf(", %llu did not apply", (unsigned long long)skipped);
+    printf(".\n");
+    return root;
+}
+
+// After every command: interactive changes are durable before the next prompt, and a long journal is checkpointed
+void journalAfterCommand(node* root) {
+    if (!journal.base) return;
+    if (journal.appended >= JOURNAL_CHECKPOINT_BYTES) journalCheckpoint(root);
+    else if (!batchMode) journalSync();
+}
+
+// Flush and stop the writer; used on exit
+void journalShutdown(void) {
+    if (!journal.started) return;
+    pthread_mutex_lock(&journal.lock);
+    journal.stopping = 1;
+    pthread_cond_signal(&journal.workAvailable);
+    pthread_mutex_unlock(&journal.lock);
+
+    pthread_join(journal.writer, NULL); // The writer drains the queue before it returns
+    journal.started = 0;
+    close(journal.fd);
+    free(journal.pending);
+    free(journal.spare);
+    free(journal.base);
+    journal.base = NULL;
+}
+
+void journalReport(void) {
+    if (!journal.base) {
+        printf("Journal is off; start with -j <base> to keep one.\n");
+        return;
+    }
+    pthread_mutex_lock(&journal.lock);
+    printf("Journal '%s.journal': generation %llu, %llu bytes since the checkpoint, "
+           "%llu changes in %llu group commits, %llu checkpoints%s.\n",
+           journal.base, (unsigned long long)journal.generation, (unsigned long long)journal.appended,
+           (unsigned long long)journal.records, (unsigned long long)journal.commits,
+           (unsigned long long)journal.checkpoints, journal.failed ? " (suspended: run 'checkpoint')" : "");
+    pthread_mutex_unlock(&journal.lock);
+}
+
+void make_dir(node* currentFolder, char* command) {
+    if (strtok(command, " ") != NULL) {
+        char* folderName = strtok(NULL, " ");
+        if (folderName != NULL) {
+            // Check if the folder already exists in the virtual tree
+            if (getNodeTypeless(currentFolder, folderName) == NULL) {
+                // Create the folder in the virtual file system
+                node* newFolder = createNode(Folder, folderName);
+                if (!newFolder) {
+                    printf("Error: Memory allocation failed.\n");
+                    return;
+                }
+                linkChild(currentFolder, newFolder);
+                journalCreate(newFolder);
+
+                printf("Folder '%s' added to the virtual filesystem.\n", nodeName(newFolder));
+                if (!mirrorEnabled) return;
+
+                // Queue the folder's creation in the real file system, inside its parent's host directory
+                uint64_t parentId = mirrorFolderId(currentFolder);
+                newFolder->dir->mirrorId = parentId ? mirrorNewId(parentId) : 0;
+                if (newFolder->dir->mirrorId) {
+                    mirrorSubmit(MirrorMkdir, parentId, nodeName(newFolder), NULL, newFolder->dir->mirrorId);
+                }
+            } else {
+                fprintf(stderr, "'%s' already exists in the current directory!\n", folderName);
+            }
+        }
+    }
+}
+
+void touch(node* currentFolder, char* command, char* currentPath) {
+    if (strtok(command, " ") != NULL) {
+        char* fileName = strtok(NULL, " ");
+        if (fileName != NULL) {
+            if (getNodeTypeless(currentFolder, fileName) == NULL) {
+                node* newFile = createNode(File, fileName);
+                if (!newFile) {
+                    printf("Error: Memory allocation failed.\n");
+                    return;
+                }
+                linkChild(currentFolder, newFile);
+                journalCreate(newFile);
+                if (!mirrorEnabled) return;
+
+                // Queue the file's creation inside the folder's host directory
+                uint64_t folderId = mirrorFolderId(currentFolder);
+                if (folderId) mirrorSubmit(MirrorCreate, folderId, fileName, NULL, 0);
+            } else {
+                fprintf(stderr, "'%s' already exists in the current directory!\n", fileName);
+            }
+        }
+    }
+}
+
+// Listing output: ls and lsrecursive format their lines into one large
+// buffer that goes out in a few write() calls, instead of several printf
+// calls per entry. Timestamps are formatted once per distinct minute.
+// With -u, the unbuffered baseline for benchmarks, every piece goes through
+// stdio and every timestamp through localtime and strftime instead.
+#define LISTING_BUFFER_SIZE (1 << 20)
+#define LISTING_DATE_SLOTS 1024 // Power of two
+
+typedef struct listingDate {
+    long long minute;
+    int used;
+    size_t length;
+    char text[24];
+} listingDate;
+
+typedef struct listingOutput {
+    char* buffer;
+    size_t used;
+    listingDate dates[LISTING_DATE_SLOTS]; // Direct-mapped by minute
+    int unbuffered;          // -u
+} listingOutput;
+
+listingOutput listing;
+
+void listingWrite(const char* data, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = write(STDOUT_FILENO, data + done, length - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break; // Nowhere to write to; drop the rest like stdio would
+        done += (size_t)written;
+    }
+}
+
+void listingFlush(void) {
+    listingWrite(listing.buffer, listing.used);
+    listing.used = 0;
+}
+
+// Start a listing: whatever stdio still holds goes out first, to keep the order
+void listingBegin(void) {
+    fflush(stdout);
+    if (!listing.buffer && !listing.unbuffered) listing.buffer = malloc(LISTING_BUFFER_SIZE);
+}
+
+void listingEnd(void) {
+    if (listing.buffer) listingFlush();
+}
+
+void listingPut(const char* data, size_t length) {
+    if (!listing.buffer) {
+        fwrite(data, 1, length, stdout);
+        return;
+    }
+    if (listing.used + length > LISTING_BUFFER_SIZE) {
+        listingFlush();
+        if (length > LISTING_BUFFER_SIZE) {
+            listingWrite(data, length); // Too big to buffer
+            return;
+        }
+    }
+    memcpy(listing.buffer + listing.used, data, length);
+    listing.used += length;
+}
+
+void listingString(const char* str) {
+    listingPut(str, strlen(str));
+}
+
+void listingNumber(unsigned long long value) {
+    char digits[24];
+    int position = sizeof(digits);
+    do {
+        digits[--position] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    listingPut(digits + position, sizeof(digits) - position);
+}
+
+// "%d %b %H:%M" of a date; localtime and strftime run once per minute seen
+void listingDateOf(time_t date) {
+    if (listing.unbuffered) {
+        char text[24];
+        struct tm* parts = localtime(&date);
+        listingPut(text, parts ? strftime(text, sizeof(text), "%d %b %H:%M", parts) : 0);
+        return;
+    }
+    long long minute = date >= 0 ? (long long)date / 60 : -((-(long long)date + 59) / 60);
+    listingDate* slot = &listing.dates[(unsigned long long)minute & (LISTING_DATE_SLOTS - 1)];
+    if (!slot->used || slot->minute != minute) {
+        time_t start = (time_t)(minute * 60);
+        struct tm* parts = localtime(&start);
+        slot->length = parts ? strftime(slot->text, sizeof(slot->text), "%d %b %H:%M", parts) : 0;
+        slot->minute = minute;
+        slot->used = 1;
+    }
+    listingPut(slot->text, slot->length);
+}
+
+// lsrecursive's tree prefix: one tab per level, then a branch
+void listingIndent(int indentCount) {
+    static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+    for (int left = indentCount; left > 0; left -= 16) {
+        listingPut(tabs, left < 16 ? (size_t)left : 16);
+    }
+    if (indentCount != 0) listingString("└─");
+}
+
+// One listing line; lsrecursive indents it and leaves the '/' off folder names
+void lsEntry(node* currentNode, int indentCount, int recursive) {
+    int numberOfItems = currentNode->type == Folder ? currentNode->dir->numberOfItems : 0;
+    lsLine(currentNode->type, numberOfItems, currentNode->size, currentNode->date, nodeName(currentNode),
+           indentCount, recursive);
+}
+
+// lsEntry from the fields alone, for node states that are not a live node (snapshot views)
+void lsLine(enum nodeType type, int numberOfItems, size_t size, time_t date, const char* name,
+            int indentCount, int recursive) {
+    listingIndent(indentCount);
+
+    if (type == Folder) {
+        listingString(CYAN);
+        listingNumber((unsigned long long)numberOfItems);
+        listingPut(" items\t", 7);
+    } else if (type == File) {
+        listingString(YELLOW);
+        listingNumber((unsigned long long)size);
+        listingPut("B\t", 2);
+    } else {
+        listingString(BLUE);
+        listingPut("\t", 1);
+    }
+    listingDateOf(date);
+    listingPut("\t", 1);
+    listingString(name);
+    if (type == Folder && !recursive) listingPut("/", 1);
+    listingString(RESET);
+    listingPut("\n", 1);
+}
+
+void ls(node *currentFolder) {
+    materialize(currentFolder);
+    if (nodeChild(currentFolder) == NULL) {
+        printf("___Empty____\n");
+        return;
+    }
+
+    listingBegin();
+    node *currentNode = nodeChild(currentFolder);
+
+    while (currentNode != NULL) {
+        lsEntry(currentNode, 0, 0);
+        currentNode = nodeNext(currentNode);
+    }
+    listingEnd();
+}
+
+// A date bound for ls --from/--to: seconds since the epoch, or local YYYY-MM-DD[THH:MM[:SS]]
+int parseDateBound(const char* text, time_t* date) {
+    char* end;
+    long long seconds = strtoll(text, &end, 10);
+    if (*text && *end == '\0') {
+        *date = (time_t)seconds;
+        return 0;
+    }
+
+    struct tm parts;
+    memset(&parts, 0, sizeof(parts));
+    int fields = sscanf(text, "%d-%d-%dT%d:%d:%d", &parts.tm_year, &parts.tm_mon, &parts.tm_mday,
+                        &parts.tm_hour, &parts.tm_min, &parts.tm_sec);
+    if (fields != 3 && fields < 5) return -1;
+    parts.tm_year -= 1900;
+    parts.tm_mon -= 1;
+    parts.tm_isdst = -1;
+    *date = mktime(&parts);
+    return *date == (time_t)-1 ? -1 : 0;
+}
+
+// ls [--sort=name|date] [--from key] [--to key] [--limit n]: children in a
+// standing order, from the first key at or after --from up to (not
+// including) --to. Keys are names, or dates for --sort=date.
+void lsSorted(node* currentFolder, char* command) {
+    char* words[16];
+    int count = findSplitArguments(command, words, 16);
+    enum orderKind kind = OrderByName;
+    int sorted = 0;
+    const char* from = NULL;
+    const char* to = NULL;
+    long long limit = -1;
+
+    for (int i = 1; i < count; i++) {
+        int hasValue = i + 1 < count;
+        if (strcmp(words[i], "--sort=name") == 0) {
+            kind = OrderByName;
+            sorted = 1;
+        } else if (strcmp(words[i], "--sort=date") == 0) {
+            kind = OrderByDate;
+            sorted = 1;
+        } else if (strcmp(words[i], "--from") == 0 && hasValue) {
+            from = words[++i];
+        } else if (strcmp(words[i], "--to") == 0 && hasValue) {
+            to = words[++i];
+        } else if (strcmp(words[i], "--limit") == 0 && hasValue) {
+            limit = atoll(words[++i]);
+        } else {
+            printf("Error: Usage: ls [--sort=name|date] [--from key] [--to key] [--limit n]\n");
+            return;
+        }
+    }
+    if (!sorted && (from || to)) sorted = 1; // A range implies the name order
+    if (!sorted && limit < 0) {
+        ls(currentFolder);
+        return;
+    }
+
+    time_t fromDate = 0, toDate = 0;
+    if (kind == OrderByDate && ((from && parseDateBound(from, &fromDate) != 0) ||
+                                (to && parseDateBound(to, &toDate) != 0))) {
+        printf("Error: Dates are seconds since the epoch or YYYY-MM-DD[THH:MM[:SS]].\n");
+        return;
+    }
+
+    materialize(currentFolder);
+    if (nodeChild(currentFolder) == NULL) {
+        printf("___Empty____\n");
+        return;
+    }
+    listingBegin();
+    if (!sorted) {
+        for (node* item = nodeChild(currentFolder); item && limit != 0; item = nodeNext(item), limit--) {
+            lsEntry(item, 0, 0);
+        }
+        listingEnd();
+        return;
+    }
+
+    // A date bound starts before every name at that second
+    orderCursor cursor = orderSeek(currentFolder, kind, kind == OrderByDate ? (from ? "" : NULL) : from, fromDate);
+    for (node* item = orderNext(&cursor); item && limit != 0; item = orderNext(&cursor), limit--) {
+        if (to && (kind == OrderByDate ? item->date >= toDate : strcmp(nodeName(item), to) >= 0)) break;
+        lsEntry(item, 0, 0);
+    }
+    listingEnd();
+}
+
+
+void lsrecursiveLines(node *currentFolder, int indentCount) {
+    materialize(currentFolder);
+    if (nodeChild(currentFolder) == NULL) {
+        listingIndent(indentCount);
+        listingString("___Empty____\n");
+    } else {
+        node *currentNode = nodeChild(currentFolder);
+
+        while (currentNode != NULL) {
+            lsEntry(currentNode, indentCount, 1);
+
+            // Recursively list child folders
+            if (currentNode->type == Folder) {
+                lsrecursiveLines(currentNode, indentCount + 1);
+            }
+
+            currentNode = nodeNext(currentNode);
+        }
+    }
+}
+
+void lsrecursive(node *currentFolder, int indentCount) {
+    listingBegin();
+    lsrecursiveLines(currentFolder, indentCount);
+    listingEnd();
+}
+
+void edit(node* currentFolder, char* command) {
+    if (strtok(command, " ") != NULL) {
+        char* fileName = strtok(NULL, " ");
+        if (fileName != NULL) {
+            node* editingNode = getNode(currentFolder, fileName, File);
+            if (editingNode) {
+                printf("Enter new content for '%s':\n", fileName);
+                char* content = getString();
+
+                // Update memory
+                if (setContent(editingNode, content, strlen(content), time(NULL)) != 0) {
+                    printf("Error: Memory allocation failed.\n");
+                    free(content);
+                    return;
+                }
+                journalEdit(editingNode, content, strlen(content));
+
+                if (mirrorEnabled) {
+                    // Queue the write to the real file
+                    uint64_t folderId = mirrorFolderId(currentFolder);
+                    if (folderId) mirrorSubmit(MirrorWrite, folderId, fileName, content, 0);
+                }
+
+                free(content);
+            } else {
+                printf("File '%s' not found.\n", fileName);
+            }
+        }
+    }
+}
+
+// Write text read from the input at offset (at most the file's size) without
+// rewriting the rest of the file; offset -1 appends
+void writeAt(node* currentFolder, char* fileName, long long offset) {
+    node* file = getNode(currentFolder, fileName, File);
+    if (!file) {
+        printf("File '%s' not found.\n", fileName);
+        return;
+    }
+    size_t length = file->content ? file->content->length : 0;
+    if (offset < 0) offset = (long long)length;
+    if ((unsigned long long)offset > length) {
+        printf("Error: Offset %lld is past the end of '%s' (%zu bytes).\n", offset, fileName, length);
+        return;
+    }
+
+    printf("Enter text to write to '%s' at offset %lld:\n", fileName, offset);
+    char* text = getString();
+    size_t textLength = strlen(text);
+
+    if (writeContent(file, (size_t)offset, text, textLength, time(NULL)) != 0) {
+        printf("Error: Memory allocation failed.\n");
+        free(text);
+        return;
+    }
+    journalWrite(file, (size_t)offset, text, textLength);
+
+    if (mirrorEnabled && textLength > 0) {
+        // Only the written range goes to the real file
+        uint64_t folderId = mirrorFolderId(currentFolder);
+        if (folderId) mirrorSubmitPatch(folderId, fileName, (size_t)offset, text, textLength);
+    }
+    free(text);
+}
+
+// Replace a file's whole content (shared with identical files) and stamp it
+int setContent(node* file, const char* data, size_t length, time_t date) {
+    preserveNode(file); // A snapshot may still show the old content
+    fileContent* replacement = contentIntern(data, length);
+    if (!replacement) return -1;
+    contentRelease(file->content);
+    file->content = replacement;
+    setNodeSize(file, replacement->length);
+    setNodeDate(file, date);
+    return 0;
+}
+
+// Overwrite or extend a file's content at offset (at most its size) and stamp it
+int writeContent(node* file, size_t offset, const char* data, size_t length, time_t date) {
+    preserveNode(file); // Holding the old content makes it shared, so it is copied below
+    // A content shared with other files is copied first (its chunks stay shared)
+    fileContent* content = file->content ? contentWritable(file->content) : contentCreate();
+    if (content) file->content = content;
+    if (!content || contentWrite(content, offset, data, length) != 0) return -1;
+    setNodeSize(file, content->length);
+    setNodeDate(file, date);
+    return 0;
+}
+
+void append(node* currentFolder, char* command) {
+    strtok(command, " ");
+    char* fileName = strtok(NULL, " ");
+    if (!fileName) {
+        printf("Error: No file name provided. Usage: append <fileName>\n");
+        return;
+    }
+    writeAt(currentFolder, fileName, -1);
+}
+
+void writeCommand(node* currentFolder, char* command) {
+    strtok(command, " ");
+    char* fileName = strtok(NULL, " ");
+    char* offsetText = strtok(NULL, " ");
+    char* end = NULL;
+    long long offset = offsetText ? strtoll(offsetText, &end, 10) : -1;
+    if (!fileName || !offsetText || *end != '\0' || offset < 0) {
+        printf("Error: Usage: write <fileName> <offset>\n");
+        return;
+    }
+    writeAt(currentFolder, fileName, offset);
+}
+
+void clear() {
+    #ifdef _WIN32
+        system("cls"); // Windows-specific command to clear the screen
+    #else
+        system("clear"); // Unix/Linux/Mac command to clear the screen
+    #endif
+}
+
+
+void pwd(char *path) {
+    if (path && strlen(path) > 0) {
+        // Print the path directly without trimming the last character
+        printf("%s\n", path);
+    } else {
+        // Default to root if the path is not set or invalid
+        printf("/\n");
+    }
+}
+
+node* cd(node *currentFolder, char *command, char **path, node *root) {
+    if (strtok(command, " ") != NULL) {
+        char* targetPath = strtok(NULL, " ");
+        if (targetPath != NULL) {
+            char missing[256];
+            node* destinationFolder = resolvePath(currentFolder, targetPath, root, missing, sizeof(missing));
+            if (destinationFolder == NULL) {
+                fprintf(stderr, "There is no '%s' folder in the current directory!\n", missing);
+                return currentFolder;
+            }
+            if (destinationFolder->type != Folder) {
+                fprintf(stderr, "There is no '%s' folder in the current directory!\n", nodeName(destinationFolder));
+                return currentFolder;
+            }
+
+            // The prompt path is the folder's own path, however it was reached
+            size_t length = nodePathLength(destinationFolder);
+            char* resized = realloc(*path, length + 1);
+            if (!resized) {
+                printf("Error: Memory allocation failed.\n");
+                return currentFolder;
+            }
+            *path = resized;
+            nodePath(destinationFolder, *path, length + 1);
+            currentFolder = destinationFolder;
+        } else {
+            printf("Error: No path provided.\n");
+        }
+    }
+    return currentFolder;
+}
+
+node* cdup(node *currentFolder, char **path) {
+
+    size_t newPathLength = strlen(*path) - strlen(nodeName(currentFolder));
+
+    while (nodePrevious(currentFolder) != NULL) {
+        currentFolder = nodePrevious(currentFolder);
+    }
+    if (nodeParent(currentFolder) != NULL ) {
+
+        *path = (char *) realloc(*path, sizeof(char)* newPathLength);
+        (*path)[newPathLength-1] = '\0';
+
+        currentFolder = nodeParent(currentFolder);
+        return currentFolder;
+    } else {
+        return currentFolder;
+    }
+}
+
+void freeNode(node *freeingNode) {
+
+    if (nodeChild(freeingNode) != NULL) {
+
+        node* currentNode = nodeChild(freeingNode);
+
+        while (nodeNext(currentNode) != NULL) {
+            node* nextNode = nodeNext(currentNode);
+            freeNode(currentNode);
+            currentNode = nextNode;
+        }
+        freeNode(currentNode);
+    }
+    if (snapshotRetire(freeingNode)) return; // Freed once no snapshot shows it
+    releaseNode(freeingNode);
+}
+
+// Free one node's own memory; its children are not touched
+void releaseNode(node* freeingNode) {
+    nodeHistoryRelease(freeingNode);
+    nodeFreeName(freeingNode);
+    if (freeingNode->type == File) {
+        contentRelease(freeingNode->content);
+    } else if (freeingNode->type == Symlink) {
+        arenaFreeString(activeArena, freeingNode->symlinkTarget);
+    } else {
+        folderData* dir = freeingNode->dir;
+        arenaRelease(activeArena, dir->index, dir->indexCapacity * sizeof(nodeRef));
+        orderFree(dir->order[OrderByName]);
+        orderFree(dir->order[OrderByDate]);
+        arenaRelease(activeArena, dir, sizeof(folderData));
+    }
+    nodeUsageAdd(freeingNode, -1, -(long long)(sizeof(node) + (freeingNode->type == Folder ? sizeof(folderData) : 0)));
+    arenaFreeNode(activeArena, freeingNode);
+
+}
+
+void removeNode(node *removingNode) {
+    unlinkChild(removingNode);
+}
+
+void rm(node* currentFolder, char* command) {
+    if (strtok(command, " ") != NULL) {
+        char* nodeName = strtok(NULL, " ");
+        if (nodeName != NULL) {
+            node* removingNode = getNodeTypeless(currentFolder, nodeName);
+            if (removingNode) {
+                printf("Do you really want to remove '%s' and its content? (y/n)\n", nodeName);
+                char* answer = getString();
+                if (strcmp(answer, "y") == 0) {
+                    // Remove from memory
+                    enum nodeType removingType = removingNode->type;
+                    uint64_t removingId = removingType == Folder ? removingNode->dir->mirrorId : 0;
+                    journalRemove(removingNode);
+                    removeNode(removingNode);
+                    freeNode(removingNode);
+
+                    if (mirrorEnabled && removingType != Symlink) {
+                        // Queue the removal from the real filesystem (folders go recursively)
+                        uint64_t folderId = mirrorFolderId(currentFolder);
+                        if (folderId) {
+                            mirrorSubmit(removingType == Folder ? MirrorRemoveDir : MirrorRemoveFile,
+                                         folderId, nodeName, NULL, removingId);
+                        }
+                    }
+                }
+                free(answer);
+            } else {
+                printf("Node '%s' not found.\n", nodeName);
+            }
+        }
+    }
+}
+
+
+void moveNode(node *movingNode, node *destinationFolder) {
+    linkChild(destinationFolder, movingNode);
+}
+
+void mov(node *currentFolder, char *command) {
+
+    char* movingName;
+    char* destinationName;
+
+    if (strtok(command, " ") != NULL) {
+        movingName = strtok(NULL, " ");
+        if (movingName != NULL) {
+            destinationName = strtok(NULL, " ");
+            if (destinationName != NULL) {
+                if (strtok(NULL, " ")) {
+                    return;
+                } else {
+
+                    node* movingNode = getNodeTypeless(currentFolder, movingName);
+                    node* destinationFolder = getNode(currentFolder, destinationName, Folder);
+
+                    if (destinationFolder != NULL && movingNode != NULL && destinationFolder != movingNode) {
+
+                        if (getNodeTypeless(destinationFolder, nodeName(movingNode)) != NULL) {
+                            fprintf(stderr, "'%s' already exists in '%s'!\n", nodeName(movingNode), nodeName(destinationFolder));
+                            return;
+                        }
+                        journalMove(movingNode, destinationFolder, NULL);
+                        removeNode(movingNode);
+                        moveNode(movingNode, destinationFolder);
+                    } else {
+                        fprintf(stderr, "Something you made wrong!\n");
+                    }
+                }
+            }
+        }
+    }
+}
+
+void sortDirectory(node* folder, const char* criterion) {
+    if (!folder) return;
+    enum orderKind kind;
+    if (strcmp(criterion, "name") == 0) {
+        kind = OrderByName;
+    } else if (strcmp(criterion, "date") == 0) {
+        kind = OrderByDate;
+    } else {
+        printf("Error: Unknown sort criterion '%s'. Use name or date.\n", criterion);
+        return;
+    }
+
+    journalSort(folder, kind);
+    sortChildren(folder, kind);
+    printf("Directory sorted by %s.\n", criterion);
+}
+
+// Relink the child list in one of the standing orders; O(n), nothing is sorted
+void sortChildren(node* folder, enum orderKind kind) {
+    materialize(folder);
+    preserveNode(folder);
+    markDirty(folder);
+    orderCursor cursor = orderSeek(folder, kind, NULL, 0);
+    node* previous = NULL;
+    for (node* current = orderNext(&cursor); current; current = orderNext(&cursor)) {
+        current->previousRef = previous ? previous->self : 0;
+        if (previous) previous->nextRef = current->self;
+        else folder->dir->child = current->self;
+        previous = current;
+    }
+    if (previous) previous->nextRef = 0;
+    folder->dir->lastChild = previous ? previous->self : 0;
+}
+
+// Function to merge two directories, resolving any conflicts interactively
+void mergeDirectories(node* destFolder, node* srcFolder) {
+    if (!destFolder || !srcFolder || srcFolder->type != Folder || destFolder->type != Folder) return;
+    materialize(srcFolder);
+
+    node* current = nodeChild(srcFolder);
+    while (current) {
+        node* next = nodeNext(current);
+        int choice = 0;
+        // Check for conflicts (same name)
+        node* existing = getNodeTypeless(destFolder, nodeName(current));
+        if (existing) {
+            printf("Conflict detected: %s already exists. Choose an option:\n", nodeName(current));
+            printf("1. Skip\n2. Rename\n3. Overwrite\n");
+            
+            // Declare and initialize the choice variable
+            if (fscanf(inputStream, "%d", &choice) != 1) choice = 0;
+            fgetc(inputStream); // Consume the newline character
+
+            if (choice == 1) {
+                // Skip the conflicting file/folder
+                printf("Skipping %s\n", nodeName(current));
+            } else if (choice == 2) {
+                // Rename the new file/folder
+                char newName[256];
+                printf("Enter a new name for %s: ", nodeName(current));
+                if (!fgets(newName, sizeof(newName), inputStream)) newName[0] = '\0';
+                newName[strcspn(newName, "\n")] = '\0'; // Remove newline
+                if (getNodeTypeless(destFolder, newName) != NULL) {
+                    printf("'%s' also exists. Skipping %s.\n", newName, nodeName(current));
+                    current = next;
+                    continue;
+                }
+                // Unlink before renaming so the node leaves the source index
+                // under the name it was hashed with. The journal records the
+                // rename and the move together, as the new name may be taken
+                // in the source folder
+                journalMove(current, destFolder, newName);
+                removeNode(current);
+                renameChild(current, newName);
+                printf("Renamed to %s\n", nodeName(current));
+            } else if (choice == 3) {
+                // Overwrite the existing file/folder
+                printf("Overwriting %s\n", nodeName(current));
+                journalRemove(existing);
+                removeNode(existing); // Remove the existing node
+                freeNode(existing);
+            } else {
+                // Handle invalid input
+                printf("Invalid choice. Skipping %s.\n", nodeName(current));
+                return;
+            }
+        }
+
+        // Move the current node to the destination folder
+        if (!existing || choice == 2 || choice == 3) {
+            if (nodeParent(current) == srcFolder) {
+                journalMove(current, destFolder, NULL);
+                removeNode(current);
+            }
+            moveNode(current, destFolder);
+        }
+        current = next;
+    }
+    printf("Directories merged.\n");
+}
+
+// Handle symbolic links
+int createSymlink(node* currentFolder, char* sourcePath, char* linkName, node* root) {
+    // Use parsePath to find the source node
+    node* sourceNode = parsePath(currentFolder, sourcePath, root);
+    if (sourceNode == NULL) {
+        printf("Error: Source '%s' not found.\n", sourcePath);
+        return -1;
+    }
+
+    // Check if a node with the linkName already exists in the current folder
+    node* existingNode = getNodeTypeless(currentFolder, linkName); // Use getNodeTypeless
+    if (existingNode != NULL) {
+        printf("Error: A node with the name '%s' already exists.\n", linkName);
+        return -1;
+    }
+
+    // Create the new symlink node
+    node* newLink = createNode(Symlink, linkName);
+    if (!newLink) {
+        printf("Error: Memory allocation failed.\n");
+        return -1;
+    }
+    newLink->symlinkTarget = arenaStrdup(activeArena, sourcePath); // Store the target path as a string
+
+    // Add the new symlink to the current folder's child list
+    linkChild(currentFolder, newLink);
+    journalCreate(newLink);
+
+    printf("Symbolic link '%s' -> '%s' created.\n", linkName, sourcePath);
+    return 0;
+}
+
+// Import of a host directory tree. Host directories are scanned on a thread
+// pool (readdir, which fetches entries with getdents64 in large batches,
+// plus fstatat per entry), each into a list of entries. The arena is not
+// thread-safe, so the command thread then turns the lists into nodes. Names
+// within one host directory are unique, so the nodes are attached in bulk
+// into a pre-sized name index, without a duplicate check per insert, and
+// the subtree totals are summed bottom-up and propagated once.
+typedef struct importEntry {
+    char* name;
+    enum nodeType type;
+    size_t size;
+    time_t date;
+    char* content;           // Files, with -c only
+    size_t contentLength;
+    char* symlinkTarget;
+    struct importDirectory* directory; // Folders: their own scan
+} importEntry;
+
+typedef struct importDirectory {
+    char* path;              // Host path, dropped once scanned
+    importEntry* entries;
+    size_t count;
+    size_t capacity;
+    struct importDirectory* nextTask; // Stack of directories waiting for a scan
+} importDirectory;
+
+typedef struct importJob {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    importDirectory* tasks;
+    size_t pending;          // Directories queued or being scanned
+    int withContent;
+    atomic_ullong errors;
+} importJob;
+
+importDirectory* importNewDirectory(const char* parentPath, const char* name) {
+    importDirectory* directory = calloc(1, sizeof(importDirectory));
+    if (!directory) return NULL;
+    size_t length = strlen(parentPath) + 1 + strlen(name) + 1;
+    directory->path = malloc(length);
+    if (!directory->path) {
+        free(directory);
+        return NULL;
+    }
+    snprintf(directory->path, length, "%s/%s", parentPath, name);
+    return directory;
+}
+
+void importError(importJob* job, const char* path, const char* name) {
+    fprintf(stderr, "Error: Could not import '%s%s%s': %s\n", path, name ? "/" : "", name ? name : "", strerror(errno));
+    atomic_fetch_add(&job->errors, 1);
+}
+
+// Read a whole host file next to its directory fd
+char* importReadFile(int directoryFd, const char* name, size_t size, size_t* length) {
+    int fd = openat(directoryFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    char* data = malloc(size + 1);
+    size_t done = 0;
+    while (data && done < size) {
+        ssize_t got = pread(fd, data + done, size - done, (off_t)done);
+        if (got < 0) {
+            free(data);
+            data = NULL;
+        } else if (got == 0) {
+            break; // The file shrank since fstatat
+        } else {
+            done += (size_t)got;
+        }
+    }
+    close(fd);
+    if (data) data[done] = '\0';
+    *length = done;
+    return data;
+}
+
+// Scan one host directory; returns the subdirectories found, chained as tasks
+importDirectory* importScan(importJob* job, importDirectory* directory) {
+    importDirectory* found = NULL;
+    int fd = open(directory->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR* stream = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!stream) {
+        importError(job, directory->path, NULL);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    struct dirent* item;
+    while ((item = readdir(stream)) != NULL) {
+        const char* name = item->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        struct stat info;
+        if (fstatat(dirfd(stream), name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+            importError(job, directory->path, name);
+            continue;
+        }
+        if (!S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode) && !S_ISLNK(info.st_mode)) continue;
+
+        if (directory->count == directory->capacity) {
+            size_t capacity = directory->capacity ? directory->capacity * 2 : 16;
+            importEntry* entries = realloc(directory->entries, capacity * sizeof(importEntry));
+            if (!entries) {
+                importError(job, directory->path, name);
+                break;
+            }
+            directory->entries = entries;
+            directory->capacity = capacity;
+        }
+        importEntry* entry = &directory->entries[directory->count];
+        memset(entry, 0, sizeof(*entry));
+        entry->name = strdup(name);
+        if (!entry->name) {
+            importError(job, directory->path, name);
+            continue;
+        }
+        entry->date = info.st_mtime;
+
+        if (S_ISDIR(info.st_mode)) {
+            entry->type = Folder;
+            entry->directory = importNewDirectory(directory->path, name);
+            if (!entry->directory) {
+                importError(job, directory->path, name);
+                free(entry->name);
+                continue;
+            }
+            entry->directory->nextTask = found;
+            found = entry->directory;
+        } else if (S_ISLNK(info.st_mode)) {
+            entry->type = Symlink;
+            char target[MAX_PATH_LENGTH];
+            ssize_t length = readlinkat(dirfd(stream), name, target, sizeof(target) - 1);
+            if (length < 0) {
+                importError(job, directory->path, name);
+                free(entry->name);
+                continue;
+            }
+            target[length] = '\0';
+            entry->symlinkTarget = strdup(target);
+        } else {
+            entry->type = File;
+            entry->size = (size_t)info.st_size;
+            if (job->withContent) {
+                entry->content = importReadFile(dirfd(stream), name, entry->size, &entry->contentLength);
+                if (!entry->content) importError(job, directory->path, name);
+                else entry->size = entry->contentLength;
+            }
+        }
+        directory->count++;
+    }
+    closedir(stream);
+    return found;
+}
+
+void* importWorker(void* argument) {
+    importJob* job = argument;
+    pthread_mutex_lock(&job->lock);
+    while (1) {
+        while (!job->tasks && job->pending > 0) pthread_cond_wait(&job->wake, &job->lock);
+        if (!job->tasks) break; // Nothing queued and nobody scanning
+
+        importDirectory* directory = job->tasks;
+        job->tasks = directory->nextTask;
+        pthread_mutex_unlock(&job->lock);
+
+        importDirectory* found = importScan(job, directory);
+        free(directory->path);
+        directory->path = NULL;
+
+        pthread_mutex_lock(&job->lock);
+        while (found) {
+            importDirectory* next = found->nextTask;
+            found->nextTask = job->tasks;
+            job->tasks = found;
+            job->pending++;
+            found = next;
+        }
+        job->pending--;
+        pthread_cond_broadcast(&job->wake);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// Turn a scanned directory into children of folder, freeing the scan as it goes
+void importBuild(importDirectory* directory, node* folder) {
+    if (directory->count > folder->dir->indexCapacity) {
+        size_t capacity = 8;
+        while (capacity < directory->count) capacity *= 2;
+        resizeIndex(folder, capacity);
+    }
+
+    for (size_t i = 0; i < directory->count; i++) {
+        importEntry* entry = &directory->entries[i];
+        node* child = createNode(entry->type, entry->name);
+        if (child) {
+            child->date = entry->date;
+            child->size = entry->type == File ? entry->size : 0;
+            if (entry->content) child->content = contentIntern(entry->content, entry->contentLength);
+            if (entry->symlinkTarget) child->symlinkTarget = arenaStrdup(activeArena, entry->symlinkTarget);
+            if (entry->directory) importBuild(entry->directory, child);
+            attachChild(folder, child);
+            subtreeStats stats = nodeStats(child);
+            addStats(&folder->dir->stats, &stats);
+        } else if (entry->directory) {
+            importBuild(entry->directory, NULL);
+        }
+        free(entry->name);
+        free(entry->content);
+        free(entry->symlinkTarget);
+    }
+    free(directory->entries);
+    free(directory);
+}
+
+// import <hostdir> [-c] [-t threads]: copy a host tree into a new folder named after it
+int importHostTree(node* currentFolder, char* command) {
+    char* words[8];
+    int count = findSplitArguments(command, words, 8);
+    const char* hostPath = NULL;
+    int threads = walkDefaultThreads();
+    int withContent = 0;
+
+    for (int i = 1; i < count; i++) {
+        if (strcmp(words[i], "-c") == 0) {
+            withContent = 1;
+        } else if (strcmp(words[i], "-t") == 0 && i + 1 < count) {
+            threads = atoi(words[++i]);
+            if (threads < 1 || threads > WALK_MAX_THREADS) {
+                printf("Error: Thread count must be between 1 and %d.\n", WALK_MAX_THREADS);
+                return -1;
+            }
+        } else if (words[i][0] != '-' && !hostPath) {
+            hostPath = words[i];
+        } else {
+            hostPath = NULL;
+            break;
+        }
+    }
+    if (!hostPath) {
+        printf("Error: Usage: import <hostdir> [-c] [-t threads]\n");
+        return -1;
+    }
+
+    // The new folder is named after the last component of the host path
+    size_t end = strlen(hostPath);
+    while (end > 1 && hostPath[end - 1] == '/') end--;
+    size_t begin = end;
+    while (begin > 0 && hostPath[begin - 1] != '/') begin--;
+    char name[256];
+    if (end - begin == 0 || end - begin >= sizeof(name)) {
+        printf("Error: Cannot name a folder after '%s'.\n", hostPath);
+        return -1;
+    }
+    memcpy(name, hostPath + begin, end - begin);
+    name[end - begin] = '\0';
+    if (getNodeTypeless(currentFolder, name) != NULL) {
+        printf("Error: '%s' already exists in the current directory.\n", name);
+        return -1;
+    }
+
+    struct stat info;
+    if (stat(hostPath, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        printf("Error: '%s' is not a host directory.\n", hostPath);
+        return -1;
+    }
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    importDirectory* top = calloc(1, sizeof(importDirectory));
+    if (top) top->path = strdup(hostPath);
+    if (!top || !top->path) {
+        free(top);
+        printf("Error: Memory allocation failed.\n");
+        return -1;
+    }
+    importJob job = {.tasks = top, .pending = 1, .withContent = withContent};
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.wake, NULL);
+    atomic_init(&job.errors, 0);
+
+    // The calling thread scans too
+    pthread_t handles[WALK_MAX_THREADS];
+    int started = 1;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&handles[i], NULL, importWorker, &job) != 0) break;
+        started++;
+    }
+    importWorker(&job);
+    for (int i = 1; i < started; i++) pthread_join(handles[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.wake);
+
+    node* folder = createNode(Folder, name);
+    if (!folder) {
+        importBuild(top, NULL);
+        printf("Error: Memory allocation failed.\n");
+        return -1;
+    }
+    folder->date = info.st_mtime;
+    importBuild(top, folder);
+    linkChild(currentFolder, folder); // The only link that walks up the ancestors
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    printf("Imported '%s': %llu files, %llu folders, %llu symlinks, %llu bytes (%d threads, %.3f s",
+           name, (unsigned long long)nodeStats(folder).files, (unsigned long long)nodeStats(folder).folders,
+           (unsigned long long)nodeStats(folder).symlinks, (unsigned long long)nodeStats(folder).bytes, started,
+           elapsedSeconds(&start, &finish));
+    unsigned long long errors = atomic_load(&job.errors);
+    if (errors) printf(", %llu entries skipped", errors);
+    printf(").\n");
+    return 0;
+}
+
+// Parallel gzip pipeline used by compress (pigz style). The serialized
+// snapshot is cut into blocks that worker threads deflate independently;
+// every block but the last ends on a sync flush, so the concatenated raw
+// deflate data forms a single stream that plain gunzip can read. Only a
+// bounded window of blocks is in flight, so memory stays flat however big
+// the tree is.
+#define GZIP_DEFAULT_LEVEL 6
+#define GZIP_DEFAULT_BLOCK (128 * 1024)
+#define GZIP_MAX_THREADS 64
+#define GZIP_MAX_RATIO 1032 // Deflate never expands a stream by more than this
+
+typedef struct gzipBlock {
+    unsigned char* input;
+    size_t inputLength;
+    unsigned char* output;
+    size_t outputLength;
+    uLong crc;               // CRC-32 of the block's input
+    int last;                // Finish the deflate stream after this block
+    int done;
+    int failed;
+    struct gzipBlock* nextJob;
+} gzipBlock;
+
+typedef struct gzipWriter {
+    FILE* file;
+    int level;
+    size_t blockSize;
+    pthread_t workers[GZIP_MAX_THREADS];
+    int workerCount;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t jobDone;
+    gzipBlock* queueHead;    // Blocks waiting for a worker
+    gzipBlock* queueTail;
+    int stopping;
+    gzipBlock** window;      // Blocks in flight, oldest first, written out in order
+    size_t windowCapacity;
+    size_t windowStart;
+    size_t windowCount;
+    gzipBlock* filling;      // Block currently receiving input
+    uLong crc;
+    uint64_t totalIn;
+    uint64_t totalOut;
+    int failed;
+} gzipWriter;
+
+void deflateBlock(gzipWriter* writer, gzipBlock* block) {
+    block->crc = crc32(0L, block->input, (uInt)block->inputLength);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, writer->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        block->failed = 1;
+        return;
+    }
+    size_t capacity = deflateBound(&stream, block->inputLength) + 16; // Room for the sync flush marker
+    block->output = malloc(capacity);
+    if (!block->output) {
+        deflateEnd(&stream);
+        block->failed = 1;
+        return;
+    }
+
+    stream.next_in = block->input;
+    stream.avail_in = (uInt)block->inputLength;
+    stream.next_out = block->output;
+    stream.avail_out = (uInt)capacity;
+    int result = deflate(&stream, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((block->last && result != Z_STREAM_END) || (!block->last && result != Z_OK) || stream.avail_in != 0) {
+        block->failed = 1;
+    }
+    block->outputLength = capacity - stream.avail_out;
+    deflateEnd(&stream);
+}
+
+void* gzipWorker(void* argument) {
+    gzipWriter* writer = argument;
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (!writer->queueHead && !writer->stopping) {
+            pthread_cond_wait(&writer->jobReady, &writer->lock);
+        }
+        if (!writer->queueHead) break;
+
+        gzipBlock* block = writer->queueHead;
+        writer->queueHead = block->nextJob;
+        if (!writer->queueHead) writer->queueTail = NULL;
+        pthread_mutex_unlock(&writer->lock);
+
+        deflateBlock(writer, block);
+
+        pthread_mutex_lock(&writer->lock);
+        block->done = 1;
+        pthread_cond_broadcast(&writer->jobDone);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+void freeGzipBlock(gzipBlock* block) {
+    free(block->input);
+    free(block->output);
+    free(block);
+}
+
+// Wait for the oldest block in flight and append it to the file
+void gzipRetireOldest(gzipWriter* writer) {
+    gzipBlock* block = writer->window[writer->windowStart];
+    pthread_mutex_lock(&writer->lock);
+    while (!block->done) {
+        pthread_cond_wait(&writer->jobDone, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    if (block->failed || fwrite(block->output, 1, block->outputLength, writer->file) != block->outputLength) {
+        writer->failed = 1;
+    }
+    writer->crc = crc32_combine(writer->crc, block->crc, (z_off_t)block->inputLength);
+    writer->totalIn += block->inputLength;
+    writer->totalOut += block->outputLength;
+
+    writer->windowStart = (writer->windowStart + 1) % writer->windowCapacity;
+    writer->windowCount--;
+    freeGzipBlock(block);
+}
+
+// Hand the filled block to the workers and start a new one
+void gzipSubmit(gzipWriter* writer, int last) {
+    gzipBlock* block = writer->filling;
+    block->last = last;
+    writer->filling = NULL;
+
+    if (writer->windowCount == writer->windowCapacity) {
+        gzipRetireOldest(writer);
+    }
+    writer->window[(writer->windowStart + writer->windowCount) % writer->windowCapacity] = block;
+    writer->windowCount++;
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->queueTail) writer->queueTail->nextJob = block;
+    else writer->queueHead = block;
+    writer->queueTail = block;
+    pthread_cond_signal(&writer->jobReady);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+gzipBlock* newGzipBlock(size_t blockSize) {
+    gzipBlock* block = calloc(1, sizeof(gzipBlock));
+    if (!block) return NULL;
+    block->input = malloc(blockSize);
+    if (!block->input) {
+        free(block);
+        return NULL;
+    }
+    return block;
+}
+
+// snapshotSink callback: copy into the current block, submitting full ones
+int gzipWrite(void* context, const void* data, size_t length) {
+    gzipWriter* writer = context;
+    const unsigned char* bytes = data;
+    while (length > 0 && !writer->failed) {
+        if (!writer->filling) {
+            writer->filling = newGzipBlock(writer->blockSize);
+            if (!writer->filling) {
+                writer->failed = 1;
+                break;
+            }
+        }
+        gzipBlock* block = writer->filling;
+        size_t room = writer->blockSize - block->inputLength;
+        size_t chunk = length < room ? length : room;
+        memcpy(block->input + block->inputLength, bytes, chunk);
+        block->inputLength += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (block->inputLength == writer->blockSize) {
+            gzipSubmit(writer, 0);
+        }
+    }
+    return writer->failed ? -1 : 0;
+}
+
+void stopGzipWorkers(gzipWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    pthread_cond_broadcast(&writer->jobReady);
+    pthread_mutex_unlock(&writer->lock);
+    for (int i = 0; i < writer->workerCount; i++) {
+        pthread_join(writer->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->jobReady);
+    pthread_cond_destroy(&writer->jobDone);
+}
+
+gzipWriter* gzipWriterOpen(const char* filename, int level, size_t blockSize, int threads) {
+    gzipWriter* writer = calloc(1, sizeof(gzipWriter));
+    if (!writer) return NULL;
+
+    writer->file = fopen(filename, "wb");
+    writer->windowCapacity = (size_t)threads * 2;
+    writer->window = malloc(writer->windowCapacity * sizeof(gzipBlock*));
+    if (!writer->file || !writer->window) {
+        if (writer->file) fclose(writer->file);
+        free(writer->window);
+        free(writer);
+        return NULL;
+    }
+    writer->level = level;
+    writer->blockSize = blockSize;
+    writer->crc = crc32(0L, Z_NULL, 0);
+
+    // Minimal gzip member header: no name, no mtime, OS = Unix
+    static const unsigned char gzipHeader[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    fwrite(gzipHeader, 1, sizeof(gzipHeader), writer->file);
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->jobReady, NULL);
+    pthread_cond_init(&writer->jobDone, NULL);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&writer->workers[i], NULL, gzipWorker, writer) != 0) break;
+        writer->workerCount++;
+    }
+    if (writer->workerCount == 0) {
+        stopGzipWorkers(writer);
+        fclose(writer->file);
+        free(writer->window);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+// Flush the final block, drain the window and write the gzip trailer; 0 on success
+int gzipWriterClose(gzipWriter* writer) {
+    if (!writer->filling) writer->filling = newGzipBlock(writer->blockSize);
+    if (writer->filling) {
+        gzipSubmit(writer, 1); // The last block may be empty; it still ends the deflate stream
+    } else {
+        writer->failed = 1;
+    }
+    while (writer->windowCount > 0) {
+        gzipRetireOldest(writer);
+    }
+    stopGzipWorkers(writer);
+
+    unsigned char trailer[8];
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (unsigned char)(writer->crc >> (8 * i));
+        trailer[4 + i] = (unsigned char)(writer->totalIn >> (8 * i)); // ISIZE is the length mod 2^32
+    }
+    if (fwrite(trailer, 1, sizeof(trailer), writer->file) != sizeof(trailer)) writer->failed = 1;
+    if (fclose(writer->file) != 0) writer->failed = 1;
+
+    int failed = writer->failed;
+    free(writer->window);
+    free(writer);
+    return failed ? -1 : 0;
+}
+
+// Function to compress the entire directory structure into a gzip file
+void compressDirectory(node* folder, const char* filename, int level, size_t blockSize, int threads) {
+    if (!folder) return;
+
+    snapshotPlan plan = {0};
+    if (planSnapshot(&plan, folder) != 0) {
+        printf("Error: Out of memory while compressing to '%s'.\n", filename);
+        freePlan(&plan);
+        return;
+    }
+
+    gzipWriter* writer = gzipWriterOpen(filename, level, blockSize, threads);
+    if (!writer) {
+        printf("Error: Unable to create compressed file '%s'.\n", filename);
+        freePlan(&plan);
+        return;
+    }
+
+    snapshotSink sink = {gzipWrite, writer, 0};
+    int failed = writeSnapshot(&plan, folder, &sink) != 0;
+    if (gzipWriterClose(writer) != 0) failed = 1;
+    uint64_t nodeCount = plan.nodeCount;
+    freePlan(&plan);
+
+    struct stat info;
+    if (failed || stat(filename, &info) != 0) {
+        printf("Error: Could not write compressed file '%s'.\n", filename);
+        return;
+    }
+    printf("Directory compressed to '%s' (%llu nodes, %lld bytes, level %d, %zu KiB blocks, %d threads).\n",
+           filename, (unsigned long long)nodeCount, (long long)info.st_size, level, blockSize / 1024, threads);
+}
+
+size_t gzipSourceRead(void* context, void* data, size_t length) {
+    gzFile gz = context;
+    size_t total = 0;
+    while (total < length) {
+        size_t chunk = length - total > (1u << 30) ? (1u << 30) : length - total;
+        int got = gzread(gz, (char*)data + total, (unsigned)chunk);
+        if (got <= 0) break;
+        total += (size_t)got;
+    }
+    return total;
+}
+
+// Function to decompress a file and restore the directory structure into the active arena
+node* decompressDirectory(const char* filename) {
+    gzFile gz = gzopen(filename, "rb");
+    if (!gz) {
+        printf("Error: Unable to open compressed file '%s'.\n", filename);
+        return NULL;
+    }
+    gzbuffer(gz, 1 << 20);
+
+    struct stat info;
+    uint64_t limit = stat(filename, &info) == 0 ? (uint64_t)info.st_size : 0;
+    limit = limit > UINT64_MAX / GZIP_MAX_RATIO ? UINT64_MAX : limit * GZIP_MAX_RATIO;
+    snapshotSource source = {gzipSourceRead, gz, limit};
+    node* root = readSnapshot(&source, filename);
+    gzclose(gz);
+
+    if (root) printf("Directory decompressed from '%s'.\n", filename);
+    return root;
+}
+
+// Background saves (bgsave): the command thread forks, and the child writes
+// the snapshot from its copy-on-write image of the tree while the parent
+// keeps running commands; only pages the parent changes meanwhile get
+// copied. The child runs nothing but the serializer: the mirror worker and
+// the journal writer do not exist in it, so it never takes their locks, and
+// it leaves through _exit() so that no stdio buffer it inherited is flushed
+// twice. It writes a temporary file and renames it over the target, then
+// reports through a pipe; the parent collects the result between commands.
+typedef struct backgroundResult {
+    int32_t failed;
+    int32_t error;           // errno of the failure
+    double seconds;          // Spent by the child
+    uint64_t nodes;
+} backgroundResult;
+
+typedef struct backgroundSave {
+    pid_t pid;               // 0 while no save is running
+    int resultFd;            // Read end of the running child's result pipe
+    char* filename;
+    int binary;
+    struct timespec started;
+    double forkSeconds;      // The command thread's stall in fork()
+    int finished;            // A save has finished since startup
+    backgroundResult last;   // Result of the last finished save
+    char* lastFilename;
+    time_t lastFinished;
+    double lastForkSeconds;
+} backgroundSave;
+
+backgroundSave bgsaveState = {.resultFd = -1};
+
+// Child side: write the snapshot next to filename, then rename it into place
+backgroundResult backgroundWrite(node* root, const char* filename, int binary) {
+    backgroundResult result = {0};
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char temporary[MAX_PATH_LENGTH + 32];
+    snprintf(temporary, sizeof(temporary), "%s.bgsave-%ld", filename, (long)getpid());
+    if (binary) {
+        snapshotPlan plan = {0}; // Not freed: the child exits right after
+        result.failed = snapshotToFile(root, temporary, 1, &plan) != 0;
+        result.nodes = plan.nodeCount;
+    } else {
+        materializeTree(root);
+        FILE* file = fopen(temporary, "w");
+        result.failed = !file;
+        if (file) {
+            saveDirectoryToFile(root, file, 0);
+            fprintf(file, "\n");
+            if (fflush(file) != 0 || fsync(fileno(file)) != 0) result.failed = 1;
+            if (fclose(file) != 0) result.failed = 1;
+        }
+        result.nodes = nodeStats(root).files + nodeStats(root).folders + nodeStats(root).symlinks;
+    }
+    if (!result.failed && rename(temporary, filename) != 0) result.failed = 1;
+    if (result.failed) {
+        result.error = errno;
+        unlink(temporary);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    result.seconds = elapsedSeconds(&start, &finish);
+    return result;
+}
+
+void backgroundSaveStart(node* root, const char* filename, int binary) {
+    if (bgsaveState.pid) {
+        printf("Error: A background save to '%s' is already in progress (pid %ld).\n",
+               bgsaveState.filename, (long)bgsaveState.pid);
+        return;
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("Error: Could not start a background save: %s\n", strerror(errno));
+        return;
+    }
+
+    fflush(stdout); // Otherwise the child would inherit, and could repeat, buffered output
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO); // The parent reports the outcome
+        backgroundResult result = backgroundWrite(root, filename, binary);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(result.failed || written != (ssize_t)sizeof(result));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        printf("Error: Could not start a background save: %s\n", strerror(errno));
+        return;
+    }
+
+    bgsaveState.pid = pid;
+    bgsaveState.resultFd = fds[0];
+    bgsaveState.filename = strdup(filename);
+    bgsaveState.binary = binary;
+    bgsaveState.started = before;
+    bgsaveState.forkSeconds = elapsedSeconds(&before, &after);
+    printf("Background save to '%s' started (pid %ld, fork took %.3f ms).\n",
+           filename, (long)pid, bgsaveState.forkSeconds * 1e3);
+}
+
+// Collect a finished background save; with wait set, wait for a running one
+void backgroundSavePoll(int wait) {
+    if (!bgsaveState.pid) return;
+    int status = 0;
+    pid_t reaped = waitpid(bgsaveState.pid, &status, wait ? 0 : WNOHANG);
+    if (reaped == 0 || (reaped < 0 && errno == EINTR)) return;
+
+    backgroundResult result = {.failed = 1};
+    if (read(bgsaveState.resultFd, &result, sizeof(result)) != (ssize_t)sizeof(result)) {
+        result.failed = 1; // The child died before reporting
+        result.error = 0;
+    }
+    if (reaped < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) result.failed = 1;
+    close(bgsaveState.resultFd);
+
+    free(bgsaveState.lastFilename);
+    bgsaveState.lastFilename = bgsaveState.filename;
+    bgsaveState.filename = NULL;
+    bgsaveState.last = result;
+    bgsaveState.lastFinished = time(NULL);
+    bgsaveState.lastForkSeconds = bgsaveState.forkSeconds;
+    bgsaveState.finished = 1;
+    bgsaveState.pid = 0;
+    bgsaveState.resultFd = -1;
+
+    if (result.failed) {
+        printf("Background save to '%s' failed%s%s.\n", bgsaveState.lastFilename,
+               result.error ? ": " : "", result.error ? strerror(result.error) : "");
+    } else {
+        printf("Background save to '%s' done: %llu nodes in %.3f s.\n", bgsaveState.lastFilename,
+               (unsigned long long)result.nodes, result.seconds);
+    }
+}
+
+void lastSave(void) {
+    backgroundSavePoll(0);
+    if (bgsaveState.pid) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf("Background save to '%s' in progress for %.3f s (pid %ld).\n", bgsaveState.filename,
+               elapsedSeconds(&bgsaveState.started, &now), (long)bgsaveState.pid);
+    }
+    if (!bgsaveState.finished) {
+        printf("No background save has finished yet.\n");
+        return;
+    }
+
+    char finished[32];
+    strftime(finished, sizeof(finished), "%Y-%m-%d %H:%M:%S", localtime(&bgsaveState.lastFinished));
+    backgroundResult* last = &bgsaveState.last;
+    if (last->failed) {
+        printf("Last background save: '%s' failed at %s%s%s.\n", bgsaveState.lastFilename, finished,
+               last->error ? ": " : "", last->error ? strerror(last->error) : "");
+    } else {
+        printf("Last background save: '%s' succeeded at %s, %llu nodes in %.3f s (fork %.3f ms).\n",
+               bgsaveState.lastFilename, finished, (unsigned long long)last->nodes, last->seconds,
+               bgsaveState.lastForkSeconds * 1e3);
+    }
+}
+
+// In-memory snapshots: point-in-time views of the tree that share every
+// unchanged node with the live tree. Taking one is O(1): it records the root
+// and starts a new epoch. Nodes are versioned in place instead of copied
+// along the path to the root, which their parent pointers rule out: the
+// first change to a node that a snapshot saw keeps its former name, date,
+// size, content and child list in a version stamped with the epoch that
+// state began in, and a node that leaves the live tree is set aside as long
+// as a snapshot still shows it. A snapshot at epoch e sees, for each node,
+// the newest state that began at or before e.
+typedef struct nodeVersion {
+    uint32_t since;          // Epoch the state began in
+    int numberOfItems;
+    char* name;
+    size_t size;
+    time_t date;
+    fileContent* content;    // Held (contentHold) by the version
+    node** children;         // Folders: the child list, in order
+    struct nodeVersion* older;
+} nodeVersion;
+
+typedef struct nodeHistory {
+    nodeRef owner;           // Node the history belongs to
+    uint32_t born;           // Epoch the node was created in
+    uint32_t epoch;          // Epoch its current state began in
+    uint32_t died;           // Epoch it left the live tree in, 0 while it is in it
+    int tracked;             // Listed in treeSnapshots.tracked
+    nodeVersion* versions;   // Newest first
+    struct nodeHistory* hashNext;
+} nodeHistory;
+
+// Few nodes ever have a history, so histories live in a side table keyed by
+// node slot instead of in every node; the node's hasHistory bit says whether
+// to look
+nodeHistory* nodeHistoryOf(const node* item) {
+    if (!item->hasHistory) return NULL;
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    nodeHistory* history = snapshots->histories[item->self & (snapshots->historyBuckets - 1)];
+    while (history->owner != item->self) history = history->hashNext;
+    return history;
 }
 
-void removeNode(node *removingNode) {
-    if (removingNode->parent != NULL){
-        if (removingNode->next != NULL) {
-            removingNode->next->parent = removingNode->parent;
-            removingNode->parent->child = removingNode->next;
-            removingNode->next->previous = NULL;
-        } else {
-            removingNode->parent->child = NULL;
-        }
-    } else {
-        if (removingNode->next != NULL) {
-            removingNode->previous->next = removingNode->next;
-            removingNode->next->previous  = removingNode->previous;
-        } else {
-            removingNode->previous->next = NULL;
+int historyTableGrow(treeSnapshots* snapshots) {
+    size_t bucketCount = snapshots->historyBuckets ? snapshots->historyBuckets * 2 : 256;
+    nodeHistory** buckets = arenaAlloc(activeArena, bucketCount * sizeof(nodeHistory*));
+    if (!buckets) return -1;
+    memset(buckets, 0, bucketCount * sizeof(nodeHistory*));
+
+    for (size_t i = 0; i < snapshots->historyBuckets; i++) {
+        nodeHistory* history = snapshots->histories[i];
+        while (history) {
+            nodeHistory* next = history->hashNext;
+            nodeHistory** bucket = &buckets[history->owner & (bucketCount - 1)];
+            history->hashNext = *bucket;
+            *bucket = history;
+            history = next;
         }
     }
+    arenaRelease(activeArena, snapshots->histories, snapshots->historyBuckets * sizeof(nodeHistory*));
+    snapshots->histories = buckets;
+    snapshots->historyBuckets = bucketCount;
+    return 0;
 }
 
-void rm(node* currentFolder, char* command) {
-    if (strtok(command, " ") != NULL) {
-        char* nodeName = strtok(NULL, " ");
-        if (nodeName != NULL) {
-            node* removingNode = getNodeTypeless(currentFolder, nodeName);
-            if (removingNode) {
-                printf("Do you really want to remove '%s' and its content? (y/n)\n", nodeName);
-                char* answer = getString();
-                if (strcmp(answer, "y") == 0) {
-                    // Remove from memory
-                    currentFolder->numberOfItems--;
-                    removeNode(removingNode);
-                    freeNode(removingNode);
+// Give a node an empty history (born at epoch 0), NULL if out of memory
+nodeHistory* nodeHistoryAttach(node* item) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    if (snapshots->historyCount >= snapshots->historyBuckets && historyTableGrow(snapshots) != 0) return NULL;
+    nodeHistory* history = arenaAlloc(activeArena, sizeof(nodeHistory));
+    if (!history) return NULL;
+    memset(history, 0, sizeof(nodeHistory));
+    history->owner = item->self;
+    nodeHistory** bucket = &snapshots->histories[item->self & (snapshots->historyBuckets - 1)];
+    history->hashNext = *bucket;
+    *bucket = history;
+    snapshots->historyCount++;
+    item->hasHistory = 1;
+    return history;
+}
 
-                    // Remove from real filesystem
-                    char path[1024];
-                    snprintf(path, sizeof(path), "%s/%s", currentFolder->name, nodeName);
-                    if (removingNode->type == Folder) {
-                        if (rmdir(path) == 0) {
-                            printf("Folder '%s' removed from the real filesystem.\n", path);
-                        } else {
-                            perror("Error removing folder from the real filesystem");
-                        }
-                    } else if (removingNode->type == File) {
-                        if (remove(path) == 0) {
-                            printf("File '%s' removed from the real filesystem.\n", path);
-                        } else {
-                            perror("Error removing file from the real filesystem");
-                        }
-                    }
-                }
-                free(answer);
+// History of a new node. Nodes created while no snapshot exists go without:
+// every later snapshot sees them from the start, as if born at epoch 0
+void nodeHistoryCreate(node* item) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    if (snapshots->count == 0 || materializing) return;
+
+    nodeHistory* history = nodeHistoryAttach(item);
+    if (!history) return; // Treated as born at epoch 0, which only keeps it longer
+    history->born = history->epoch = snapshots->epoch;
+}
+
+void nodeVersionRelease(nodeVersion* version) {
+    arenaFreeString(activeArena, version->name);
+    contentDrop(version->content);
+    arenaRelease(activeArena, version->children, (size_t)version->numberOfItems * sizeof(node*));
+    arenaRelease(activeArena, version, sizeof(nodeVersion));
+    activeArena->snapshots.versions--;
+}
+
+void nodeHistoryRelease(node* item) {
+    if (!item->hasHistory) return;
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    nodeHistory** link = &snapshots->histories[item->self & (snapshots->historyBuckets - 1)];
+    while ((*link)->owner != item->self) link = &(*link)->hashNext;
+    nodeHistory* history = *link;
+    *link = history->hashNext;
+    snapshots->historyCount--;
+    item->hasHistory = 0;
+    while (history->versions) {
+        nodeVersion* older = history->versions->older;
+        nodeVersion* version = history->versions;
+        history->versions = older;
+        nodeVersionRelease(version);
+    }
+    arenaRelease(activeArena, history, sizeof(nodeHistory));
+}
+
+// Remember a node whose versions or retirement snapshotReclaim must revisit
+void snapshotTrack(node* item) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    nodeHistory* history = nodeHistoryOf(item);
+    if (history->tracked) return;
+    if (snapshots->trackedCount == snapshots->trackedCapacity) {
+        size_t capacity = snapshots->trackedCapacity ? snapshots->trackedCapacity * 2 : 64;
+        node** tracked = realloc(snapshots->tracked, capacity * sizeof(node*));
+        if (!tracked) return; // Then it is only reclaimed with the whole tree
+        snapshots->tracked = tracked;
+        snapshots->trackedCapacity = capacity;
+    }
+    snapshots->tracked[snapshots->trackedCount++] = item;
+    history->tracked = 1;
+}
+
+// Called by every mutator before it changes a node: if a snapshot saw the
+// node's current state, keep that state as a version first. Only the first
+// change after a snapshot pays; later ones find the state already newer
+void preserveNode(node* item) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    if (!item || snapshots->count == 0 || materializing) return;
+    nodeHistory* history = nodeHistoryOf(item);
+    if (history && history->epoch > snapshots->list[snapshots->count - 1].epoch) return; // Seen by none
+    if (!history && !(history = nodeHistoryAttach(item))) { // Born at epoch 0, see nodeHistoryCreate
+        printf("Error: Memory allocation failed; snapshots may show this change.\n");
+        return;
+    }
+
+    materialize(item); // The children the snapshot saw, before they change
+    int numberOfItems = item->type == Folder ? item->dir->numberOfItems : 0;
+    nodeVersion* version = arenaAlloc(activeArena, sizeof(nodeVersion));
+    char* name = version ? arenaStrdup(activeArena, nodeName(item)) : NULL;
+    node** children = NULL;
+    if (name && numberOfItems > 0) {
+        children = arenaAlloc(activeArena, (size_t)numberOfItems * sizeof(node*));
+    }
+    if (!version || !name || (numberOfItems > 0 && !children)) {
+        arenaFreeString(activeArena, name);
+        arenaRelease(activeArena, version, sizeof(nodeVersion));
+        printf("Error: Memory allocation failed; snapshots may show this change.\n");
+        return;
+    }
+
+    version->since = history->epoch;
+    version->numberOfItems = numberOfItems;
+    version->name = name;
+    version->size = item->size;
+    version->date = item->date;
+    version->content = item->type == File ? item->content : NULL;
+    contentHold(version->content);
+    version->children = children;
+    int position = 0;
+    for (node* child = nodeChild(item); child && position < numberOfItems; child = nodeNext(child)) {
+        children[position++] = child;
+    }
+    version->older = history->versions;
+    history->versions = version;
+    history->epoch = snapshots->epoch;
+    snapshots->versions++;
+    snapshotTrack(item);
+}
+
+// Called by freeNode: a node that a snapshot shows is set aside instead of
+// freed. Returns 1 if it was
+int snapshotRetire(node* item) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    if (snapshots->count == 0) return 0;
+    nodeHistory* history = nodeHistoryOf(item);
+    if (history && history->born > snapshots->list[snapshots->count - 1].epoch) return 0;
+    if (!history && !(history = nodeHistoryAttach(item))) return 1; // Kept until the whole tree goes
+    history->died = snapshots->epoch;
+    snapshots->retired++;
+    if (item->type == File && item->content) {
+        // No longer a file's content, only held for the snapshots
+        activeArena->contents.references--;
+        activeArena->contents.logicalBytes -= item->content->length;
+    }
+    snapshotTrack(item);
+    return 1;
+}
+
+// Whether a snapshot was taken at an epoch within [from, to]
+int snapshotSees(uint32_t from, uint32_t to) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    size_t low = 0, high = snapshots->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (snapshots->list[middle].epoch < from) low = middle + 1;
+        else high = middle;
+    }
+    return low < snapshots->count && snapshots->list[low].epoch <= to;
+}
+
+// Free the versions and set-aside nodes that no remaining snapshot shows
+void snapshotReclaim(void) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    size_t kept = 0;
+    for (size_t i = 0; i < snapshots->trackedCount; i++) {
+        node* item = snapshots->tracked[i];
+        nodeHistory* history = nodeHistoryOf(item);
+
+        // A version stands for the epochs from its own up to the next newer state's
+        uint32_t until = history->epoch - 1;
+        nodeVersion** link = &history->versions;
+        while (*link) {
+            nodeVersion* version = *link;
+            int seen = version->since <= until && snapshotSees(version->since, until);
+            until = version->since - 1;
+            if (seen) {
+                link = &version->older;
             } else {
-                printf("Node '%s' not found.\n", nodeName);
+                *link = version->older;
+                nodeVersionRelease(version);
+            }
+        }
+
+        if (history->died && !snapshotSees(history->born, history->died - 1)) {
+            snapshots->retired--;
+            if (item->type == File) {
+                contentDrop(item->content); // Held since snapshotRetire
+                item->content = NULL;
             }
+            releaseNode(item);
+            continue;
         }
+        if (!history->died && !history->versions) {
+            history->tracked = 0;
+            continue;
+        }
+        snapshots->tracked[kept++] = item;
     }
+    snapshots->trackedCount = kept;
 }
 
+treeSnapshot* snapshotFind(uint32_t id) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    for (size_t i = 0; i < snapshots->count; i++) {
+        if (snapshots->list[i].id == id) return &snapshots->list[i];
+    }
+    return NULL;
+}
 
-void moveNode(node *movingNode, node *destinationFolder) {
+// Snapshot the tree in O(1); returns its id, 0 on failure
+uint32_t snapshotTake(node* root) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    if (snapshots->count == snapshots->capacity) {
+        size_t capacity = snapshots->capacity ? snapshots->capacity * 2 : 8;
+        treeSnapshot* list = realloc(snapshots->list, capacity * sizeof(treeSnapshot));
+        if (!list) return 0;
+        snapshots->list = list;
+        snapshots->capacity = capacity;
+    }
+    treeSnapshot* snapshot = &snapshots->list[snapshots->count++];
+    snapshot->id = ++snapshots->nextId;
+    snapshot->epoch = snapshots->epoch++;
+    snapshot->root = root;
+    snapshot->taken = time(NULL);
+    snapshot->stats = nodeStats(root);
+    return snapshot->id;
+}
+
+void snapshotDrop(uint32_t id) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    treeSnapshot* snapshot = snapshotFind(id);
+    if (!snapshot) return;
+    size_t position = (size_t)(snapshot - snapshots->list);
+    memmove(snapshot, snapshot + 1, (snapshots->count - position - 1) * sizeof(treeSnapshot));
+    snapshots->count--;
+    snapshotReclaim();
+}
 
-    if (destinationFolder->child == NULL) {
-        destinationFolder->child = movingNode;
-        movingNode->previous = NULL;
-        movingNode->parent = destinationFolder;
-        movingNode->next = NULL;
+// A node as the snapshot taken at epoch saw it
+typedef struct nodeView {
+    node* item;
+    int numberOfItems;
+    const char* name;
+    size_t size;
+    time_t date;
+    fileContent* content;
+    node** children;         // The child list it had then, when versioned
+    int versioned;           // 0: unchanged since, the live node stands for it
+} nodeView;
+
+nodeView viewNode(node* item, uint32_t epoch) {
+    nodeView view = {item, 0, nodeName(item), item->size, item->date, item->type == File ? item->content : NULL, NULL, 0};
+    nodeHistory* history = nodeHistoryOf(item);
+    nodeVersion* version = NULL;
+    if (history && history->epoch > epoch) {
+        version = history->versions;
+        while (version && version->since > epoch) version = version->older;
+    }
+    if (version) {
+        view.numberOfItems = version->numberOfItems;
+        view.name = version->name;
+        view.size = version->size;
+        view.date = version->date;
+        view.content = version->content;
+        view.children = version->children; // NULL for a folder that was empty
+        view.versioned = 1;
     } else {
+        materialize(item); // Unchanged since it was loaded
+        view.numberOfItems = item->type == Folder ? item->dir->numberOfItems : 0;
+    }
+    return view;
+}
+
+// Child position of a folder view, given the one before it
+node* viewChild(const nodeView* view, int position, node* previous) {
+    if (view->versioned) return view->children[position];
+    return position == 0 ? nodeChild(view->item) : nodeNext(previous);
+}
+
+// Child of a folder view by name, NULL if it had none
+node* viewLookup(const nodeView* view, uint32_t epoch, const char* name) {
+    // Unchanged since, children's names included (renameChild preserves the folder): the live index
+    if (!view->versioned) return getNodeTypeless(view->item, (char*)name);
+    for (int i = 0; i < view->numberOfItems; i++) {
+        nodeView child = viewNode(view->children[i], epoch);
+        if (strcmp(child.name, name) == 0) return view->children[i];
+    }
+    return NULL;
+}
+
+// A live copy of a node's subtree as the snapshot taken at epoch saw it; file contents are shared
+node* snapshotCopy(node* item, uint32_t epoch) {
+    nodeView view = viewNode(item, epoch);
+    node* copy = createNode(item->type, view.name);
+    if (!copy) return NULL;
+    copy->date = view.date;
+    copy->size = view.size;
+    if (item->type == Symlink) {
+        copy->symlinkTarget = arenaStrdup(activeArena, item->symlinkTarget);
+    } else if (item->type == File) {
+        copy->content = view.content;
+        contentShare(view.content);
+    }
 
-        node *currentNode = destinationFolder->child;
-        while (currentNode->next != NULL) {
-            currentNode = currentNode->next;
+    node* child = NULL;
+    for (int i = 0; i < view.numberOfItems; i++) {
+        child = viewChild(&view, i, child);
+        node* childCopy = snapshotCopy(child, epoch);
+        if (!childCopy) {
+            freeNode(copy);
+            return NULL;
         }
+        attachChild(copy, childCopy);
+        subtreeStats stats = nodeStats(childCopy);
+        addStats(&copy->dir->stats, &stats);
+    }
+    return copy;
+}
+
+// ls line of a node as a snapshot saw it
+void viewEntry(node* item, uint32_t epoch, int indentCount, int recursive) {
+    nodeView view = viewNode(item, epoch);
+    lsLine(item->type, view.numberOfItems, view.size, view.date, view.name, indentCount, recursive);
+}
+
+void viewLs(node* folder, uint32_t epoch) {
+    nodeView view = viewNode(folder, epoch);
+    if (view.numberOfItems == 0) {
+        printf("___Empty____\n");
+        return;
+    }
 
-        currentNode->next = movingNode;
-        movingNode->previous = currentNode;
-        movingNode->parent = NULL;
-        movingNode->next = NULL;
+    listingBegin();
+    node* child = NULL;
+    for (int i = 0; i < view.numberOfItems; i++) {
+        child = viewChild(&view, i, child);
+        viewEntry(child, epoch, 0, 0);
     }
-    destinationFolder->numberOfItems++;
+    listingEnd();
 }
 
-void mov(node *currentFolder, char *command) {
+void viewLsRecursiveLines(node* folder, uint32_t epoch, int indentCount) {
+    nodeView view = viewNode(folder, epoch);
+    if (view.numberOfItems == 0) {
+        listingIndent(indentCount);
+        listingString("___Empty____\n");
+        return;
+    }
 
-    char* nodeName;
-    char* destinationName;
+    node* child = NULL;
+    for (int i = 0; i < view.numberOfItems; i++) {
+        child = viewChild(&view, i, child);
+        viewEntry(child, epoch, indentCount, 1);
+        if (child->type == Folder) viewLsRecursiveLines(child, epoch, indentCount + 1);
+    }
+}
 
-    if (strtok(command, " ") != NULL) {
-        nodeName = strtok(NULL, " ");
-        if (nodeName != NULL) {
-            destinationName = strtok(NULL, " ");
-            if (destinationName != NULL) {
-                if (strtok(NULL, " ")) {
-                    return;
-                } else {
+// Node at a path as a snapshot saw it, from the folders on a view's stack.
+// Like parsePath, symlinks along the way are not followed
+node* viewResolve(node** folders, size_t depth, uint32_t epoch, const char* path) {
+    char* names = strdup(path);
+    node** stack = malloc((depth + strlen(path) / 2 + 2) * sizeof(node*));
+    if (!names || !stack) {
+        free(names);
+        free(stack);
+        printf("Error: Memory allocation failed.\n");
+        return NULL;
+    }
+    if (path[0] == '/') depth = 1;
+    memcpy(stack, folders, depth * sizeof(node*));
+
+    node* current = stack[depth - 1];
+    char* saveptr;
+    for (char* name = strtok_r(names, "/", &saveptr); name; name = strtok_r(NULL, "/", &saveptr)) {
+        if (current != stack[depth - 1]) { // A file or symlink cannot have a path below it
+            current = NULL;
+        } else if (strcmp(name, ".") == 0) {
+            continue;
+        } else if (strcmp(name, "..") == 0) {
+            if (depth > 1) depth--;
+            current = stack[depth - 1];
+            continue;
+        } else {
+            nodeView folder = viewNode(current, epoch);
+            current = viewLookup(&folder, epoch, name);
+        }
+        if (!current) {
+            printf("Error: Directory or file '%s' not found.\n", name);
+            break;
+        }
+        if (current->type == Folder) stack[depth++] = current;
+    }
+    free(names);
+    free(stack);
+    return current;
+}
 
-                    node* movingNode = getNodeTypeless(currentFolder, nodeName);
-                    node* destinationFolder = getNode(currentFolder, destinationName, Folder);
+// echo inside a snapshot, following a symlink the way the live echo does
+void viewEcho(node** folders, size_t depth, uint32_t epoch, const char* fileName) {
+    nodeView view = viewNode(folders[depth - 1], epoch);
+    node* item = viewLookup(&view, epoch, fileName);
+    if (!item) {
+        printf("Error: File '%s' not found.\n", fileName);
+        return;
+    }
+    if (item->type == Symlink) {
+        printf("Following symlink '%s' -> '%s'\n", fileName, item->symlinkTarget);
+        item = viewResolve(folders, depth, epoch, item->symlinkTarget);
+        if (!item) {
+            printf("Error: Target of symlink '%s' not found.\n", fileName);
+            return;
+        }
+    }
+    if (item->type != File) {
+        printf("Error: '%s' is not a file.\n", fileName);
+        return;
+    }
 
-                    if (destinationFolder != NULL && movingNode != NULL && destinationFolder != movingNode) {
+    nodeView file = viewNode(item, epoch);
+    printf("Contents of '%s':\n", file.name);
+    if (file.content) {
+        contentPrint(file.content, stdout);
+        printf("\n");
+    }
+}
+
+// Make a copy of a snapshot's tree the live tree, setting the old live tree
+// aside as far as snapshots show it. Returns the new root, NULL on failure
+node* snapshotRollback(node* root, treeSnapshot* snapshot) {
+    node* copy = snapshotCopy(snapshot->root, snapshot->epoch);
+    if (!copy) return NULL;
+    pathCacheClear(); // Every cached node belongs to the old tree
+    freeNode(root);
+    return copy;
+}
+
+void snapshotList(void) {
+    treeSnapshots* snapshots = &activeArena->snapshots;
+    printf("Snapshots: %zu (%llu older node states and %llu removed nodes kept for them)\n", snapshots->count,
+           (unsigned long long)snapshots->versions, (unsigned long long)snapshots->retired);
+    for (size_t i = 0; i < snapshots->count; i++) {
+        treeSnapshot* snapshot = &snapshots->list[i];
+        char taken[32];
+        strftime(taken, sizeof(taken), "%Y-%m-%d %H:%M:%S", localtime(&snapshot->taken));
+        printf("@%u\t%s\t%llu files, %llu folders, %llu symlinks, %llu bytes\n", snapshot->id, taken,
+               (unsigned long long)snapshot->stats.files, (unsigned long long)snapshot->stats.folders,
+               (unsigned long long)snapshot->stats.symlinks, (unsigned long long)snapshot->stats.bytes);
+    }
+}
+
+void displayPrompt(const char* path) {
+    printf("┌──[%s%s%s]\n└─%s>%s ", BLUE, path, RESET, GREEN, RESET);
+}
+
+// [Not Working] 
+// // Function to enable raw mode for real-time input
+// void enableRawMode() {
+//     struct termios raw;
+//     tcgetattr(STDIN_FILENO, &raw);
+//     raw.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
+//     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+// }
+
+// // Function to restore the terminal to default mode
+// void disableRawMode() {
+//     struct termios raw;
+//     tcgetattr(STDIN_FILENO, &raw);
+//     raw.c_lflag |= (ICANON | ECHO); // Enable canonical mode and echo
+//     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+// }
+
+// // [Not Working] Function to read input in real-time with yellow color
+// char* getRealTimeInput() {
+//     enableRawMode();
+
+//     char* input = malloc(1024);
+//     size_t length = 0;
+
+//     printf("%s", YELLOW); // Set input color to yellow
+
+//     char c;
+//     while (read(STDIN_FILENO, &c, 1) == 1 && c != '\n') {
+//         if (c == 127) { // Handle backspace
+//             if (length > 0) {
+//                 length--;
+//                 printf("\b \b"); // Move cursor back and overwrite character
+//             }
+//         } else {
+//             input[length++] = c;
+//             printf("%c", c); // Print each character as it's typed
+//         }
+//     }
+
+//     input[length] = '\0'; // Null-terminate the input
+//     printf("%s\n", RESET); // Reset color and print newline
+
+//     disableRawMode();
+
+//     return input;
+// }
+
+void displayNode(node* item) {
+    if (item->type == File) {
+        printf("%s%s%s\n", YELLOW, nodeName(item), RESET);
+    } else if (item->type == Folder) {
+        printf("%s%s/%s\n", CYAN, nodeName(item), RESET);
+    } else if (item->type == Symlink) {
+        printf("%s%s@%s\n", BLUE, nodeName(item), RESET);
+    }
+}
+
+
+// State the command handlers share
+typedef struct shell {
+    node* root;
+    node* currentFolder;
+    char* path;                           // Virtual path shown in the prompt
+    char currentPath[MAX_PATH_LENGTH];    // Path to the real file system
+    int running;
+    uint32_t view;                        // Snapshot shown read-only after cd @<id>, 0 for the live tree
+    uint32_t viewEpoch;
+    node** viewFolders;                   // Folders from the snapshot's root down to the one shown
+    size_t viewDepth;
+    char* livePath;                       // The live tree's path while a snapshot is shown
+} shell;
+
+typedef void (*commandHandler)(shell* state, char* command);
+
+typedef struct shellCommand {
+    const char* name;
+    commandHandler handler;
+    commandHandler viewHandler;           // Runs instead while a snapshot is shown; NULL if not allowed there
+} shellCommand;
+
+void shellMkdir(shell* state, char* command) {
+    make_dir(state->currentFolder, command); // Pass the full path
+}
+
+void shellTouch(shell* state, char* command) {
+    touch(state->currentFolder, command, state->currentPath); // Pass the full path
+}
+
+void shellLs(shell* state, char* command) {
+    lsSorted(state->currentFolder, command);
+}
+
+void shellLsRecursive(shell* state, char* command) {
+    (void)command;
+    lsrecursive(state->currentFolder, 0);
+}
+
+void shellEdit(shell* state, char* command) {
+    edit(state->currentFolder, command);
+}
+
+void shellAppend(shell* state, char* command) {
+    append(state->currentFolder, command);
+}
+
+void shellWrite(shell* state, char* command) {
+    writeCommand(state->currentFolder, command);
+}
+
+void shellClear(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    clear(); // Call the clear function
+}
+
+void shellPwd(shell* state, char* command) {
+    (void)command;
+    pwd(state->path);
+}
+
+void shellCdup(shell* state, char* command) {
+    (void)command;
+    state->currentFolder = cdup(state->currentFolder, &state->path);
+}
+
+// Prompt path of a snapshot view, "@<id>:/folder/..."
+void viewUpdatePath(shell* state) {
+    size_t length = 32;
+    for (size_t i = 1; i < state->viewDepth; i++) {
+        length += strlen(viewNode(state->viewFolders[i], state->viewEpoch).name) + 1;
+    }
+    char* path = malloc(length);
+    if (!path) return;
+    size_t used = (size_t)snprintf(path, length, "@%u:", state->view);
+    for (size_t i = 1; i < state->viewDepth; i++) {
+        used += (size_t)snprintf(path + used, length - used, "/%s",
+                                 viewNode(state->viewFolders[i], state->viewEpoch).name);
+    }
+    if (state->viewDepth == 1) snprintf(path + used, length - used, "/");
+    free(state->path);
+    state->path = path;
+}
+
+void viewLeave(shell* state) {
+    if (!state->view) return;
+    state->view = 0;
+    state->viewDepth = 0;
+    free(state->viewFolders);
+    state->viewFolders = NULL;
+    free(state->path);
+    state->path = state->livePath;
+    state->livePath = NULL;
+}
+
+// Snapshot id as typed, with or without its '@'; 0 if it is none
+uint32_t parseSnapshotId(const char* text) {
+    if (!text) return 0;
+    if (*text == '@') text++;
+    char* end;
+    unsigned long id = strtoul(text, &end, 10);
+    return *text && *end == '\0' && id <= UINT32_MAX ? (uint32_t)id : 0;
+}
+
+// cd @<id> shows a snapshot read-only, cd @live goes back to the live tree
+void viewEnter(shell* state, const char* target) {
+    if (strcmp(target, "@live") == 0) {
+        viewLeave(state);
+        return;
+    }
+    treeSnapshot* snapshot = snapshotFind(parseSnapshotId(target));
+    if (!snapshot) {
+        printf("Error: No snapshot %s.\n", target);
+        return;
+    }
+    node** folders = malloc(sizeof(node*));
+    if (!folders) {
+        printf("Error: Memory allocation failed.\n");
+        return;
+    }
+    folders[0] = snapshot->root;
+    if (!state->view) {
+        state->livePath = state->path;
+        state->path = NULL;
+    }
+    free(state->viewFolders);
+    state->viewFolders = folders;
+    state->viewDepth = 1;
+    state->view = snapshot->id;
+    state->viewEpoch = snapshot->epoch;
+    viewUpdatePath(state);
+}
+
+// cd inside a snapshot: absolute or relative paths of folders, with . and ..
+void viewCd(shell* state, char* target) {
+    size_t capacity = state->viewDepth + strlen(target) / 2 + 2;
+    node** folders = malloc(capacity * sizeof(node*));
+    if (!folders) {
+        printf("Error: Memory allocation failed.\n");
+        return;
+    }
+    size_t depth = target[0] == '/' ? 1 : state->viewDepth;
+    memcpy(folders, state->viewFolders, depth * sizeof(node*));
+
+    char* saveptr;
+    for (char* name = strtok_r(target, "/", &saveptr); name; name = strtok_r(NULL, "/", &saveptr)) {
+        if (strcmp(name, ".") == 0) continue;
+        if (strcmp(name, "..") == 0) {
+            if (depth > 1) depth--;
+            continue;
+        }
+        nodeView folder = viewNode(folders[depth - 1], state->viewEpoch);
+        node* next = viewLookup(&folder, state->viewEpoch, name);
+        if (!next || next->type != Folder) {
+            fprintf(stderr, "There is no '%s' folder in the current directory!\n", name);
+            free(folders);
+            return;
+        }
+        folders[depth++] = next;
+    }
+    free(state->viewFolders);
+    state->viewFolders = folders;
+    state->viewDepth = depth;
+    viewUpdatePath(state);
+}
+
+void shellCd(shell* state, char* command) {
+    char* target = command + strcspn(command, " ");
+    target += strspn(target, " ");
+    if (*target == '@') {
+        viewEnter(state, strtok(target, " "));
+    } else if (state->view && *target) {
+        viewCd(state, strtok(target, " "));
+    } else if (state->view) {
+        printf("Error: No path provided.\n");
+    } else {
+        state->currentFolder = cd(state->currentFolder, command, &state->path, state->root);
+    }
+}
+
+void shellViewCdup(shell* state, char* command) {
+    (void)command;
+    if (state->viewDepth > 1) state->viewDepth--;
+    viewUpdatePath(state);
+}
+
+void shellViewLs(shell* state, char* command) {
+    (void)command;
+    viewLs(state->viewFolders[state->viewDepth - 1], state->viewEpoch);
+}
+
+void shellViewLsRecursive(shell* state, char* command) {
+    (void)command;
+    listingBegin();
+    viewLsRecursiveLines(state->viewFolders[state->viewDepth - 1], state->viewEpoch, 0);
+    listingEnd();
+}
+
+void shellViewEcho(shell* state, char* command) {
+    strtok(command, " ");
+    char* fileName = strtok(NULL, " ");
+    if (fileName) {
+        viewEcho(state->viewFolders, state->viewDepth, state->viewEpoch, fileName);
+    } else {
+        printf("Error: No file name provided. Usage: echo <fileName>\n");
+    }
+}
+
+void shellRm(shell* state, char* command) {
+    rm(state->currentFolder, command);
+}
+
+void shellMov(shell* state, char* command) {
+    mov(state->currentFolder, command);
+}
+
+void shellEcho(shell* state, char* command) {
+    strtok(command, " ");
+    char* fileName = strtok(NULL, " ");
+    if (fileName) {
+        echo(state->currentFolder, fileName, state->root);
+    } else {
+        printf("Error: No file name provided. Usage: echo <fileName>\n");
+    }
+}
 
-                        removeNode(movingNode);
-                        moveNode(movingNode, destinationFolder);
-                    } else {
-                        fprintf(stderr, "Something you made wrong!\n");
-                    }
-                }
+void shellCount(shell* state, char* command) {
+    node* currentFolder = state->currentFolder;
+
+    // count -w [-t threads]: recount by walking the subtree in parallel
+    strtok(command, " ");
+    char* option = strtok(NULL, " ");
+    if (option && strcmp(option, "-w") == 0) {
+        int threads = walkDefaultThreads();
+        option = strtok(NULL, " ");
+        if (option && strcmp(option, "-t") == 0) {
+            char* value = strtok(NULL, " ");
+            threads = value ? atoi(value) : 0;
+            if (threads < 1 || threads > WALK_MAX_THREADS) {
+                printf("Error: Thread count must be between 1 and %d.\n", WALK_MAX_THREADS);
+                return;
             }
+        } else if (option) {
+            printf("Error: Usage: count [-w [-t threads]]\n");
+            return;
         }
+        walkCountReport(currentFolder, threads);
+        return;
+    } else if (option) {
+        printf("Error: Usage: count [-w [-t threads]]\n");
+        return;
     }
+
+    int fileCount = countFiles(currentFolder);
+    int folderCount = countFolders(currentFolder);
+    printf("Files: %d\nFolders: %d\n", fileCount, folderCount);
+    printf("Symlinks: %llu\nBytes: %llu\n", (unsigned long long)nodeStats(currentFolder).symlinks,
+           (unsigned long long)nodeStats(currentFolder).bytes);
 }
 
-// Helper functions for comparing and swapping nodes (used for sorting)
-int compareNodesByName(const void* a, const void* b) {
-    node* nodeA = *(node**)a;
-    node* nodeB = *(node**)b;
-    return strcmp(nodeA->name, nodeB->name);
+void shellPathCache(shell* state, char* command) {
+    (void)state;
+    strtok(command, " ");
+    char* option = strtok(NULL, " ");
+    if (option == NULL) {
+        pathCacheReport();
+    } else if (strcmp(option, "clear") == 0) {
+        pathCacheClear();
+        printf("Path cache cleared.\n");
+    } else {
+        printf("Error: Usage: pathcache [clear]\n");
+    }
 }
 
-int compareNodesByDate(const void* a, const void* b) {
-    node* nodeA = *(node**)a;
-    node* nodeB = *(node**)b;
-    return difftime(nodeA->date, nodeB->date);
+void shellCountFiles(shell* state, char* command) {
+    (void)command;
+    printf("Total files: %d\n", countFiles(state->root));
 }
 
-void sortDirectory(node* folder, const char* criterion) {
-    if (!folder || folder->child == NULL) return;
+void shellCountFolders(shell* state, char* command) {
+    (void)command;
+    printf("Total folders: %d\n", countFolders(state->root));
+}
 
-    // Count the number of child nodes
-    int count = 0;
-    node* current = folder->child;
-    while (current) {
-        count++;
-        current = current->next;
+void shellSave(shell* state, char* command) {
+    strtok(command, " ");
+    char* filename = strtok(NULL, " ");
+    int binary = filename && strcmp(filename, "-b") == 0;
+    int segmented = filename && strcmp(filename, "-s") == 0;
+    if (binary || segmented) filename = strtok(NULL, " ");
+    if (filename && segmented) {
+        saveSegmented(state->root, filename);  // Append what changed since the last save into the same file
+    } else if (filename && binary) {
+        saveSnapshot(state->root, filename);   // Save the tree as a binary snapshot
+    } else if (filename) {
+        saveDirectory(state->root, filename);  // Save the entire directory tree to the specified file
+    } else {
+        printf("Error: No filename provided for saving.\n");
     }
+}
 
-    // Populate an array of child nodes
-    node** nodesArray = malloc(count * sizeof(node*));
-    current = folder->child;
-    for (int i = 0; i < count; i++) {
-        nodesArray[i] = current;
-        current = current->next;
+// bgsave [-b] <filename>: save like save (-b) without stopping the shell
+void shellBgsave(shell* state, char* command) {
+    strtok(command, " ");
+    char* filename = strtok(NULL, " ");
+    int binary = filename && strcmp(filename, "-b") == 0;
+    if (binary) filename = strtok(NULL, " ");
+    if (filename) {
+        backgroundSaveStart(state->root, filename, binary);
+    } else {
+        printf("Error: No filename provided for saving. Usage: bgsave [-b] <filename>\n");
     }
+}
 
-    // Sort the array based on the criterion
-    if (strcmp(criterion, "name") == 0) {
-        qsort(nodesArray, count, sizeof(node*), compareNodesByName);
-    } else if (strcmp(criterion, "date") == 0) {
-        qsort(nodesArray, count, sizeof(node*), compareNodesByDate);
-    }
+void shellLastsave(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    lastSave();
+}
 
-    // Re-link the sorted nodes back into the tree
-    folder->child = nodesArray[0];
-    folder->child->previous = NULL;
-    for (int i = 0; i < count - 1; i++) {
-        nodesArray[i]->next = nodesArray[i + 1];
-        nodesArray[i + 1]->previous = nodesArray[i];
+void shellSnapshot(shell* state, char* command) {
+    strtok(command, " ");
+    char* argument = strtok(NULL, " ");
+    if (!argument) {
+        uint32_t id = snapshotTake(state->root);
+        if (!id) {
+            printf("Error: Memory allocation failed.\n");
+            return;
+        }
+        printf("Snapshot @%u taken: %llu files, %llu folders.\n", id,
+               (unsigned long long)state->root->dir->stats.files, (unsigned long long)state->root->dir->stats.folders);
+    } else if (strcmp(argument, "drop") == 0) {
+        char* idText = strtok(NULL, " ");
+        uint32_t id = parseSnapshotId(idText);
+        if (!snapshotFind(id)) {
+            printf("Error: No snapshot %s.\n", idText ? idText : "given. Usage: snapshot drop <id>");
+        } else if (id == state->view) {
+            printf("Error: Snapshot @%u is shown; 'cd @live' first.\n", id);
+        } else {
+            snapshotDrop(id);
+            printf("Snapshot @%u dropped.\n", id);
+        }
+    } else {
+        printf("Error: Usage: snapshot [drop <id>]\n");
     }
-    nodesArray[count - 1]->next = NULL;
+}
 
-    free(nodesArray);
-    printf("Directory sorted by %s.\n", criterion);
+void shellSnapshots(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    snapshotList();
 }
 
-// Function to merge two directories, resolving any conflicts interactively
-void mergeDirectories(node* destFolder, node* srcFolder) {
-    if (!destFolder || !srcFolder || srcFolder->type != Folder || destFolder->type != Folder) return;
+void shellRollback(shell* state, char* command) {
+    strtok(command, " ");
+    char* idText = strtok(NULL, " ");
+    treeSnapshot* snapshot = snapshotFind(parseSnapshotId(idText));
+    if (!snapshot) {
+        printf("Error: No snapshot %s.\n", idText ? idText : "given. Usage: rollback <id>");
+        return;
+    }
 
-    node* current = srcFolder->child;
-    while (current) {
-        node* next = current->next;
-        int choice;
-        // Check for conflicts (same name)
-        node* existing = getNodeTypeless(destFolder, current->name);
-        if (existing) {
-            printf("Conflict detected: %s already exists. Choose an option:\n", current->name);
-            printf("1. Skip\n2. Rename\n3. Overwrite\n");
-            
-            // Declare and initialize the choice variable
-            scanf("%d", &choice);
-            getchar(); // Consume the newline character
+    node* root = snapshotRollback(state->root, snapshot);
+    if (!root) {
+        printf("Error: Memory allocation failed.\n");
+        return;
+    }
+    viewLeave(state);
+    state->root = root;
+    state->currentFolder = root;
+    free(state->path);
+    state->path = strdup("/");
+    journalReset(root); // The journal continues from the restored tree
+    printf("Rolled back to snapshot @%u: %llu files, %llu folders.\n", snapshot->id,
+           (unsigned long long)nodeStats(root).files, (unsigned long long)nodeStats(root).folders);
+}
 
-            if (choice == 1) {
-                // Skip the conflicting file/folder
-                printf("Skipping %s\n", current->name);
-            } else if (choice == 2) {
-                // Rename the new file/folder
-                char newName[256];
-                printf("Enter a new name for %s: ", current->name);
-                fgets(newName, sizeof(newName), stdin);
-                newName[strcspn(newName, "\n")] = '\0'; // Remove newline
-                free(current->name);
-                current->name = strdup(newName);
-                printf("Renamed to %s\n", current->name);
-            } else if (choice == 3) {
-                // Overwrite the existing file/folder
-                printf("Overwriting %s\n", current->name);
-                removeNode(existing); // Remove the existing node
-            } else {
-                // Handle invalid input
-                printf("Invalid choice. Skipping %s.\n", current->name);
-                return;
-            }
+// Make a freshly loaded tree current, dropping the old one
+void shellReplaceTree(shell* state, treeArena* previousArena, node* loadedRoot) {
+    pathCacheClear(); // Every cached node belongs to the old tree
+    arenaDestroy(previousArena); // Free the current directory tree in memory
+    state->root = loadedRoot;   // Replace with the loaded directory tree
+    state->currentFolder = loadedRoot; // Reset current folder to the root of the loaded tree
+    free(state->path);
+    state->path = strdup("/");  // Reset the path to the root
+    journalReset(loadedRoot);   // The journal continues from the new tree
+}
+
+void shellLoad(shell* state, char* command) {
+    strtok(command, " ");
+    char* filename = strtok(NULL, " ");
+    int binary = filename && strcmp(filename, "-b") == 0;
+    int mapped = filename && strcmp(filename, "-m") == 0;
+    int segmented = filename && strcmp(filename, "-s") == 0;
+    if (binary || mapped || segmented) filename = strtok(NULL, " ");
+    if (filename) {
+        // Build the loaded tree in a fresh arena so the old tree can be dropped in bulk
+        treeArena* previousArena = activeArena;
+        activeArena = arenaCreate();
+        node* loadedRoot = segmented ? loadSegmented(filename)  // Load a segmented snapshot
+                         : mapped ? loadSnapshotLazy(filename)  // Map a binary snapshot, build folders on demand
+                         : binary ? loadSnapshot(filename)      // Load a binary snapshot
+                                  : loadDirectory(filename);    // Load the directory tree from the specified file
+        if (!loadedRoot) {
+            arenaDestroy(activeArena);
+            activeArena = previousArena;
+        } else {
+            shellReplaceTree(state, previousArena, loadedRoot);
         }
+    } else {
+        printf("Error: No filename provided for loading.\n");
+    }
+}
 
-        // Move the current node to the destination folder
-        if (!existing || choice == 3) {
-            current->parent = destFolder;
-            if (destFolder->child == NULL) {
-                destFolder->child = current;
-                current->previous = NULL;
-            } else {
-                node* last = destFolder->child;
-                while (last->next) last = last->next;
-                last->next = current;
-                current->previous = last;
-            }
+void shellMerge(shell* state, char* command) {
+    strtok(command, " ");
+    char* srcName = strtok(NULL, " ");
+    char* destName = strtok(NULL, " ");
+    if (srcName && destName) {
+        node* srcFolder = getNode(state->currentFolder, srcName, Folder);
+        node* destFolder = getNode(state->currentFolder, destName, Folder);
+        if (srcFolder && destFolder) {
+            mergeDirectories(destFolder, srcFolder);
+        } else {
+            printf("Error: One or both directories not found.\n");
         }
-        current = next;
     }
-    printf("Directories merged.\n");
 }
 
-// Handle symbolic links
-int createSymlink(node* currentFolder, char* sourcePath, char* linkName, node* root) {
-    // Use parsePath to find the source node
-    node* sourceNode = parsePath(currentFolder, sourcePath, root);
-    if (sourceNode == NULL) {
-        printf("Error: Source '%s' not found.\n", sourcePath);
-        return -1;
+void shellSymlink(shell* state, char* command) {
+    strtok(command, " ");
+    char* sourcePath = strtok(NULL, " ");
+    char* linkName = strtok(NULL, " ");
+    if (sourcePath && linkName) {
+        createSymlink(state->currentFolder, sourcePath, linkName, state->root);
+    } else {
+        printf("Error: Invalid arguments. Usage: symlink <source> <linkName>\n");
     }
+}
 
-    // Check if a node with the linkName already exists in the current folder
-    node* existingNode = getNodeTypeless(currentFolder, linkName); // Use getNodeTypeless
-    if (existingNode != NULL) {
-        printf("Error: A node with the name '%s' already exists.\n", linkName);
-        return -1;
+void shellSortBy(shell* state, char* command) {
+    strtok(command, " ");
+    char* criterion = strtok(NULL, " ");
+    if (criterion && (strcmp(criterion, "name") == 0 || strcmp(criterion, "date") == 0)) {
+        sortDirectory(state->currentFolder, criterion);
+    } else {
+        printf("Error: Sort criterion must be 'name' or 'date'.\n");
     }
+}
 
-    // Create the new symlink node
-    node* newLink = malloc(sizeof(node));
-    if (!newLink) {
-        printf("Error: Memory allocation failed.\n");
-        return -1;
+void shellCompress(shell* state, char* command) {
+    int level = GZIP_DEFAULT_LEVEL;
+    size_t blockSize = GZIP_DEFAULT_BLOCK;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = processors > 0 ? (processors < GZIP_MAX_THREADS ? (int)processors : GZIP_MAX_THREADS) : 1;
+    char* filename = NULL;
+    int valid = 1;
+
+    // compress [-l level] [-s blockKiB] [-t threads] <filename>
+    strtok(command, " ");
+    char* token = strtok(NULL, " ");
+    while (token && valid) {
+        if (strcmp(token, "-l") == 0 || strcmp(token, "-s") == 0 || strcmp(token, "-t") == 0) {
+            char* value = strtok(NULL, " ");
+            long number = value ? strtol(value, NULL, 10) : -1;
+            if (token[1] == 'l' && number >= 0 && number <= 9) level = (int)number;
+            else if (token[1] == 's' && number >= 1 && number <= 65536) blockSize = (size_t)number * 1024;
+            else if (token[1] == 't' && number >= 1 && number <= GZIP_MAX_THREADS) threads = (int)number;
+            else valid = 0;
+        } else {
+            filename = token;
+        }
+        token = strtok(NULL, " ");
     }
 
-    newLink->type = Symlink;
-    newLink->name = strdup(linkName);
-    newLink->symlinkTarget = strdup(sourcePath); // Store the target path as a string
-    newLink->size = 0; // Size for symlinks can be 0 as it points to another node
-    newLink->date = time(NULL); // Set current time as the creation date
-    newLink->child = NULL;
-    newLink->next = NULL;
-    newLink->parent = currentFolder;
+    if (valid && filename) {
+        compressDirectory(state->root, filename, level, blockSize, threads);
+    } else {
+        printf("Error: Usage: compress [-l 0-9] [-s blockKiB] [-t threads] <filename>\n");
+    }
+}
 
-    // Add the new symlink to the current folder's child list
-    if (currentFolder->child == NULL) {
-        currentFolder->child = newLink;
+void shellDecompress(shell* state, char* command) {
+    strtok(command, " ");
+    char* filename = strtok(NULL, " ");
+    if (filename) {
+        // Like load: build in a fresh arena and drop the old tree only on success
+        treeArena* previousArena = activeArena;
+        activeArena = arenaCreate();
+        node* decompressedRoot = decompressDirectory(filename);
+        if (!decompressedRoot) {
+            arenaDestroy(activeArena);
+            activeArena = previousArena;
+        } else {
+            shellReplaceTree(state, previousArena, decompressedRoot);
+        }
     } else {
-        node* lastChild = currentFolder->child;
-        while (lastChild->next != NULL) {
-            lastChild = lastChild->next;
+        printf("Error: No filename provided for decompressing.\n");
+    }
+}
+
+void shellRename(shell* state, char* command) {
+    strtok(command, " ");
+    char* oldName = strtok(NULL, " ");
+    char* newName = strtok(NULL, " ");
+    if (oldName && newName) {
+        // Locate the node with the old name
+        node* targetNode = getNodeTypeless(state->currentFolder, oldName);
+        if (targetNode) {
+            renameNode(targetNode, newName); // Call the updated rename function
+        } else {
+            printf("Error: Node '%s' not found in the current directory.\n", oldName);
         }
-        lastChild->next = newLink;
+    } else {
+        printf("Error: Insufficient arguments. Usage: rename <oldName> <newName>\n");
     }
+}
 
-    printf("Symbolic link '%s' -> '%s' created.\n", linkName, sourcePath);
-    return 0;
+void shellFullPath(shell* state, char* command) {
+    (void)command;
+    displayFullPath(state->currentFolder);
+    printf("\n");
 }
 
-// Compression (using zlib)
-// void compressDirectory(node* folder, const char* filename) {
-//     if (!folder) return;
+void shellLookup(shell* state, char* command) {
+    strtok(command, " ");
+    char* targetPath = strtok(NULL, " ");
+    if (!targetPath) {
+        printf("Error: Usage: lookup <path>\n");
+        return;
+    }
+    node* target = parsePath(state->currentFolder, targetPath, state->root);
+    if (target) {
+        const char* typeName = target->type == Folder ? "folder" : target->type == Symlink ? "symlink" : "file";
+        printf("%s: %s\n", targetPath, typeName);
+    }
+}
 
-//     FILE* file = fopen(filename, "wb");
-//     if (!file) {
-//         printf("Error: Unable to create compressed file '%s'.\n", filename);
-//         return;
-//     }
+void shellDedup(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    contentReport();
+}
 
-//     gzFile gzfile = gzdopen(fileno(file), "wb");
-//     if (!gzfile) {
-//         fclose(file);
-//         printf("Error: Unable to open compressed stream for '%s'.\n", filename);
-//         return;
-//     }
+void shellFlush(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    mirrorFlush();
+    mirrorReport();
+}
 
-//     // Save the directory structure into the compressed stream
-//     saveDirectory(folder, gzfile);
-//     gzclose(gzfile);
+void shellFind(shell* state, char* command) {
+    find(state->currentFolder, state->root, command);
+}
 
-//     printf("Directory compressed to '%s'.\n", filename);
-// }
+void shellImport(shell* state, char* command) {
+    if (importHostTree(state->currentFolder, command) == 0) {
+        journalReset(state->root); // Checkpointed rather than journaled node by node
+    }
+}
 
+void shellJournal(shell* state, char* command) {
+    (void)state;
+    (void)command;
+    journalReport();
+}
 
-// // Decompression (using zlib)
-// node* decompressDirectory(const char* filename) {
-//     FILE* file = fopen(filename, "rb");
-//     if (!file) {
-//         printf("Error: Unable to open compressed file '%s'.\n", filename);
-//         return NULL;
-//     }
+void shellCheckpoint(shell* state, char* command) {
+    (void)command;
+    if (!journal.base) {
+        printf("Error: No journal to checkpoint; start with -j <base>.\n");
+    } else if (journalCheckpoint(state->root) == 0) {
+        printf("Checkpoint written: journal generation %llu.\n", (unsigned long long)journal.generation);
+    }
+}
 
-//     gzFile gzfile = gzdopen(fileno(file), "rb");
-//     if (!gzfile) {
-//         fclose(file);
-//         printf("Error: Unable to open compressed stream for '%s'.\n", filename);
-//         return NULL;
-//     }
+// stats [reset | dump <file> [seconds] | dump off]
+void shellStats(shell* state, char* command) {
+    (void)state;
+    strtok(command, " ");
+    char* argument = strtok(NULL, " ");
+    char* filename = argument && strcmp(argument, "dump") == 0 ? strtok(NULL, " ") : NULL;
+    char* intervalText = filename ? strtok(NULL, " ") : NULL;
+    char* end = NULL;
+    double interval = intervalText ? strtod(intervalText, &end) : 10.0;
+
+    if (!argument) {
+        metricsPrint();
+    } else if (strcmp(argument, "reset") == 0 && !strtok(NULL, " ")) {
+        metricsReset();
+        printf("Statistics reset.\n");
+    } else if (filename && strcmp(filename, "off") == 0 && !intervalText) {
+        metricsPoll(1);
+        printf("Statistics dump stopped.\n");
+    } else if (filename && (!intervalText || (*end == '\0' && interval >= 0)) && !strtok(NULL, " ")) {
+        metricsPoll(1); // Finish the previous dump first
+        metrics.dump = fopen(filename, "a");
+        if (!metrics.dump) {
+            printf("Error: Unable to open '%s' for the statistics dump.\n", filename);
+            return;
+        }
+        metrics.dumpInterval = interval;
+        metricsPoll(0);
+        printf("Dumping statistics to '%s' every %g s.\n", filename, interval);
+    } else {
+        printf("Error: Usage: stats [reset | dump <file> [seconds] | dump off]\n");
+    }
+}
 
-//     // Create the root node
-//     node* folder = malloc(sizeof(node));
-//     folder->type = Folder;
-//     folder->name = strdup("/");
-//     folder->parent = NULL;
-//     folder->child = NULL;
-//     folder->next = NULL;
-//     folder->previous = NULL;
-//     folder->symlinkTarget = NULL;
-
-//     // Load the directory structure from the compressed stream
-//     folder->child = loadDirectory(gzfile, folder);
-//     gzclose(gzfile);
-
-//     printf("Directory decompressed from '%s'.\n", filename);
-//     return folder;
-// }
+void shellExit(shell* state, char* command) {
+    (void)command;
+    state->running = 0;
+}
 
-void displayPrompt(const char* path) {
-    printf("┌──[%s%s%s]\n└─%s>%s ", BLUE, path, RESET, GREEN, RESET);
+// Commands are matched on their whole first word, so "rm" no longer catches "rename"
+shellCommand commandTable[] = {
+    {"mkdir", shellMkdir, NULL},
+    {"touch", shellTouch, NULL},
+    {"ls", shellLs, shellViewLs},
+    {"lsrecursive", shellLsRecursive, shellViewLsRecursive},
+    {"edit", shellEdit, NULL},
+    {"append", shellAppend, NULL},
+    {"write", shellWrite, NULL},
+    {"clear", shellClear, shellClear},
+    {"pwd", shellPwd, shellPwd},
+    {"cdup", shellCdup, shellViewCdup},
+    {"cd", shellCd, shellCd},
+    {"rm", shellRm, NULL},
+    {"mov", shellMov, NULL},
+    {"echo", shellEcho, shellViewEcho},
+    {"count", shellCount, NULL},
+    {"pathcache", shellPathCache, shellPathCache},
+    {"countFiles", shellCountFiles, NULL},
+    {"countFolders", shellCountFolders, NULL},
+    {"save", shellSave, NULL},
+    {"load", shellLoad, NULL},
+    {"bgsave", shellBgsave, NULL},
+    {"lastsave", shellLastsave, shellLastsave},
+    {"merge", shellMerge, NULL},
+    {"symlink", shellSymlink, NULL},
+    {"sortBy", shellSortBy, NULL},
+    {"compress", shellCompress, NULL},
+    {"decompress", shellDecompress, NULL},
+    {"rename", shellRename, NULL},
+    {"fullpath", shellFullPath, NULL},
+    {"lookup", shellLookup, NULL},
+    {"flush", shellFlush, shellFlush},
+    {"dedup", shellDedup, shellDedup},
+    {"find", shellFind, NULL},
+    {"import", shellImport, NULL},
+    {"journal", shellJournal, shellJournal},
+    {"checkpoint", shellCheckpoint, NULL},
+    {"snapshot", shellSnapshot, shellSnapshot},
+    {"snapshots", shellSnapshots, shellSnapshots},
+    {"rollback", shellRollback, shellRollback},
+    {"stats", shellStats, shellStats},
+    {"exit", shellExit, shellExit},
+};
+
+#define COMMAND_COUNT (sizeof(commandTable) / sizeof(commandTable[0]))
+#define COMMAND_INDEX_SLOTS 64 // Power of two, comfortably above COMMAND_COUNT
+_Static_assert(COMMAND_COUNT <= METRICS_COMMAND_SLOTS, "metrics has no histogram for every command");
+
+// Open-addressed index from command name to table entry, built on first use
+shellCommand* commandIndex[COMMAND_INDEX_SLOTS];
+
+shellCommand* findCommand(const char* name) {
+    static int built = 0;
+    if (!built) {
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            size_t slot = hashName(commandTable[i].name) & (COMMAND_INDEX_SLOTS - 1);
+            while (commandIndex[slot]) slot = (slot + 1) & (COMMAND_INDEX_SLOTS - 1);
+            commandIndex[slot] = &commandTable[i];
+        }
+        built = 1;
+    }
+
+    size_t slot = hashName(name) & (COMMAND_INDEX_SLOTS - 1);
+    while (commandIndex[slot]) {
+        if (strcmp(commandIndex[slot]->name, name) == 0) return commandIndex[slot];
+        slot = (slot + 1) & (COMMAND_INDEX_SLOTS - 1);
+    }
+    return NULL;
 }
 
-// [Not Working] 
-// // Function to enable raw mode for real-time input
-// void enableRawMode() {
-//     struct termios raw;
-//     tcgetattr(STDIN_FILENO, &raw);
-//     raw.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
-//     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
-// }
+// Run one command line; its first word picks the handler. Returns the entry that ran, if any
+shellCommand* dispatchCommand(shell* state, char* command) {
+    size_t nameLength = strcspn(command, " ");
+    if (nameLength == 0) return NULL; // Blank line
+
+    char name[32];
+    shellCommand* entry = NULL;
+    if (nameLength < sizeof(name)) {
+        memcpy(name, command, nameLength);
+        name[nameLength] = '\0';
+        entry = findCommand(name);
+    }
 
-// // Function to restore the terminal to default mode
-// void disableRawMode() {
-//     struct termios raw;
-//     tcgetattr(STDIN_FILENO, &raw);
-//     raw.c_lflag |= (ICANON | ECHO); // Enable canonical mode and echo
-//     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
-// }
+    if (entry && state->view) {
+        if (entry->viewHandler) {
+            entry->viewHandler(state, command);
+        } else {
+            printf("Error: Snapshot @%u is read-only; 'cd @live' returns to the live tree.\n", state->view);
+        }
+    } else if (entry) {
+        entry->handler(state, command);
+    } else {
+        printf("Unknown command: %s\n", command);
+    }
+    return entry;
+}
 
-// // [Not Working] Function to read input in real-time with yellow color
-// char* getRealTimeInput() {
-//     enableRawMode();
+// Latency samples per command, collected when a report is requested with -r
+typedef struct commandTiming {
+    double* samples;         // Seconds per call
+    size_t count;
+    size_t capacity;
+} commandTiming;
+
+commandTiming commandTimings[COMMAND_COUNT];
+
+void recordCommandTime(shellCommand* entry, double seconds) {
+    commandTiming* timing = &commandTimings[entry - commandTable];
+    if (timing->count == timing->capacity) {
+        size_t capacity = timing->capacity ? timing->capacity * 2 : 1024;
+        double* samples = realloc(timing->samples, capacity * sizeof(double));
+        if (!samples) return;
+        timing->samples = samples;
+        timing->capacity = capacity;
+    }
+    timing->samples[timing->count++] = seconds;
+}
 
-//     char* input = malloc(1024);
-//     size_t length = 0;
+int compareSeconds(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-//     printf("%s", YELLOW); // Set input color to yellow
+// Append one JSON line per command that ran: calls, ops/s, p50/p99 latency and peak RSS
+void writeCommandReport(const char* filename) {
+    FILE* file = fopen(filename, "a");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open report file '%s'.\n", filename);
+        return;
+    }
 
-//     char c;
-//     while (read(STDIN_FILENO, &c, 1) == 1 && c != '\n') {
-//         if (c == 127) { // Handle backspace
-//             if (length > 0) {
-//                 length--;
-//                 printf("\b \b"); // Move cursor back and overwrite character
-//             }
-//         } else {
-//             input[length++] = c;
-//             printf("%c", c); // Print each character as it's typed
-//         }
-//     }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peakRssKiB = usage.ru_maxrss; // Kilobytes on Linux
+
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        commandTiming* timing = &commandTimings[i];
+        if (timing->count == 0) continue;
+
+        double total = 0;
+        for (size_t j = 0; j < timing->count; j++) total += timing->samples[j];
+        qsort(timing->samples, timing->count, sizeof(double), compareSeconds);
+        double p50 = timing->samples[(timing->count - 1) * 50 / 100];
+        double p99 = timing->samples[(timing->count - 1) * 99 / 100];
+
+        fprintf(file, "{\"command\":\"%s\",\"calls\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+                      "\"p50_us\":%.2f,\"p99_us\":%.2f,\"peak_rss_kb\":%ld,\"mirror\":%s}\n",
+                commandTable[i].name, timing->count, total, total > 0 ? (double)timing->count / total : 0.0,
+                p50 * 1e6, p99 * 1e6, peakRssKiB, mirrorEnabled ? "true" : "false");
+        free(timing->samples);
+        timing->samples = NULL;
+        timing->count = timing->capacity = 0;
+    }
+    fclose(file);
+}
 
-//     input[length] = '\0'; // Null-terminate the input
-//     printf("%s\n", RESET); // Reset color and print newline
+double elapsedSeconds(const struct timespec* start, const struct timespec* end) {
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
-//     disableRawMode();
+// A histogram's calls and latencies in microseconds, read from its buckets
+typedef struct latencySummary {
+    unsigned long long calls;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+} latencySummary;
+
+latencySummary histogramSummary(latencyHistogram* histogram) {
+    unsigned long long counts[HISTOGRAM_BUCKETS];
+    latencySummary summary = {0};
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        summary.calls += counts[i];
+    }
+    if (summary.calls == 0) return summary;
+    summary.mean = (double)atomic_load_explicit(&histogram->totalNs, memory_order_relaxed) / summary.calls / 1e3;
+
+    const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+    double* percentiles[4] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    unsigned long long seen = 0;
+    int next = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (counts[i] == 0) continue;
+        seen += counts[i];
+        double limit = (double)histogramBucketLimit(i) / 1e3;
+        while (next < 4 && seen >= fractions[next] * summary.calls) *percentiles[next++] = limit;
+        summary.max = limit;
+    }
+    return summary;
+}
 
-//     return input;
-// }
+const char* nodeTypeNames[3] = {"File", "Folder", "Symlink"};
 
-void displayNode(node* item) {
-    if (item->type == File) {
-        printf("%s%s%s\n", YELLOW, item->name, RESET);
-    } else if (item->type == Folder) {
-        printf("%s%s/%s\n", CYAN, item->name, RESET);
-    } else if (item->type == Symlink) {
-        printf("%s%s@%s\n", BLUE, item->name, RESET);
+// calls: all the calls, of which the histogram may hold a sample; 0 if it holds them all
+void metricsPrintRow(const char* name, latencyHistogram* histogram, unsigned long long calls) {
+    latencySummary summary = histogramSummary(histogram);
+    if (summary.calls == 0) return;
+    if (calls == 0) calls = summary.calls;
+    printf("%-22s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, calls,
+           summary.mean, summary.p50, summary.p90, summary.p99, summary.p999, summary.max);
+}
+
+// stats: every command and helper called since the last reset, then the nodes by type
+void metricsPrint(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Statistics of the last %.1f s (latencies in us, percentiles within 1/16; "
+           "getNode* and parsePath timed on 1 call in %d):\n", elapsedSeconds(&metrics.since, &now), METRICS_SAMPLE_PERIOD);
+    printf("%-22s %10s %10s %10s %10s %10s %10s %10s\n", "", "calls", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        metricsPrintRow(commandTable[i].name, &metrics.commands[i], 0);
+    }
+    for (size_t i = 0; i < HELPER_METRIC_COUNT; i++) {
+        metricsPrintRow(helperMetricNames[i], &metrics.helpers[i], atomic_load(&metrics.helperCalls[i]));
+    }
+
+    printf("%-22s %10s %10s %12s %12s %10s %12s\n", "Nodes", "created", "freed", "created B", "freed B", "live", "live B");
+    for (int type = 0; type < 3; type++) {
+        nodeAllocations* allocations = &metrics.allocations[type];
+        printf("%-22s %10llu %10llu %12llu %12llu %10zu %12zu\n", nodeTypeNames[type],
+               (unsigned long long)atomic_load(&allocations->created), (unsigned long long)atomic_load(&allocations->freed),
+               (unsigned long long)atomic_load(&allocations->createdBytes),
+               (unsigned long long)atomic_load(&allocations->freedBytes),
+               activeArena->usage[type].nodes, activeArena->usage[type].bytes);
     }
 }
 
+void histogramReset(latencyHistogram* histogram) {
+    atomic_store_explicit(&histogram->totalNs, 0, memory_order_relaxed);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&histogram->buckets[i], 0, memory_order_relaxed);
+    }
+}
 
-int main() {
+// stats reset: start every histogram and allocation count over; live node counts stay
+void metricsReset(void) {
+    for (size_t i = 0; i < COMMAND_COUNT; i++) histogramReset(&metrics.commands[i]);
+    for (size_t i = 0; i < HELPER_METRIC_COUNT; i++) {
+        histogramReset(&metrics.helpers[i]);
+        atomic_store(&metrics.helperCalls[i], 0);
+    }
+    for (int type = 0; type < 3; type++) {
+        atomic_store(&metrics.allocations[type].created, 0);
+        atomic_store(&metrics.allocations[type].freed, 0);
+        atomic_store(&metrics.allocations[type].createdBytes, 0);
+        atomic_store(&metrics.allocations[type].freedBytes, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &metrics.since);
+}
 
-    node *root = (node*) malloc(sizeof(node));
+void metricsDumpGroup(FILE* file, const char* group, const char* name, latencyHistogram* histogram,
+                      unsigned long long calls, int* first) {
+    latencySummary summary = histogramSummary(histogram);
+    if (summary.calls == 0) return;
+    if (calls == 0) calls = summary.calls;
+    fprintf(file, "%s{\"group\":\"%s\",\"name\":\"%s\",\"calls\":%llu,\"timed\":%llu,\"mean_us\":%.3f,"
+                  "\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f}",
+            *first ? "" : ",", group, name, calls, summary.calls, summary.mean, summary.p50, summary.p90, summary.p99,
+            summary.p999, summary.max);
+    *first = 0;
+}
 
-    char *rootName = (char *) malloc(sizeof(char)*2);
-    strcpy(rootName, "/");
-    root->type = Folder;
-    root->name = rootName;
-    root->numberOfItems = 0;
-    root->size = 0;
-    root->date = time(NULL);
-    root->content =NULL;
-    root->previous = NULL;
-    root->parent = NULL;
-    root->next = NULL;
-    root->child = NULL;
+// One JSON line with everything stats shows
+void metricsDump(FILE* file) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(file, "{\"time\":%lld,\"seconds\":%.3f,\"latencies\":[", (long long)time(NULL),
+            elapsedSeconds(&metrics.since, &now));
+    int first = 1;
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        metricsDumpGroup(file, "command", commandTable[i].name, &metrics.commands[i], 0, &first);
+    }
+    for (size_t i = 0; i < HELPER_METRIC_COUNT; i++) {
+        metricsDumpGroup(file, "helper", helperMetricNames[i], &metrics.helpers[i],
+                         atomic_load(&metrics.helperCalls[i]), &first);
+    }
+    fprintf(file, "],\"nodes\":{");
+    for (int type = 0; type < 3; type++) {
+        nodeAllocations* allocations = &metrics.allocations[type];
+        fprintf(file, "%s\"%s\":{\"created\":%llu,\"freed\":%llu,\"created_bytes\":%llu,\"freed_bytes\":%llu,"
+                      "\"live\":%zu,\"live_bytes\":%zu}",
+                type ? "," : "", nodeTypeNames[type], (unsigned long long)atomic_load(&allocations->created),
+                (unsigned long long)atomic_load(&allocations->freed),
+                (unsigned long long)atomic_load(&allocations->createdBytes),
+                (unsigned long long)atomic_load(&allocations->freedBytes),
+                activeArena->usage[type].nodes, activeArena->usage[type].bytes);
+    }
+    fprintf(file, "}}\n");
+    fflush(file);
+}
 
-    node *currentFolder = root;
+// Called between commands: dump the statistics once the interval has passed.
+// final writes a last line and ends the dump (stats dump off, exit)
+void metricsPoll(int final) {
+    if (!metrics.dump) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int due = metrics.lastDump.tv_sec == 0 || elapsedSeconds(&metrics.lastDump, &now) >= metrics.dumpInterval;
+    if (due || final) {
+        metricsDump(metrics.dump);
+        metrics.lastDump = now;
+    }
+    if (final) {
+        fclose(metrics.dump);
+        metrics.dump = NULL;
+        metrics.lastDump.tv_sec = 0;
+        metrics.lastDump.tv_nsec = 0;
+    }
+}
 
-    char *path = (char *) malloc(sizeof(char)*2);
-    strcpy(path, "/");
+int main(int argc, char* argv[]) {
+    inputStream = stdin;
+    const char* reportFile = NULL;
+    const char* journalBase = NULL;
+
+    // linux_file_system [-b script] [-n] [-r report.jsonl] [-j journal] [-u]
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && inputStream == stdin) {
+            inputStream = fopen(argv[++i], "r");
+            if (!inputStream) {
+                fprintf(stderr, "Error: Unable to open script '%s'.\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            mirrorEnabled = 0;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            reportFile = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            journalBase = argv[++i];
+        } else if (strcmp(argv[i], "-u") == 0) {
+            listing.unbuffered = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-b script] [-n] [-r report.jsonl] [-j journal] [-u]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (inputStream != stdin || !isatty(STDIN_FILENO)) {
+        batchMode = 1; // Commands come from a script or are piped in
+    }
 
-     // Path to the real file system
-    char currentPath[2048] = ".";
-    getRealPath(currentFolder, currentPath); // Initialize to real root
+    if (batchMode || !isatty(STDOUT_FILENO)) {
+        // No colors when nobody sees them; in batch mode no prompts either, and output goes out in large writes
+        YELLOW = CYAN = BLUE = GREEN = RESET = "";
+    }
+    if (batchMode) setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+    activeArena = arenaCreate();
+
+    shell state;
+    state.root = createNode(Folder, "/");
+    state.currentFolder = state.root;
+    state.path = strdup("/");
+    strcpy(state.currentPath, "."); // The mirror's root is the working directory
+    state.running = 1;
+    state.view = 0;
+    state.viewEpoch = 0;
+    state.viewFolders = NULL;
+    state.viewDepth = 0;
+    state.livePath = NULL;
+    if (journalBase) {
+        // Recover the tree from the last checkpoint and the journal written since
+        state.root = state.currentFolder = journalOpen(journalBase, state.root);
+        if (!state.root) {
+            arenaDestroy(activeArena);
+            free(state.path);
+            return 1;
+        }
+    }
 
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    metrics.since = start;
+    unsigned long long commandCount = 0;
 
-    while (1) {
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    while (state.running) {
+        if (!batchMode) displayPrompt(state.path);
 
-        displayPrompt(path);
-        char *command = getString();
+        ssize_t length = getline(&line, &lineCapacity, inputStream);
+        if (length < 0) break; // End of input acts like exit
+        if (length > 0 && line[length - 1] == '\n') line[--length] = '\0';
 
         // [Not Working] 
         // char *command = getRealTimeInput();
 
-        if (strncmp(command, "mkdir", 5) == 0) {
-            make_dir(currentFolder, command); // Pass the full path
-        } else if (strncmp(command, "touch", 5) == 0) {
-            touch(currentFolder, command, currentPath); // Pass the full path
-        } else if (strcmp(command, "ls") == 0) {
-            ls(currentFolder);
-        } else if (strcmp(command, "lsrecursive") == 0) {
-            lsrecursive(currentFolder, 0);
-        } else if (strncmp(command, "edit", 4) == 0 ) {
-            edit(currentFolder, command);
-        } else if (strncmp(command, "clear", 5) == 0) {
-            clear(); // Call the clear function
-        } else if (strcmp(command, "pwd") == 0) {
-            pwd(path);
-        } else if (strcmp(command, "cdup") == 0) {
-            currentFolder = cdup(currentFolder, &path);
-        } else if (strncmp(command, "cd", 2) == 0) {
-            currentFolder = cd(currentFolder, command, &path, root);
-        } else if (strncmp(command, "rm", 2) == 0) {
-            rm(currentFolder, command);
-        } else if (strncmp(command, "mov", 3) == 0) {
-            mov(currentFolder, command);
-        } else if (strncmp(command, "echo", 4) == 0) {
-            char* fileName = strtok(command + 5, " ");
-            if (fileName) {
-                echo(currentFolder, fileName, root);
-            } else {
-                printf("Error: No file name provided. Usage: echo <fileName>\n");
-            }
-        } else if (strcmp(command, "count") == 0) {
-            int fileCount = countFiles(currentFolder);
-            int folderCount = countFolders(currentFolder);
-            printf("Files: %d\nFolders: %d\n", fileCount, folderCount);
-        } else if (strcmp(command, "countFiles") == 0) {
-            printf("Total files: %d\n", countFiles(root));
-        } else if (strcmp(command, "countFolders") == 0) {
-            printf("Total folders: %d\n", countFolders(root));
-        } else if (strncmp(command, "save", 4) == 0) {
-            char* filename = strtok(command + 5, " ");
-            if (filename) {
-                saveDirectory(root, filename);  // Save the entire directory tree to the specified file
-            } else {
-                printf("Error: No filename provided for saving.\n");
-            }
+        backgroundSavePoll(0); // Report a background save that finished meanwhile
 
-            // char* filename = strtok(command + 5, " ");
-            // if (filename) {
-            //     // Use gz compression for saving the directory structure
-            //     FILE* file = fopen(filename, "wb");
-            //     if (file) {
-            //         gzFile gzfile = gzdopen(fileno(file), "wb");
-            //         if (gzfile) {
-            //             saveDirectory(root, gzfile);
-            //             gzclose(gzfile);
-            //             printf("Directory structure compressed and saved to '%s'.\n", filename);
-            //         } else {
-            //             fclose(file);
-            //             printf("Error: Unable to open compressed stream for '%s'.\n", filename);
-            //         }
-            //     } else {
-            //         printf("Error: Could not create file '%s' for saving.\n", filename);
-            //     }
-            // } else {
-            //     printf("Error: No filename provided for saving.\n");
-            // }
-        } else if (strncmp(command, "load", 4) == 0) {
-            char* filename = strtok(command + 5, " ");
-            if (filename) {
-                node* loadedRoot = loadDirectory(filename);  // Load the directory tree from the specified file
-                if (loadedRoot) {
-                    freeNode(root);      // Free the current directory tree in memory
-                    root = loadedRoot;   // Replace with the loaded directory tree
-                    currentFolder = root; // Reset current folder to the root of the loaded tree
-                    free(path);
-                    path = strdup("/");  // Reset the path to the root
-                }
-            } else {
-                printf("Error: No filename provided for loading.\n");
-            }
-            // char* filename = strtok(command + 5, " ");
-            // if (filename) {
-            //     // Use gz decompression for loading the directory structure
-            //     FILE* file = fopen(filename, "rb");
-            //     if (file) {
-            //         gzFile gzfile = gzdopen(fileno(file), "rb");
-            //         if (gzfile) {
-            //             freeNode(root); // Free the current directory tree in memory
-            //             root = (node*)malloc(sizeof(node));
-            //             root->type = Folder;
-            //             root->name = strdup("/");
-            //             root->child = loadDirectory(gzfile, root);
-            //             gzclose(gzfile);
-            //             currentFolder = root; // Reset current folder to root
-            //             printf("Directory structure decompressed and loaded from '%s'.\n", filename);
-            //         } else {
-            //             fclose(file);
-            //             printf("Error: Unable to open compressed stream for '%s'.\n", filename);
-            //         }
-            //     } else {
-            //         printf("Error: Could not open file '%s' for loading.\n", filename);
-            //     }
-            // } else {
-            //     printf("Error: No filename provided for loading.\n");
-            // }
-        } else if (strncmp(command, "merge", 5) == 0) {
-            char* srcName = strtok(command + 6, " ");
-            char* destName = strtok(NULL, " ");
-            if (srcName && destName) {
-                node* srcFolder = getNode(currentFolder, srcName, Folder);
-                node* destFolder = getNode(currentFolder, destName, Folder);
-                if (srcFolder && destFolder) {
-                    mergeDirectories(destFolder, srcFolder);
-                } else {
-                    printf("Error: One or both directories not found.\n");
-                }
-            }
-        } else if (strncmp(command, "symlink", 7) == 0) {
-            char* sourcePath = strtok(command + 8, " ");
-            char* linkName = strtok(NULL, " ");
-            if (sourcePath && linkName) {
-                createSymlink(currentFolder, sourcePath, linkName, root);
-            } else {
-                printf("Error: Invalid arguments. Usage: symlink <source> <linkName>\n");
-            }
-        } else if (strncmp(command, "sortBy", 6) == 0) {
-            char* criterion = strtok(command + 7, " ");
-            if (criterion && (strcmp(criterion, "name") == 0 || strcmp(criterion, "date") == 0)) {
-                sortDirectory(currentFolder, criterion);
-            } else {
-                printf("Error: Sort criterion must be 'name' or 'date'.\n");
-            }
-        } else if (strncmp(command, "compress", 8) == 0) {
-            // char* filename = strtok(command + 9, " ");
-            // if (filename) {
-            //     compressDirectory(root, filename);
-            // }
-        } else if (strncmp(command, "decompress", 10) == 0) {
-            // char* filename = strtok(command + 11, " ");
-            // if (filename) {
-            //     node* decompressedRoot = decompressDirectory(filename);
-            //     if (decompressedRoot) {
-            //         freeNode(root);
-            //         root = decompressedRoot;
-            //         currentFolder = root;
-            //     }
-            // }
-        } else if (strncmp(command, "rename", 6) == 0) {
-            char* oldName = strtok(command + 7, " ");
-    char* newName = strtok(NULL, " ");
-    if (oldName && newName) {
-            // Locate the node with the old name
-            node* targetNode = getNodeTypeless(currentFolder, oldName);
-                if (targetNode) {
-                    renameNode(targetNode, newName); // Call the updated rename function
-                } else {
-                    printf("Error: Node '%s' not found in the current directory.\n", oldName);
-                }
-            } else {
-                printf("Error: Insufficient arguments. Usage: rename <oldName> <newName>\n");
-            }
-        } else if (strncmp(command, "fullpath", 8) == 0) {
-            displayFullPath(currentFolder);
-            printf("\n");
-        } else if (strcmp(command, "exit") == 0){
-            free(command);
-            freeNode(root);
-            free(path);
-            break;
-        } else {
-            printf("Unknown command: %s\n", command);
+        uint64_t started = metricsNow();
+        shellCommand* entry = dispatchCommand(&state, line);
+        uint64_t finished = metricsNow();
+        if (entry) {
+            histogramRecord(&metrics.commands[entry - commandTable], finished - started);
+            if (reportFile) recordCommandTime(entry, (double)(finished - started) / 1e9);
         }
-
-        free(command);
+        journalAfterCommand(state.root);
+        metricsPoll(0);
+        commandCount++;
+    }
+    free(line);
+    if (bgsaveState.pid) {
+        printf("Waiting for the background save to '%s' to finish.\n", bgsaveState.filename);
+        backgroundSavePoll(1);
+    }
+    free(bgsaveState.lastFilename);
+    mirrorShutdown(); // Sync barrier: timings and the exit status cover the mirror too
+    journalShutdown();
+    if (reportFile) writeCommandReport(reportFile);
+    metricsPoll(1);
+
+    if (batchMode) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = elapsedSeconds(&start, &end);
+        fflush(stdout);
+        fprintf(stderr, "Batch: %llu commands in %.3fs (%.0f commands/s)\n",
+                commandCount, seconds, seconds > 0 ? (double)commandCount / seconds : 0.0);
+        if (inputStream != stdin) fclose(inputStream);
     }
 
+    pathCacheClear();
+    arenaDestroy(activeArena);
+    free(state.path);
+    free(state.viewFolders);
+    free(state.livePath);
     return 0;
 }
 
@@ -9,7 +9,7 @@ YELLOW="\e[33m"
 RESET="\e[0m"
 
 # Define the executable name
-EXECUTABLE="./linux_file_system.out" # Change this to the actual compiled program name
+EXECUTABLE="$(pwd)/linux_file_system.out" # Absolute, since the tests run inside $TEST_DIR
 
 # Check if executable exists
 if [[ ! -f "$EXECUTABLE" ]]; then
@@ -33,7 +33,7 @@ echo -e "${CYAN}Starting Unit and Integration Tests for Filesystem...${RESET}"
 
 # Test 1: Creating files and directories
 echo -e "${BLUE}Test 1:${RESET} Creating files and directories..."
-echo -e "mkdir folder1\nmkdir folder2\ncd folder1\ntouch file1.txt\ntouch file2.txt\ncd ..\nmkdir folder3" | $EXECUTABLE > /dev/null
+echo -e "mkdir folder1\nmkdir folder2\ncd folder1\ntouch file1.txt\ntouch file2.txt\ncd ..\nmkdir folder3\nexit" | $EXECUTABLE > /dev/null
 if [[ -d "folder1" && -f "folder1/file1.txt" && -f "folder1/file2.txt" && -d "folder2" && -d "folder3" ]]; then
     echo -e "${GREEN}PASS:${RESET} Directories and files created successfully."
 else
@@ -70,8 +70,203 @@ else
     echo -e "${RED}FAIL:${RESET} Directory structure loading failed."
 fi
 
-# Test 5: Checking for memory leaks using Valgrind
-echo -e "${BLUE}Test 5:${RESET} Running Valgrind for memory leak check..."
+# Test 5: Compressing to a gzip stream that standard tools can read
+echo -e "${BLUE}Test 5:${RESET} Compressing and decompressing the directory structure..."
+echo -e "mkdir docs\ncd docs\ntouch a.txt\ntouch b.txt\ncd /\ncompress -s 1 ../archive.gz\nsave -b ../archive.snap\ndecompress ../archive.gz\ncountFiles\nexit" | $EXECUTABLE > ../compress_output.txt
+if gunzip -c ../archive.gz | cmp -s - ../archive.snap && grep -q "Total files: 2" ../compress_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} Compressed archive is valid gzip and decompresses to the same tree."
+else
+    echo -e "${RED}FAIL:${RESET} Compression round trip failed."
+fi
+rm -f ../archive.gz ../archive.snap ../compress_output.txt
+
+# Test 6: Rejecting truncated and corrupted binary snapshots
+echo -e "${BLUE}Test 6:${RESET} Loading truncated and corrupted snapshots..."
+echo -e "touch a.txt\ntouch b.txt\nsave -b ../good.snap\nexit" | $EXECUTABLE -n > /dev/null
+head -c $(($(stat -c %s ../good.snap) - 40)) ../good.snap > ../truncated.snap
+cp ../good.snap ../corrupt.snap
+STRING_BYTES=$(od -An -t u8 -j 24 -N 8 ../good.snap | tr -d ' ')
+# Let the root claim one child and its first file claim the other
+printf '\x01' | dd of=../corrupt.snap bs=1 seek=$((32 + STRING_BYTES + 4)) conv=notrunc 2> /dev/null
+printf '\x01' | dd of=../corrupt.snap bs=1 seek=$((32 + STRING_BYTES + 88 + 4)) conv=notrunc 2> /dev/null
+# Claim a string table of 1 TiB
+cp ../good.snap ../oversized.snap
+printf '\x01' | dd of=../oversized.snap bs=1 seek=29 conv=notrunc 2> /dev/null
+echo -e "load -b ../truncated.snap\nload -b ../corrupt.snap\nload -m ../corrupt.snap\nls\nload -b ../oversized.snap\nexit" | $EXECUTABLE -n > ../corrupt_output.txt 2>&1
+if [[ $? -eq 0 && $(grep -c "^Error:" ../corrupt_output.txt) -eq 4 ]]; then
+    echo -e "${GREEN}PASS:${RESET} Corrupt snapshots were rejected."
+else
+    echo -e "${RED}FAIL:${RESET} A corrupt snapshot was accepted or crashed the loader."
+fi
+rm -f ../good.snap ../truncated.snap ../corrupt.snap ../oversized.snap ../corrupt_output.txt
+
+# Test 7: Snapshot views show the tree their snapshot saw
+echo -e "${BLUE}Test 7:${RESET} Changing the tree after a snapshot, then reading the snapshot..."
+echo -e "mkdir d\ncd d\ntouch f\nedit f\nold\ncd /\nsymlink d/f link\nsnapshot\nrename d dd\ncd dd\nrename f g\nedit g\nnew\ncd @1\ncd d\npwd\necho f\necho g\ncd /\ncd dd\necho link\nexit" | $EXECUTABLE -n > ../snapshot_output.txt 2>&1
+# Nodes created after a snapshot in a folder that was empty then, and freed again
+echo -e "snapshot\ntouch a\ncd @1\nls\necho a\nexit" | $EXECUTABLE -n >> ../snapshot_output.txt 2>&1
+echo -e "mkdir a\nrename a c\nsnapshot\nsnapshot\ncd c\nmkdir b\nsnapshot\ncd b\ntouch c\nmkdir a\ncd /\nrm c\ny\ncd @2\ncd c\ncd b\nls\nexit" | $EXECUTABLE -n >> ../snapshot_output.txt 2>&1
+if [[ $? -eq 0 && $(grep -c "^old$" ../snapshot_output.txt) -eq 2 ]] && grep -q "File 'g' not found" ../snapshot_output.txt &&
+   grep -q "no 'dd' folder" ../snapshot_output.txt && ! grep -q "^new$" ../snapshot_output.txt &&
+   grep -q "File 'a' not found" ../snapshot_output.txt && grep -q "no 'b' folder" ../snapshot_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} The snapshot shows the tree as it was when it was taken."
+else
+    echo -e "${RED}FAIL:${RESET} The snapshot view showed a change made after it was taken."
+fi
+rm -f ../snapshot_output.txt
+
+# Test 8: Recovering from the journal after a crash
+echo -e "${BLUE}Test 8:${RESET} Killing a journaled session and replaying its journal..."
+{ echo -e "mkdir keep\ncd keep\ntouch f.txt\nedit f.txt\nhello\ncd /\ncheckpoint\nmkdir after\nrename keep kept\ntouch last.txt"; sleep 10; } | $EXECUTABLE -n -j ../journal_test > /dev/null &
+JOURNALED=$!
+for i in $(seq 1 50); do
+    grep -qa "last.txt" ../journal_test.journal 2> /dev/null && break # Written, if not yet synced
+    sleep 0.1
+done
+kill -9 $JOURNALED
+wait $JOURNALED 2> /dev/null
+echo -e "ls\ncd kept\necho f.txt\nexit" | $EXECUTABLE -n -j ../journal_test > ../journal_output.txt
+if [[ -f ../journal_test.1.snap ]] && grep -q "generation 1, 3 changes replayed" ../journal_output.txt &&
+   grep -q "after/" ../journal_output.txt && grep -q "last.txt" ../journal_output.txt && grep -q "^hello$" ../journal_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} The checkpoint and the journaled changes after it were recovered."
+else
+    echo -e "${RED}FAIL:${RESET} Journal recovery lost or misapplied changes."
+fi
+
+# Test 9: Dropping a torn record at the end of the journal
+echo -e "${BLUE}Test 9:${RESET} Replaying a journal that ends in a partial record..."
+{ printf '\x60\x00\x00\x00'; head -c 44 /dev/zero; } >> ../journal_test.journal # Claims 96 bytes, holds 48
+echo -e "touch more.txt\nexit" | $EXECUTABLE -n -j ../journal_test > ../journal_output.txt
+echo -e "ls\nexit" | $EXECUTABLE -n -j ../journal_test >> ../journal_output.txt
+if grep -q "generation 1, 4 changes replayed" ../journal_output.txt && grep -q "more.txt" ../journal_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} The torn record was dropped and later changes were kept."
+else
+    echo -e "${RED}FAIL:${RESET} The torn record was not truncated from the journal."
+fi
+rm -f ../journal_test.* ../journal_output.txt
+
+# Test 10: Renaming and moving through the folders' name indexes
+echo -e "${BLUE}Test 10:${RESET} Renaming and moving files in a large folder..."
+{ echo "mkdir dest"; for i in $(seq 1 200); do echo "touch f$i"; done
+  echo -e "rename f7 renamed7\nrename f150 f7\nmov f42 dest\nlookup f7\nlookup renamed7\nlookup f150\nlookup f42\nlookup dest/f42\ntouch f42\nmov f42 dest\ncountFiles\nexit"; } | $EXECUTABLE -n > ../index_output.txt 2>&1
+if grep -q "^f7: file" ../index_output.txt && grep -q "^renamed7: file" ../index_output.txt &&
+   grep -q "'f150' not found" ../index_output.txt && grep -q "'f42' not found" ../index_output.txt &&
+   grep -q "^dest/f42: file" ../index_output.txt && grep -q "'f42' already exists in 'dest'" ../index_output.txt &&
+   grep -q "Total files: 201" ../index_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} Renamed and moved files are found under their new names only."
+else
+    echo -e "${RED}FAIL:${RESET} The name index disagrees with a rename or move."
+fi
+rm -f ../index_output.txt
+
+# Test 11: Path cache invalidation after rename, mov and rm
+echo -e "${BLUE}Test 11:${RESET} Resolving cached paths after the tree changes..."
+echo -e "mkdir a\ncd a\nmkdir b\ncd b\ntouch f\ncd /\nlookup /a/b/f\nlookup /a/b/f\nrename a x\nlookup /a/b/f\nlookup /x/b/f\nmkdir y\nmov x y\nlookup /x/b/f\nlookup /y/x/b/f\ncd /y/x\nrm b\ny\nlookup /y/x/b/f\ncd /\nlookup /z\nmkdir z\nlookup /z\npathcache\nexit" | $EXECUTABLE -n > ../pathcache_output.txt 2>&1
+if [[ $(grep -c "^/a/b/f: file" ../pathcache_output.txt) -eq 2 && $(grep -c "not found" ../pathcache_output.txt) -eq 4 ]] &&
+   grep -q "^/x/b/f: file" ../pathcache_output.txt && grep -q "^/y/x/b/f: file" ../pathcache_output.txt &&
+   grep -q "^/z: folder" ../pathcache_output.txt && ! grep -q "^Hits: 0 " ../pathcache_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} Cached paths followed every rename, move and removal."
+else
+    echo -e "${RED}FAIL:${RESET} A stale path cache entry was used."
+fi
+rm -f ../pathcache_output.txt
+
+# Test 12: Finding nodes by name and content
+echo -e "${BLUE}Test 12:${RESET} Searching the tree with find..."
+echo -e "mkdir docs\ncd docs\ntouch a.txt\nedit a.txt\nremember the TODO list\ntouch b.md\nedit b.md\nTODO too\nmkdir sub\ncd sub\ntouch c.txt\ncd /\nfind -name \"*.txt\"\nfind -content TODO\nfind docs -name \"*.txt\" -content TODO\nfind -regex \"T.DO l\" -t 2\nexit" | $EXECUTABLE -n > ../find_output.txt 2>&1
+if [[ $(grep -c "^/docs/a.txt$" ../find_output.txt) -eq 4 && $(grep -c "^/docs/b.md$" ../find_output.txt) -eq 1 &&
+      $(grep -c "^/docs/sub/c.txt$" ../find_output.txt) -eq 1 ]]; then
+    echo -e "${GREEN}PASS:${RESET} find matched names, contents and patterns."
+else
+    echo -e "${RED}FAIL:${RESET} find missed a match or reported a wrong one."
+fi
+rm -f ../find_output.txt
+
+# Test 13: Chunked file contents across chunk boundaries
+echo -e "${BLUE}Test 13:${RESET} Appending and writing across content chunks..."
+FIRST=$(head -c 5000 /dev/zero | tr '\0' a)
+SECOND=$(head -c 3000 /dev/zero | tr '\0' b)
+echo -e "touch big\nedit big\n$FIRST\nappend big\n$SECOND\nwrite big 4090\nXYZ\necho big\nexit" | $EXECUTABLE -n > ../chunk_output.txt 2>&1
+if [[ $(grep -A1 "^Contents of 'big':" ../chunk_output.txt | tail -1) == "${FIRST:0:4090}XYZ${FIRST:4093}$SECOND" ]]; then
+    echo -e "${GREEN}PASS:${RESET} Appended and overwritten bytes landed where they belong."
+else
+    echo -e "${RED}FAIL:${RESET} Chunked content was corrupted by append or write."
+fi
+rm -f ../chunk_output.txt
+
+# Test 14: Deduplicating identical file contents
+echo -e "${BLUE}Test 14:${RESET} Sharing identical contents and copying them on write..."
+echo -e "touch a\nedit a\nsame content\ntouch b\nedit b\nsame content\ntouch c\nedit c\nother\ndedup\nappend b\n more\necho a\necho b\ndedup\nexit" | $EXECUTABLE -n > ../dedup_output.txt 2>&1
+if grep -q "3 files, 2 distinct contents" ../dedup_output.txt && grep -q "12 saved" ../dedup_output.txt &&
+   grep -q "^same content$" ../dedup_output.txt && grep -q "^same content more$" ../dedup_output.txt &&
+   grep -q "3 files, 3 distinct contents" ../dedup_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} Identical contents were stored once and split on change."
+else
+    echo -e "${RED}FAIL:${RESET} Content deduplication miscounted or leaked a change into a shared copy."
+fi
+rm -f ../dedup_output.txt
+
+# Test 15: Importing a host directory tree
+echo -e "${BLUE}Test 15:${RESET} Importing a host directory with its contents..."
+mkdir -p ../import_src/sub
+echo "hello" > ../import_src/a.txt
+echo "deep" > ../import_src/sub/b.txt
+ln -s a.txt ../import_src/link
+echo -e "import ../import_src -c -t 2\ncd import_src\necho a.txt\ncd sub\necho b.txt\nexit" | $EXECUTABLE -n > ../import_output.txt 2>&1
+if grep -q "Imported 'import_src': 2 files, 2 folders, 1 symlinks, 11 bytes" ../import_output.txt &&
+   grep -q "^hello$" ../import_output.txt && grep -q "^deep$" ../import_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} The host tree was imported with its contents."
+else
+    echo -e "${RED}FAIL:${RESET} The import missed entries or contents."
+fi
+rm -rf ../import_src ../import_output.txt
+
+# Test 16: Name and date order from the folders' ordered indexes
+echo -e "${BLUE}Test 16:${RESET} Listing by name and date ranges..."
+# Files e, d, c, b, a dated 1000, 2000, ... 5000 seconds after the epoch
+{ echo -e '{\n"type": "Folder",\n"name": "/",\n"size": 0,\n"date": 0,\n"children": ['
+  date=1000
+  for name in e d c b a; do
+      echo -e "{\n\"type\": \"File\",\n\"name\": \"$name\",\n\"size\": 0,\n\"date\": $date,\n\"children\": [\n]\n},"
+      date=$((date + 1000))
+  done
+  echo -e ']\n}'; } > ../ordered.txt
+echo -e "load ../ordered.txt\nls --sort=name --from b --to e\nls --sort=date --from 2500 --limit 2\nsortBy date\nls\nrename a z\nsortBy name\nls\nexit" | $EXECUTABLE -n > ../order_output.txt 2>&1
+if [[ $(awk -F'\t' 'NF == 3 { printf "%s ", $3 }' ../order_output.txt) == "b c d c b e d c b a b c d e z " ]]; then
+    echo -e "${GREEN}PASS:${RESET} Ranges and sorted listings followed name and date order."
+else
+    echo -e "${RED}FAIL:${RESET} A listing was out of order."
+fi
+rm -f ../ordered.txt ../order_output.txt
+
+# Test 17: Incremental segmented saves
+echo -e "${BLUE}Test 17:${RESET} Saving a segmented snapshot twice and loading it back..."
+echo -e "mkdir a\nmkdir b\ncd a\ntouch f\nedit f\nfirst\ncd /b\ntouch g\ncd /\nsave -s ../tree.seg\ncd b\ntouch h\nedit h\nsecond\ncd /\nsave -s ../tree.seg\nexit" | $EXECUTABLE -n > ../segment_output.txt 2>&1
+echo -e "load -s ../tree.seg\ncountFiles\ncd a\necho f\ncd /b\necho h\nexit" | $EXECUTABLE -n >> ../segment_output.txt 2>&1
+if grep -q "(full: 3 folders and 1 contents encoded" ../segment_output.txt &&
+   grep -q "(incremental: 2 folders and 1 contents encoded" ../segment_output.txt &&
+   grep -q "Total files: 3" ../segment_output.txt && grep -q "^first$" ../segment_output.txt && grep -q "^second$" ../segment_output.txt; then
+    echo -e "${GREEN}PASS:${RESET} The second save only encoded the changed folders, and the file loads back whole."
+else
+    echo -e "${RED}FAIL:${RESET} The incremental save rewrote too much or lost a change."
+fi
+rm -f ../tree.seg ../segment_output.txt
+
+# Test 18: Background saves
+echo -e "${BLUE}Test 18:${RESET} Saving in the background while the shell keeps working..."
+{ echo -e "mkdir a\ncd a\ntouch f\nedit f\nbackground\ncd /\nbgsave -b ../background.snap\nmkdir after"; sleep 1; echo -e "lastsave\nexit"; } | $EXECUTABLE -n > ../bgsave_output.txt 2>&1
+echo -e "load -b ../background.snap\nlsrecursive\ncd a\necho f\nexit" | $EXECUTABLE -n > ../bgsave_load.txt 2>&1
+if grep -q "Background save to '../background.snap' started" ../bgsave_output.txt &&
+   grep -q "Last background save: '../background.snap' succeeded at .*, 3 nodes" ../bgsave_output.txt &&
+   grep -q "^background$" ../bgsave_load.txt && ! grep -q "after" ../bgsave_load.txt && [[ $(ls ../background.snap*) == "../background.snap" ]]; then
+    echo -e "${GREEN}PASS:${RESET} The background save wrote the tree as it was at the fork."
+else
+    echo -e "${RED}FAIL:${RESET} The background save failed or did not capture the tree at the fork."
+fi
+rm -f ../background.snap* ../bgsave_output.txt ../bgsave_load.txt
+
+# Test 19: Checking for memory leaks using Valgrind
+echo -e "${BLUE}Test 19:${RESET} Running Valgrind for memory leak check..."
 valgrind --leak-check=full --error-exitcode=1 --log-file=valgrind.log $EXECUTABLE < /dev/null > /dev/null
 if [[ $? -eq 0 ]]; then
     echo -e "${GREEN}PASS:${RESET} No memory leaks detected."